@@ -3,6 +3,23 @@
 #include <stdio.h>
 #include <fstream>
 #include <string.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#if defined(_WIN32)
+#include <memory>
+#include <process.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SPIRV_MAGIC 0x07230203
 
 const char* SME::VkUtil::translateVkResult(VkResult result){
     #define ENUMCASE(e) case(e): return #e
@@ -45,33 +62,233 @@ bool SME::VkUtil::checkExtensionAvailabile(std::vector<VkExtensionProperties> av
     return false;
 }
 
+//Read only view of a whole file, memory mapped where available
+struct MappedFile {
+    const uint32_t* data = nullptr;
+    size_t size = 0;
+    #if defined(_WIN32)
+    std::unique_ptr<uint32_t[]> buffer;
+    #endif
+    
+    ~MappedFile(){
+        #if !defined(_WIN32)
+        if(data != nullptr){
+            munmap(const_cast<uint32_t*>(data), size);
+        }
+        #endif
+    }
+};
+
+bool mapFile(const char* filename, MappedFile &file){
+    #if defined(_WIN32)
+    std::ifstream stream(filename, std::ios::in|std::ios::binary|std::ios::ate);
+    if(!stream.is_open()){
+        return false;
+    }
+    file.size = static_cast<size_t>(stream.tellg());
+    file.buffer.reset(new uint32_t[(file.size + 3) / 4]);
+    stream.seekg(0, std::ios::beg);
+    stream.read(reinterpret_cast<char*>(file.buffer.get()), file.size);
+    file.data = file.buffer.get();
+    return static_cast<bool>(stream);
+    #else
+    int descriptor = open(filename, O_RDONLY);
+    if(descriptor == -1){
+        return false;
+    }
+    struct stat fileStat;
+    if(fstat(descriptor, &fileStat) != 0 || fileStat.st_size == 0){
+        close(descriptor);
+        return false;
+    }
+    //pages are aligned, so the words can be read in place
+    void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if(mapping == MAP_FAILED){
+        return false;
+    }
+    file.data = static_cast<const uint32_t*>(mapping);
+    file.size = fileStat.st_size;
+    return true;
+    #endif
+}
+
+bool loadSpirv(const char* filename, MappedFile &file){
+    if(!mapFile(filename, file)){
+        fprintf(stderr, "Couldn't open shader file %s!\n", filename);
+        return false;
+    }
+    if(file.size < 5 * sizeof(uint32_t) || file.size % sizeof(uint32_t) != 0){
+        fprintf(stderr, "Shader file %s is not a SPIR-V binary, its size of %zu bytes is not a multiple of 4!\n", filename, file.size);
+        return false;
+    }
+    if(file.data[0] != SPIRV_MAGIC){
+        fprintf(stderr, "Shader file %s is not a SPIR-V binary, wrong magic number 0x%08x!\n", filename, file.data[0]);
+        return false;
+    }
+    return true;
+}
+
 bool SME::VkUtil::createShaderModule(VkShaderModule* shaderModule, VkDevice device, const char* filename){
-    std::ifstream file(filename, std::ios::in|std::ios::binary|std::ios::ate);
-    if(file.is_open()){
-        std::streampos size = file.tellg();
-        char* code = new char[size];
-        file.seekg(0, std::ios::beg);
-        file.read(code, size);
-        file.close();
+    MappedFile file;
+    if(!loadSpirv(filename, file)){
+        return false;
+    }
+    
+    VkShaderModuleCreateInfo shaderModuleInfo = {
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,    //sType
+        nullptr,                                        //pNext
+        0,                                              //flags
+        file.size,                                      //codeSize
+        file.data                                       //codePointer
+    };
+    
+    VkResult result = vkCreateShaderModule(device, &shaderModuleInfo, nullptr, shaderModule);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create shader module from file %s: %d (%s)\n", filename, result, translateVkResult(result));
+        return false;
+    }
+    return true;
+}
+
+//Shader registry, modules are shared between everyone loading the same code
+struct RegisteredShader {
+    VkDevice device;
+    VkShaderModule module;
+    uint32_t referenceCount;
+    uint64_t hash;
+    std::string filename; //mapped again to tell hash collisions apart
+};
+
+std::mutex shaderRegistryMutex;
+std::multimap<uint64_t, RegisteredShader*> shadersByHash;
+std::map<std::pair<VkDevice, VkShaderModule>, RegisteredShader*> shadersByModule; //handles of different devices may be equal
+std::map<std::pair<VkDevice, std::string>, RegisteredShader*> shadersByFile; //skips reading files already loaded
+
+uint64_t hashSpirv(const uint32_t* code, size_t size){
+    //FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < size / sizeof(uint32_t); i++){
+        hash = (hash ^ code[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool SME::VkUtil::acquireShaderModule(VkShaderModule* shaderModule, VkDevice device, const char* filename){
+    std::lock_guard<std::mutex> lock(shaderRegistryMutex);
+    
+    std::map<std::pair<VkDevice, std::string>, RegisteredShader*>::iterator byFile = shadersByFile.find(std::make_pair(device, std::string(filename)));
+    if(byFile != shadersByFile.end()){
+        byFile->second->referenceCount++;
+        *shaderModule = byFile->second->module;
+        return true;
+    }
+    
+    MappedFile file;
+    if(!loadSpirv(filename, file)){
+        return false;
+    }
+    
+    //the same code may have been loaded from a different file
+    uint64_t hash = hashSpirv(file.data, file.size);
+    RegisteredShader* shader = nullptr;
+    std::pair<std::multimap<uint64_t, RegisteredShader*>::iterator, std::multimap<uint64_t, RegisteredShader*>::iterator> candidates = shadersByHash.equal_range(hash);
+    for(std::multimap<uint64_t, RegisteredShader*>::iterator it = candidates.first; it != candidates.second; ++it){
+        if(it->second->device != device){
+            continue;
+        }
+        //hashes rarely collide, so the code is only kept on disk; a file
+        //changed since it was loaded just doesn't share its module
+        MappedFile registered;
+        if(mapFile(it->second->filename.c_str(), registered) && registered.size == file.size
+                && memcmp(registered.data, file.data, file.size) == 0){
+            shader = it->second;
+            break;
+        }
+    }
+    
+    if(shader == nullptr){
+        shader = new RegisteredShader{device, VK_NULL_HANDLE, 0, hash, filename};
         
         VkShaderModuleCreateInfo shaderModuleInfo = {
             VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,    //sType
             nullptr,                                        //pNext
             0,                                              //flags
-            static_cast<size_t>(size),                      //codeSize
-            reinterpret_cast<const uint32_t*>(&code[0])     //codePointer
+            file.size,                                      //codeSize
+            file.data                                       //codePointer
         };
         
-        VkResult result = vkCreateShaderModule(device, &shaderModuleInfo, nullptr, shaderModule);
-        delete[] code;
+        VkResult result = vkCreateShaderModule(device, &shaderModuleInfo, nullptr, &shader->module);
         if (result != VK_SUCCESS) {
             fprintf(stderr, "Failed to create shader module from file %s: %d (%s)\n", filename, result, translateVkResult(result));
+            delete shader;
             return false;
+        }
+        shadersByHash.insert(std::make_pair(hash, shader));
+        shadersByModule[std::make_pair(device, shader->module)] = shader;
+    }
+    
+    shadersByFile[std::make_pair(device, std::string(filename))] = shader;
+    shader->referenceCount++;
+    *shaderModule = shader->module;
+    return true;
+}
+
+void SME::VkUtil::releaseShaderModule(VkDevice device, VkShaderModule shaderModule){
+    std::lock_guard<std::mutex> lock(shaderRegistryMutex);
+    
+    std::map<std::pair<VkDevice, VkShaderModule>, RegisteredShader*>::iterator byModule = shadersByModule.find(std::make_pair(device, shaderModule));
+    if(byModule == shadersByModule.end()){
+        return;
+    }
+    RegisteredShader* shader = byModule->second;
+    if(--shader->referenceCount > 0){
+        return;
+    }
+    
+    for(std::map<std::pair<VkDevice, std::string>, RegisteredShader*>::iterator it = shadersByFile.begin(); it != shadersByFile.end(); ){
+        if(it->second == shader){
+            it = shadersByFile.erase(it);
         } else {
-            return true;
+            ++it;
         }
-    } else {
-        fprintf(stderr, "Couldn't open file!\n");
-        return false;
     }
-}
\ No newline at end of file
+    std::pair<std::multimap<uint64_t, RegisteredShader*>::iterator, std::multimap<uint64_t, RegisteredShader*>::iterator> candidates = shadersByHash.equal_range(shader->hash);
+    for(std::multimap<uint64_t, RegisteredShader*>::iterator it = candidates.first; it != candidates.second; ++it){
+        if(it->second == shader){
+            shadersByHash.erase(it);
+            break;
+        }
+    }
+    shadersByModule.erase(byModule);
+    
+    vkDestroyShaderModule(shader->device, shader->module, nullptr);
+    delete shader;
+}
+
+bool SME::VkUtil::replaceFile(const char* path, const std::function<bool(std::ofstream &file)>& write){
+    //unique to the process and the call, so concurrent writers never share one
+    static std::atomic<uint32_t> temporaryCount(0);
+    #if defined(_WIN32)
+    int processId = _getpid();
+    #else
+    int processId = getpid();
+    #endif
+    std::string temporaryPath = std::string(path) + "." + std::to_string(processId) + "." + std::to_string(temporaryCount++) + ".tmp";
+    
+    bool written;
+    {
+        std::ofstream file(temporaryPath, std::ios::out|std::ios::binary|std::ios::trunc);
+        written = file.is_open() && write(file) && file.flush();
+    }
+    
+    #if defined(_WIN32)
+    written = written && MoveFileExA(temporaryPath.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+    #else
+    written = written && rename(temporaryPath.c_str(), path) == 0;
+    #endif
+    if(!written){
+        remove(temporaryPath.c_str());
+    }
+    return written;
+}
@@ -2,6 +2,9 @@
 #define SME_VKUTIL_H
 
 #include <vector>
+#include <stdint.h>
+#include <fstream>
+#include <functional>
 #include <vulkan/vulkan.h>
 
 namespace SME { namespace VkUtil {
@@ -23,7 +26,9 @@ namespace SME { namespace VkUtil {
     bool checkExtensionAvailabile(std::vector<VkExtensionProperties> availableExtensions, const char* extensionName);
     
     /**
-     * Creates (loads) a shader module from the given file
+     * Creates (loads) a shader module from the given file. The file is memory
+     * mapped rather than copied, and rejected if it isn't SPIR-V. The caller
+     * owns the module, see acquireShaderModule for a shared one.
      * @param shaderModule the VkShaderModule pointer in which to store the shader module
      * @param device device on which to create the shader module
      * @param filename the name of the file to be loaded and fed into Vulkan.
@@ -31,6 +36,38 @@ namespace SME { namespace VkUtil {
      * @return true if it was successfully loaded, false if it wasn't
      */
     bool createShaderModule(VkShaderModule* shaderModule, VkDevice device, const char* filename);
+    
+    /**
+     * Gets a shader module for the given file from the shader registry. A file
+     * is only read the first time it is acquired, and files with identical
+     * code share a single module. Safe to call from multiple threads.
+     * @param shaderModule the VkShaderModule pointer in which to store the shader module
+     * @param device device on which to create the shader module
+     * @param filename the name of the file to be loaded and fed into Vulkan.
+     * Must be a binary SPIR file.
+     * @return true if the module is available, false if it couldn't be loaded
+     */
+    bool acquireShaderModule(VkShaderModule* shaderModule, VkDevice device, const char* filename);
+    
+    /**
+     * Gives back a shader module obtained from acquireShaderModule. The module
+     * is destroyed once every acquisition of it has been released, which must
+     * happen before its device is destroyed.
+     * @param device device the module was acquired on
+     * @param shaderModule the shader module to release
+     */
+    void releaseShaderModule(VkDevice device, VkShaderModule shaderModule);
+    
+    /**
+     * Writes a file through a temporary file next to it, which then replaces
+     * it in a single rename. A crash or a concurrent writer never leaves a
+     * partly written file behind, readers see the old file or the new one.
+     * @param path the file to write
+     * @param write writes the contents to the temporary file, returns false
+     * to abandon it and leave the file as it was
+     * @return true if the file was replaced, false otherwise
+     */
+    bool replaceFile(const char* path, const std::function<bool(std::ofstream &file)>& write);
 }}
 
 #endif /* SME_VKUTIL_H */
@@ -1,73 +1,409 @@
 #include "SME_buffer.h"
 #include "SME_VkUtil.h"
+#include "SME_memory.h"
 #include <iostream>
 #include <cstring>
-#include <SME_core.h>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 
-VkQueue transferQueue;
-VkCommandPool transferQueueCommandPool;
-VkCommandBuffer transferCommandBuffer;
-SME::Buffer transferBuffer;
+//A batch of copies out of the staging ring, submitted at once
+struct StagingSubmission {
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    VkDeviceSize size; //bytes of the ring consumed, including padding skipped when wrapping
+    SME::Buffer::UploadToken token;
+    std::vector<VkBuffer> buffers; //written by the batch, released to the graphics queue family
+};
 
-void cleanup(){
-    transferBuffer.~Buffer();
+//A buffer being copied to a better place by the defragmentation
+struct BufferMove {
+    SME::Buffer* buffer; //null if it was destroyed meanwhile
+    VkBuffer handle;
+    SME::Memory::Allocation allocation;
+    uint64_t frame; //frame whose command buffer copies it
+    uint64_t writeCount;
+};
+
+//A buffer replaced by the defragmentation, frames before frame may still use it
+struct RetiredBuffer {
+    VkBuffer handle;
+    SME::Memory::Allocation allocation;
+    uint64_t frame;
+};
+
+//An upload to a buffer the graphics queue family owns, staged in a pooled host
+//visible buffer and copied by the upload command buffer of a frame
+struct GraphicsUpload {
+    SME::Buffer staging; //given back to the pool once the copy is recorded
+    VkBuffer destination;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    SME::Buffer::UploadToken token;
+    bool recorded;
+    uint64_t frame; //frame whose command buffer copies it, once recorded
+};
+
+//Transfer resources of one logical device
+struct TransferState {
+    uint32_t familyIndex;
+    uint32_t graphicsFamilyIndex; //uploaded buffers change ownership to it if it differs
+    VkPhysicalDevice physicalDevice;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    SME::Buffer buffer; //staging ring, persistently mapped
+    VkDeviceSize ringSize;
+    VkDeviceSize head; //where the next chunk is written
+    VkDeviceSize used; //bytes between the oldest pending batch and head
+    StagingSubmission batch; //being recorded, not submitted yet
+    bool batchOpen;
+    SME::Buffer::UploadToken nextToken; //token of the next batch to be opened
+    SME::Buffer::UploadToken completedToken; //every batch up to this one is done
+    std::deque<StagingSubmission> pending; //oldest first
+    std::vector<StagingSubmission> idle;
+    std::vector<VkBuffer> acquires; //uploaded by finished batches, not acquired by the graphics queue yet
+    std::vector<GraphicsUpload> graphicsUploads; //until the frame copying them is done
+    SME::BufferPool* graphicsStagingPool;
+    SME::Buffer::UploadToken nextGraphicsToken;
+    std::condition_variable graphicsUploadsDone; //notified whenever graphicsUploads shrinks
+    std::vector<SME::Buffer*> buffers; //device local buffers that can be moved
+    size_t defragmentCursor;
+    bool defragmentIdle; //the last pass over the buffers found none to move
+    std::vector<BufferMove> moves;
+    std::vector<RetiredBuffer> retired;
+    std::mutex mutex; //the staging ring, command buffers and queue are shared by every upload
+};
+
+std::mutex transferStatesMutex;
+std::map<VkDevice, TransferState*> transferStates;
+VkDeviceSize stagingBufferSize = SME_TRANSFER_BUFFER_SIZE;
+
+//stages and accesses that may read uploaded buffers, including defragmentation copies
+const VkPipelineStageFlags uploadReadStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+        | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+const VkAccessFlags uploadReadAccess = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+        | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+TransferState* getTransferState(VkDevice device){
+    std::lock_guard<std::mutex> lock(transferStatesMutex);
+    std::map<VkDevice, TransferState*>::iterator it = transferStates.find(device);
+    return it != transferStates.end() ? it->second : nullptr;
+}
+
+void SME::Buffer::setStagingBufferSize(VkDeviceSize size){
+    stagingBufferSize = size;
 }
 
-bool SME::Buffer::initTransferBuffer(uint32_t familyIndex, VkDevice device, VkPhysicalDevice physicalDevice){
-    vkGetDeviceQueue(device, familyIndex, 0, &transferQueue);
+bool SME::Buffer::initTransferBuffer(uint32_t familyIndex, uint32_t graphicsFamilyIndex, VkDevice device, VkPhysicalDevice physicalDevice){
+    TransferState* state = new TransferState();
+    {
+        std::lock_guard<std::mutex> lock(transferStatesMutex);
+        transferStates[device] = state;
+    }
+    
+    state->familyIndex = familyIndex;
+    state->graphicsFamilyIndex = graphicsFamilyIndex;
+    state->physicalDevice = physicalDevice;
+    vkGetDeviceQueue(device, familyIndex, 0, &state->queue);
+    state->nextToken = 1;
+    state->nextGraphicsToken = SME::Buffer::graphicsQueueToken | 1;
+    state->graphicsStagingPool = new SME::BufferPool(device, physicalDevice);
     
     VkCommandPoolCreateInfo cmdPoolInfo = {
         VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
         nullptr,
-        0,
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
         familyIndex
     };
     
-    VkResult result = vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &transferQueueCommandPool);
+    VkResult result = vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &state->commandPool);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed creating transfer command pool: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
+    //at least two chunks fit, so one can be written while the other is copied
+    state->ringSize = std::max<VkDeviceSize>(stagingBufferSize, 2 * SME_STAGING_ALIGNMENT);
+    state->ringSize -= state->ringSize % (2 * SME_STAGING_ALIGNMENT);
+    
+    VkBufferCreateInfo bufferInfo = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,   // sType
+        nullptr,                                // *pNext
+        0,                                      // flags
+        state->ringSize,                        // size
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,       // usage
+        VK_SHARING_MODE_EXCLUSIVE,              // sharingMode
+        0,                                      // queueFamilyIndexCount
+        nullptr                                 // *pQueueFamilyIndices
+    };
+    
+    if(!state->buffer.createBuffer(&bufferInfo, device, physicalDevice)){
+        fprintf(stderr, "Failed creating transfer buffer!\n");
+        return false;
+    }
+    
+    return true;
+}
+
+//barriers moving whole buffers from the transfer queue family to the graphics one
+std::vector<VkBufferMemoryBarrier> ownershipBarriers(TransferState* state, const std::vector<VkBuffer> &buffers, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask){
+    std::vector<VkBufferMemoryBarrier> barriers;
+    barriers.reserve(buffers.size());
+    for(VkBuffer buffer : buffers){
+        barriers.push_back({
+            VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,    //sType
+            nullptr,                                    //*pNext
+            srcAccessMask,                              //srcAccessMask
+            dstAccessMask,                              //dstAccessMask
+            state->familyIndex,                         //srcQueueFamilyIndex
+            state->graphicsFamilyIndex,                 //dstQueueFamilyIndex
+            buffer,                                     //buffer
+            0,                                          //offset
+            VK_WHOLE_SIZE                               //size
+        });
+    }
+    return barriers;
+}
+
+//frees the ring space of every batch the gpu is done with, waiting for the
+//oldest one first if requested
+bool reclaimStagingSpace(VkDevice device, TransferState* state, bool waitForOldest){
+    while(!state->pending.empty()){
+        StagingSubmission &oldest = state->pending.front();
+        VkResult result = waitForOldest ? vkWaitForFences(device, 1, &oldest.fence, VK_TRUE, UINT64_MAX) : vkGetFenceStatus(device, oldest.fence);
+        if(result == VK_NOT_READY){
+            break;
+        } else if(result != VK_SUCCESS){
+            fprintf(stderr, "Failed waiting for staging batch: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+        waitForOldest = false;
+        
+        state->used -= oldest.size;
+        state->completedToken = oldest.token;
+        state->acquires.insert(state->acquires.end(), oldest.buffers.begin(), oldest.buffers.end());
+        state->idle.push_back(oldest);
+        state->pending.pop_front();
+    }
+    if(state->pending.empty()){
+        state->used = state->batchOpen ? state->batch.size : 0;
+        if(state->used == 0){
+            state->head = 0;
+        }
+    }
+    return true;
+}
+
+//reserves a contiguous range of the ring, blocking until the gpu frees enough
+//of it. Fails if only the open batch could free it
+bool reserveStagingSpace(VkDevice device, TransferState* state, VkDeviceSize size, VkDeviceSize* offset){
+    size = (size + SME_STAGING_ALIGNMENT - 1) / SME_STAGING_ALIGNMENT * SME_STAGING_ALIGNMENT;
+    if(!reclaimStagingSpace(device, state, false)){
+        return false;
+    }
+    while(true){
+        //ranges never wrap around, the end of the ring is skipped instead
+        bool wraps = state->head + size > state->ringSize;
+        VkDeviceSize consumed = wraps ? state->ringSize - state->head + size : size;
+        if(state->used + consumed <= state->ringSize){
+            *offset = wraps ? 0 : state->head;
+            state->head = *offset + size;
+            state->used += consumed;
+            state->batch.size += consumed;
+            return true;
+        }
+        if(state->pending.empty() || !reclaimStagingSpace(device, state, true)){
+            return false;
+        }
+    }
+}
+
+bool getStagingSubmission(VkDevice device, TransferState* state, StagingSubmission* submission){
+    if(!state->idle.empty()){
+        *submission = state->idle.back();
+        state->idle.pop_back();
+        vkResetFences(device, 1, &submission->fence);
+        return true;
+    }
+    
     VkCommandBufferAllocateInfo cmdBufferAllocateInfo;    
     cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     cmdBufferAllocateInfo.pNext = nullptr;
-    cmdBufferAllocateInfo.commandPool = transferQueueCommandPool;
+    cmdBufferAllocateInfo.commandPool = state->commandPool;
     cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     cmdBufferAllocateInfo.commandBufferCount = 1;
     
-    result = vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &transferCommandBuffer);
+    VkResult result = vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &submission->commandBuffer);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed allocating transfer command buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
-    VkBufferCreateInfo bufferInfo = {
-        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,   // sType
-        nullptr,                                // *pNext
-        0,                                      // flags
-        SME_TRANSFER_BUFFER_SIZE,               // size
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,       // usage
-        VK_SHARING_MODE_EXCLUSIVE,              // sharingMode
-        0,                                      // queueFamilyIndexCount
-        nullptr                                 // *pQueueFamilyIndices
+    VkFenceCreateInfo fenceInfo = {
+        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,    //sType
+        nullptr,                                //pNext
+        0                                       //flags
     };
     
-    if(!transferBuffer.createBuffer(&bufferInfo, device, physicalDevice)){
-        fprintf(stderr, "Failed creating transfer buffer!\n");
+    result = vkCreateFence(device, &fenceInfo, nullptr, &submission->fence);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed creating transfer fence: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        vkFreeCommandBuffers(device, state->commandPool, 1, &submission->commandBuffer);
+        return false;
+    }
+    return true;
+}
+
+bool beginStagingBatch(VkDevice device, TransferState* state){
+    if(!getStagingSubmission(device, state, &state->batch)){
         return false;
     }
+    state->batch.size = 0;
+    state->batch.token = state->nextToken++;
+    state->batch.buffers.clear();
+    state->batchOpen = true;
+    
+    VkCommandBufferBeginInfo cmdBufferBegininfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        //sType
+        nullptr,                                            //*pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,        //flags
+        nullptr                                             //*pInheritanceInfo
+    };
+    vkBeginCommandBuffer(state->batch.commandBuffer, &cmdBufferBegininfo);
+    
+    if(state->familyIndex == state->graphicsFamilyIndex){
+        //the batch runs on the graphics queue, after frames that may still
+        //read the buffers it overwrites
+        vkCmdPipelineBarrier(state->batch.commandBuffer, uploadReadStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    }
+    return true;
+}
+
+//whether a release of the buffer to the graphics queue family is recorded
+//or in flight, so the graphics queue doesn't own it yet
+bool isBeingReleased(TransferState* state, VkBuffer buffer){
+    if(state->batchOpen && std::find(state->batch.buffers.begin(), state->batch.buffers.end(), buffer) != state->batch.buffers.end()){
+        return true;
+    }
+    for(StagingSubmission &submission : state->pending){
+        if(std::find(submission.buffers.begin(), submission.buffers.end(), buffer) != submission.buffers.end()){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool submitStagingBatch(TransferState* state){
+    if(!state->batchOpen){
+        return true;
+    }
+    state->batchOpen = false;
     
-    SME::Core::addCleanupHook(cleanup);
+    if(state->familyIndex == state->graphicsFamilyIndex){
+        //one barrier for every copy in the batch
+        VkMemoryBarrier memoryBarrier = {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,                   //sType
+            nullptr,                                            //*pNext
+            VK_ACCESS_TRANSFER_WRITE_BIT,                       //srcAccessMask
+            uploadReadAccess                                    //dstAccessMask
+        };
+        vkCmdPipelineBarrier(state->batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, uploadReadStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    } else {
+        //release the buffers to the graphics queue family, which acquires
+        //them once the batch is done, see acquireUploads
+        std::vector<VkBufferMemoryBarrier> releaseBarriers = ownershipBarriers(state, state->batch.buffers, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+        vkCmdPipelineBarrier(state->batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.empty() ? nullptr : &releaseBarriers[0], 0, nullptr);
+    }
     
+    vkEndCommandBuffer(state->batch.commandBuffer);
+
+    // Submit command buffer and copy data from staging buffer to the final buffers
+    VkSubmitInfo submitInfo = {
+        VK_STRUCTURE_TYPE_SUBMIT_INFO,                      //sType
+        nullptr,                                            //*pNext
+        0,                                                  //waitSemaphoreCount
+        nullptr,                                            //*pWaitSemaphores
+        nullptr,                                            //*pWaitDstStageMask;
+        1,                                                  //commandBufferCount
+        &state->batch.commandBuffer,                        //*pCommandBuffers
+        0,                                                  //signalSemaphoreCount
+        nullptr                                             //*pSignalSemaphores
+    };
+
+    VkResult result = vkQueueSubmit(state->queue, 1, &submitInfo, state->batch.fence);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Could not submit transfer commands: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        //nothing reads the batch, its space is reclaimed once the ring drains
+        state->idle.push_back(state->batch);
+        return false;
+    }
+    state->pending.push_back(state->batch);
     return true;
 }
 
+void SME::Buffer::destroyTransferBuffer(VkDevice device){
+    TransferState* state;
+    {
+        std::lock_guard<std::mutex> lock(transferStatesMutex);
+        std::map<VkDevice, TransferState*>::iterator it = transferStates.find(device);
+        if(it == transferStates.end()){
+            return;
+        }
+        state = it->second;
+        transferStates.erase(it);
+    }
+    
+    if(state->batchOpen){
+        vkDestroyFence(device, state->batch.fence, nullptr);
+    }
+    for(StagingSubmission &submission : state->pending){
+        vkWaitForFences(device, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+        vkDestroyFence(device, submission.fence, nullptr);
+    }
+    for(StagingSubmission &submission : state->idle){
+        vkDestroyFence(device, submission.fence, nullptr);
+    }
+    
+    if(state->commandPool != VK_NULL_HANDLE){
+        vkDestroyCommandPool(device, state->commandPool, nullptr);
+    }
+    
+    for(BufferMove &move : state->moves){
+        vkDestroyBuffer(device, move.handle, nullptr);
+        SME::Memory::release(device, &move.allocation);
+    }
+    for(RetiredBuffer &retired : state->retired){
+        vkDestroyBuffer(device, retired.handle, nullptr);
+        SME::Memory::release(device, &retired.allocation);
+    }
+    state->graphicsUploads.clear();
+    delete state->graphicsStagingPool;
+    delete state;
+}
+
 bool SME::Buffer::createBuffer(VkBufferCreateInfo* bufferInfo, VkDevice device, VkPhysicalDevice physicalDevice){
     this->device = device;
     this->transfer = bufferInfo->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    this->size = bufferInfo->size;
+    this->usage = bufferInfo->usage;
     
-    VkResult result = vkCreateBuffer(device, bufferInfo, nullptr, &handle);
+    //only vertex and index buffers are copied elsewhere by the defragmentation:
+    //their handle is read again whenever they are bound, while other handles
+    //end up in descriptor sets, and shader writes wouldn't be carried over
+    const VkBufferUsageFlags movableUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+            | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bool canMove = transfer && (bufferInfo->usage & ~movableUsage) == 0 && bufferInfo->sharingMode == VK_SHARING_MODE_EXCLUSIVE;
+    VkBufferCreateInfo createInfo = *bufferInfo;
+    if(canMove){
+        createInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    }
+    
+    VkResult result = vkCreateBuffer(device, &createInfo, nullptr, &handle);
     if(result != VK_SUCCESS){
         fprintf(stderr, "Failed creating buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
@@ -75,146 +411,610 @@ bool SME::Buffer::createBuffer(VkBufferCreateInfo* bufferInfo, VkDevice device,
     
     VkMemoryRequirements bufferMemoryRequirements;
     vkGetBufferMemoryRequirements(device, handle, &bufferMemoryRequirements );
-
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-    
-    for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++){
-        if( (bufferMemoryRequirements.memoryTypeBits & (1 << i))
-                && (memoryProperties.memoryTypes[i].propertyFlags & (transfer ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))){
-            
-            VkMemoryAllocateInfo memoryAllocateInfo = {
-                VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,     // sType
-                nullptr,                                    // *pNext
-                bufferMemoryRequirements.size,              // allocationSize
-                i                                           // memoryTypeIndex
-            };
-
-            result = vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &memory);
-            if(result != VK_SUCCESS){
-                fprintf(stderr, "Failed allocating memory for buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-                return false;
-            } else {
-                return true;
-            }
-        }
+    
+    //host visible buffers prefer coherent memory, which never needs flushing
+    if(!SME::Memory::allocate(device, physicalDevice, bufferMemoryRequirements,
+            transfer ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true, &allocation,
+            transfer ? 0 : VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)){
+        fprintf(stderr, "Failed allocating memory for buffer!\n");
+        return false;
     }
     
-    fprintf(stderr, "Couldn't find suitable memory to allocate the buffer.\n");
-    return false;
+    result = vkBindBufferMemory(device, handle, allocation.memory, allocation.offset);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Could not bind memory for buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    TransferState* state = getTransferState(device);
+    if(canMove && state != nullptr){
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->buffers.push_back(this);
+        movable = true;
+    }
+    return true;
 }
 
 bool SME::Buffer::uploadDataToDevice(void* data, VkDeviceSize offset, VkDeviceSize size){
-    if(transfer){
-        if(!transferBuffer.uploadDataToDevice(data, 0, size)){
-            fprintf(stderr, "Couldn't upload data to transfer buffer!\n");
+    UploadToken token;
+    if(!queueUpload(data, offset, size, &token)){
+        return false;
+    }
+    //copies by the graphics queue wait for a frame, which may be rendered
+    //by this very thread
+    if(token & graphicsQueueToken){
+        return true;
+    }
+    return waitForUpload(device, token);
+}
+
+bool SME::Buffer::queueUpload(const void* data, VkDeviceSize offset, VkDeviceSize size, UploadToken* token){
+    return queueUpload(offset, size, 1, [data](void* staging, VkDeviceSize uploaded, VkDeviceSize chunkSize){
+        memcpy(staging, static_cast<const char*>(data) + uploaded, chunkSize);
+        return true;
+    }, token);
+}
+
+bool SME::Buffer::queueUpload(VkDeviceSize offset, VkDeviceSize size, VkDeviceSize elementSize,
+        const std::function<bool(void*, VkDeviceSize, VkDeviceSize)>& write, UploadToken* token){
+    *token = 0;
+    if(!transfer){
+        //host visible memory stays mapped
+        if(!write(static_cast<char*>(allocation.mapped) + offset, 0, size)){
             return false;
         }
-        
-        VkResult result = vkBindBufferMemory(device, handle, memory, 0);
-        if(result != VK_SUCCESS){
-            fprintf(stderr, "Could not bind memory for buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return SME::Memory::flush(device, allocation, offset, size);
+    }
+    
+    TransferState* state = getTransferState(device);
+    if(state == nullptr){
+        fprintf(stderr, "No transfer buffer was initialised for this buffer's device!\n");
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(state->mutex);
+    writeCount++;
+    
+    //the transfer queue family gave the buffer away, unless its release is
+    //still being recorded. Copying on the transfer queue would need it back
+    //first, so the graphics queue copies it, ordered after the frames
+    //reading it
+    if(released && !(state->batchOpen && std::find(state->batch.buffers.begin(), state->batch.buffers.end(), handle) != state->batch.buffers.end())){
+        return queueGraphicsUpload(state, offset, size, write, token);
+    }
+    
+    //split in chunks, so earlier ones are copied while later ones are written
+    VkDeviceSize maxChunkSize = state->ringSize / 2 / elementSize * elementSize;
+    if(maxChunkSize == 0){
+        fprintf(stderr, "Upload elements of %llu bytes don't fit in the staging ring!\n", static_cast<unsigned long long>(elementSize));
+        return false;
+    }
+    for(VkDeviceSize uploaded = 0; uploaded < size; ){
+        VkDeviceSize chunkSize = std::min(size - uploaded, maxChunkSize);
+        if(!state->batchOpen && !beginStagingBatch(device, state)){
             return false;
         }
         
-        //transfer data from transfer buffer to final buffer
+        VkDeviceSize stagingOffset;
+        if(!reserveStagingSpace(device, state, chunkSize, &stagingOffset)){
+            //the ring is full of this batch's own data, send it off to free it.
+            //The buffer is only released by the batch with its last chunk
+            state->batch.buffers.erase(std::remove(state->batch.buffers.begin(), state->batch.buffers.end(), handle), state->batch.buffers.end());
+            if(!submitStagingBatch(state) || !beginStagingBatch(device, state) || !reserveStagingSpace(device, state, chunkSize, &stagingOffset)){
+                return false;
+            }
+        }
+        
+        if(!write(static_cast<char*>(state->buffer.allocation.mapped) + stagingOffset, uploaded, chunkSize)){
+            return false;
+        }
+        SME::Memory::flush(device, state->buffer.allocation, stagingOffset, chunkSize);
         
-        VkCommandBufferBeginInfo cmdBufferBegininfo = {
-            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        //sType
-            nullptr,                                            //*pNext
-            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,        //flags
-            nullptr                                             //*pInheritanceInfo
-        };
-
-        vkBeginCommandBuffer(transferCommandBuffer, &cmdBufferBegininfo);
-
         VkBufferCopy bufferCopyInfo = {
-            0,                                                  //srcOffset
-            offset,                                             //dstOffset
-            size                                                //size
+            stagingOffset,                                      //srcOffset
+            offset + uploaded,                                  //dstOffset
+            chunkSize                                           //size
         };
+        vkCmdCopyBuffer(state->batch.commandBuffer, state->buffer.handle, handle, 1, &bufferCopyInfo);
+        if(state->familyIndex != state->graphicsFamilyIndex && std::find(state->batch.buffers.begin(), state->batch.buffers.end(), handle) == state->batch.buffers.end()){
+            state->batch.buffers.push_back(handle);
+            released = true;
+        }
         
-        vkCmdCopyBuffer(transferCommandBuffer, transferBuffer.handle, handle, 1, &bufferCopyInfo);
+        *token = state->batch.token;
+        lastUpload = state->batch.token;
+        uploaded += chunkSize;
+    }
+    return true;
+}
 
-        VkBufferMemoryBarrier bufferMemoryBarrier = {
-            VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,            //sType;
-            nullptr,                                            //*pNext
-            VK_ACCESS_MEMORY_WRITE_BIT,                         //srcAccessMask
-            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,                //dstAccessMask         //TODO: make this thing variable
-            VK_QUEUE_FAMILY_IGNORED,                            //srcQueueFamilyIndex
-            VK_QUEUE_FAMILY_IGNORED,                            //dstQueueFamilyIndex
-            handle,                                             //buffer
-            0,                                                  //offset
-            VK_WHOLE_SIZE                                       //size
-        };
-        vkCmdPipelineBarrier(transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &bufferMemoryBarrier, 0, nullptr);
-        //TODO: make the 2nd and 3rd arguments variable as well
-        
-        vkEndCommandBuffer(transferCommandBuffer);
+bool SME::Buffer::queueGraphicsUpload(TransferState* state, VkDeviceSize offset, VkDeviceSize size,
+        const std::function<bool(void*, VkDeviceSize, VkDeviceSize)>& write, UploadToken* token){
+    GraphicsUpload upload = {Buffer(), handle, offset, size, 0, false, 0};
+    if(!state->graphicsStagingPool->acquire(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &upload.staging)){
+        fprintf(stderr, "Failed creating staging buffer for upload!\n");
+        return false;
+    }
+    if(!write(upload.staging.allocation.mapped, 0, size) || !SME::Memory::flush(device, upload.staging.allocation, 0, size)){
+        state->graphicsStagingPool->release(std::move(upload.staging));
+        return false;
+    }
+    upload.token = state->nextGraphicsToken++;
+    *token = upload.token;
+    state->graphicsUploads.push_back(std::move(upload));
+    return true;
+}
 
-        // Submit command buffer and copy data from staging buffer to a vertex buffer
-        VkSubmitInfo submitInfo = {
-            VK_STRUCTURE_TYPE_SUBMIT_INFO,                      //sType
-            nullptr,                                            //*pNext
-            0,                                                  //waitSemaphoreCount
-            nullptr,                                            //*pWaitSemaphores
-            nullptr,                                            //*pWaitDstStageMask;
-            1,                                                  //commandBufferCount
-            &transferCommandBuffer,                                    //*pCommandBuffers
-            0,                                                  //signalSemaphoreCount
-            nullptr                                             //*pSignalSemaphores
-        };
+SME::Buffer::UploadToken SME::Buffer::flushUploads(VkDevice device){
+    TransferState* state = getTransferState(device);
+    if(state == nullptr){
+        return 0;
+    }
+    
+    std::lock_guard<std::mutex> lock(state->mutex);
+    submitStagingBatch(state);
+    return state->nextToken - 1;
+}
 
-        result = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        if(result != VK_SUCCESS){
-            fprintf(stderr, "Could not submit transfer commands: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-            return false;
-        }
+//whether every upload copied by the graphics queue up to the token is done
+bool isGraphicsUploadComplete(TransferState* state, SME::Buffer::UploadToken token){
+    return std::none_of(state->graphicsUploads.begin(), state->graphicsUploads.end(), [token](const GraphicsUpload &upload){
+        return upload.token <= token; });
+}
 
-        vkDeviceWaitIdle(device);
-    } else {
-        VkResult result = vkBindBufferMemory(device, handle, memory, 0);
-        if(result != VK_SUCCESS){
-            fprintf(stderr, "Could not bind memory for buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+bool SME::Buffer::isUploadComplete(VkDevice device, UploadToken token){
+    TransferState* state = getTransferState(device);
+    if(state == nullptr || token == 0){
+        return true;
+    }
+    
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if(token & graphicsQueueToken){
+        return isGraphicsUploadComplete(state, token);
+    }
+    reclaimStagingSpace(device, state, false);
+    return token <= state->completedToken;
+}
+
+bool SME::Buffer::waitForUpload(VkDevice device, UploadToken token){
+    TransferState* state = getTransferState(device);
+    if(state == nullptr || token == 0){
+        return true;
+    }
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if(token & graphicsQueueToken){
+        state->graphicsUploadsDone.wait(lock, [state, token](){ return isGraphicsUploadComplete(state, token); });
+        return true;
+    }
+    if(state->batchOpen && token >= state->batch.token && !submitStagingBatch(state)){
+        return false;
+    }
+    while(token > state->completedToken){
+        if(state->pending.empty()){
+            //its batch failed to submit
             return false;
         }
-
-        void* memoryPointer;
-        result = vkMapMemory(device, memory, offset, size, 0, &memoryPointer);
-        if(result != VK_SUCCESS){
-            fprintf(stderr, "Could not map memory for buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        if(!reclaimStagingSpace(device, state, true)){
             return false;
         }
+    }
+    return true;
+}
 
-        memcpy(memoryPointer, data, size);
+void SME::Buffer::acquireUploads(VkDevice device, VkCommandBuffer commandBuffer, uint64_t frame, uint64_t completedFrame){
+    TransferState* state = getTransferState(device);
+    if(state == nullptr){
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if(!reclaimStagingSpace(device, state, false)){
+        return;
+    }
+    
+    if(!state->acquires.empty()){
+        //the host saw the batches complete, which orders their release before
+        //this command buffer is submitted
+        std::vector<VkBufferMemoryBarrier> acquireBarriers = ownershipBarriers(state, state->acquires, 0, uploadReadAccess);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, uploadReadStages, 0, 0, nullptr,
+                static_cast<uint32_t>(acquireBarriers.size()), &acquireBarriers[0], 0, nullptr);
+        state->acquires.clear();
+    }
+    
+    //staging of copies made by finished frames is handed out again
+    state->graphicsStagingPool->beginFrame(frame, completedFrame);
+    size_t uploadCount = state->graphicsUploads.size();
+    state->graphicsUploads.erase(std::remove_if(state->graphicsUploads.begin(), state->graphicsUploads.end(), [completedFrame](const GraphicsUpload &upload){
+        return upload.recorded && upload.frame < completedFrame; }), state->graphicsUploads.end());
+    if(state->graphicsUploads.size() != uploadCount){
+        state->graphicsUploadsDone.notify_all();
+    }
+    
+    bool recorded = false;
+    for(size_t i = 0; i < state->graphicsUploads.size(); i++){
+        GraphicsUpload &upload = state->graphicsUploads[i];
+        
+        //buffers whose release hasn't been acquired yet are copied by a
+        //later frame, the copies of a buffer are recorded in order
+        if(!upload.recorded && !isBeingReleased(state, upload.destination)
+                && std::none_of(state->graphicsUploads.begin(), state->graphicsUploads.begin() + i, [&upload](const GraphicsUpload &earlier){
+                    return !earlier.recorded && earlier.destination == upload.destination; })){
+            if(!recorded){
+                //earlier frames on this queue may still read the buffers
+                vkCmdPipelineBarrier(commandBuffer, uploadReadStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+                recorded = true;
+            }
+            VkBufferCopy bufferCopyInfo = {
+                0,                                      //srcOffset
+                upload.offset,                          //dstOffset
+                upload.size                             //size
+            };
+            vkCmdCopyBuffer(commandBuffer, upload.staging.handle, upload.destination, 1, &bufferCopyInfo);
+            upload.recorded = true;
+            upload.frame = frame;
+            //handed out again once this frame is done
+            state->graphicsStagingPool->release(std::move(upload.staging));
+        }
+    }
+    
+    if(recorded){
+        VkMemoryBarrier memoryBarrier = {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,       //sType
+            nullptr,                                //*pNext
+            VK_ACCESS_TRANSFER_WRITE_BIT,           //srcAccessMask
+            uploadReadAccess                        //dstAccessMask
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, uploadReadStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+}
 
-        VkMappedMemoryRange flushRange = {
-          VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,            // sType
-          nullptr,                                          // *pNext
-          memory,                                           // memory
-          offset,                                           // offset
-          size                                              // size
+uint32_t SME::Buffer::defragment(VkDevice device, VkCommandBuffer commandBuffer, uint64_t frame, uint64_t completedFrame, double budgetMicroseconds, bool batchSwaps){
+    TransferState* state = getTransferState(device);
+    if(state == nullptr){
+        return 0;
+    }
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if(!reclaimStagingSpace(device, state, false)){
+        return 0;
+    }
+    
+    //no frame in flight can use these anymore
+    for(size_t i = 0; i < state->retired.size(); ){
+        if(state->retired[i].frame <= completedFrame){
+            vkDestroyBuffer(device, state->retired[i].handle, nullptr);
+            SME::Memory::release(device, &state->retired[i].allocation);
+            state->retired[i] = state->retired.back();
+            state->retired.pop_back();
+        } else {
+            i++;
+        }
+    }
+    
+    //stale copies are dropped right away
+    VkDeviceSize readySize = 0;
+    bool allReady = true;
+    for(size_t i = 0; i < state->moves.size(); ){
+        BufferMove &move = state->moves[i];
+        if(move.buffer == nullptr || move.buffer->writeCount != move.writeCount){
+            if(move.frame < completedFrame){
+                vkDestroyBuffer(device, move.handle, nullptr);
+                SME::Memory::release(device, &move.allocation);
+                state->moves[i] = state->moves.back();
+                state->moves.pop_back();
+                continue;
+            }
+        } else if(move.frame < completedFrame){
+            readySize += move.buffer->size;
+        } else {
+            allReady = false;
+        }
+        i++;
+    }
+    
+    //swap in the copies made by finished frames. Batched swaps wait for a
+    //batch worth of them, or for everything there is to move
+    bool swap = !batchSwaps || readySize >= SME_DEFRAGMENT_BATCH_BYTES || (state->defragmentIdle && allReady);
+    uint32_t moved = 0;
+    for(size_t i = 0; swap && i < state->moves.size(); ){
+        BufferMove &move = state->moves[i];
+        if(move.frame >= completedFrame){
+            i++;
+            continue;
+        }
+        if(move.buffer != nullptr && move.buffer->writeCount == move.writeCount){
+            state->retired.push_back({move.buffer->handle, move.buffer->allocation, frame});
+            move.buffer->handle = move.handle;
+            move.buffer->allocation = move.allocation;
+            //the new buffer was written by the graphics queue, which keeps it
+            move.buffer->released = state->familyIndex != state->graphicsFamilyIndex;
+            moved++;
+        } else {
+            vkDestroyBuffer(device, move.handle, nullptr);
+            SME::Memory::release(device, &move.allocation);
+        }
+        state->moves[i] = state->moves.back();
+        state->moves.pop_back();
+    }
+    
+    if(swap){
+        readySize = 0;
+    }
+    
+    //start copying the next buffers that have a better place. The copies run
+    //on the graphics queue, which owns the buffers once their uploads are
+    //acquired, so only buffers without uploads in flight are moved
+    VkDeviceSize copied = 0;
+    size_t visited = 0;
+    for(; visited < state->buffers.size() && copied < SME_DEFRAGMENT_BYTES && readySize < SME_DEFRAGMENT_BATCH_BYTES; visited++){
+        if(std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() > budgetMicroseconds){
+            break;
+        }
+        state->defragmentCursor = (state->defragmentCursor + 1) % state->buffers.size();
+        Buffer* buffer = state->buffers[state->defragmentCursor];
+        //buffers never uploaded to hold nothing worth copying
+        if(buffer->writeCount == 0 || buffer->lastUpload > state->completedToken
+                || std::find(state->acquires.begin(), state->acquires.end(), buffer->handle) != state->acquires.end()
+                || std::any_of(state->moves.begin(), state->moves.end(), [buffer](const BufferMove &move){ return move.buffer == buffer; })
+                || std::any_of(state->graphicsUploads.begin(), state->graphicsUploads.end(), [buffer](const GraphicsUpload &upload){
+                    return !upload.recorded && upload.destination == buffer->handle; })){
+            continue;
+        }
+        
+        SME::Memory::Allocation allocation;
+        if(!SME::Memory::relocate(device, buffer->allocation, &allocation)){
+            continue;
+        }
+        
+        VkBufferCreateInfo bufferInfo = {
+            VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,   // sType
+            nullptr,                                // *pNext
+            0,                                      // flags
+            buffer->size,                           // size
+            buffer->usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, // usage
+            VK_SHARING_MODE_EXCLUSIVE,              // sharingMode
+            0,                                      // queueFamilyIndexCount
+            nullptr                                 // *pQueueFamilyIndices
+        };
+        
+        VkBuffer handle;
+        VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, &handle);
+        if(result != VK_SUCCESS){
+            fprintf(stderr, "Failed creating buffer to defragment into: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            SME::Memory::release(device, &allocation);
+            break;
+        }
+        
+        result = vkBindBufferMemory(device, handle, allocation.memory, allocation.offset);
+        if(result != VK_SUCCESS){
+            fprintf(stderr, "Could not bind memory to defragment into: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            vkDestroyBuffer(device, handle, nullptr);
+            SME::Memory::release(device, &allocation);
+            break;
+        }
+        
+        VkBufferCopy bufferCopyInfo = {
+            0,                                      //srcOffset
+            0,                                      //dstOffset
+            buffer->size                            //size
+        };
+        vkCmdCopyBuffer(commandBuffer, buffer->handle, handle, 1, &bufferCopyInfo);
+        
+        state->moves.push_back({buffer, handle, allocation, frame, buffer->writeCount});
+        copied += buffer->size;
+    }
+    //a whole pass found nothing to move
+    state->defragmentIdle = copied == 0 && visited == state->buffers.size();
+    
+    if(copied > 0){
+        //the copies are read like uploads once swapped in
+        VkMemoryBarrier memoryBarrier = {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,       //sType
+            nullptr,                                //*pNext
+            VK_ACCESS_TRANSFER_WRITE_BIT,           //srcAccessMask
+            uploadReadAccess                        //dstAccessMask
         };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, uploadReadStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+    return moved;
+}
 
-        vkFlushMappedMemoryRanges(device, 1, &flushRange);
+void* SME::Buffer::getMappedData(){
+    return transfer ? nullptr : allocation.mapped;
+}
+
+bool SME::Buffer::isCoherent(){
+    return !transfer && SME::Memory::isCoherent(device, allocation);
+}
 
-        vkUnmapMemory(device, memory);
+bool SME::Buffer::flushMappedRange(VkDeviceSize offset, VkDeviceSize size){
+    if(transfer){
+        return false;
     }
-    return true;
+    return SME::Memory::flush(device, allocation, offset, size);
 }
 
 VkBuffer* SME::Buffer::getHandle(){
     return &handle;
 }
 
+VkDeviceSize SME::Buffer::getSize(){
+    return size;
+}
+
+VkBufferUsageFlags SME::Buffer::getUsage(){
+    return usage;
+}
+
+SME::Buffer::Buffer(Buffer&& other) noexcept {
+    adopt(other);
+}
+
+SME::Buffer& SME::Buffer::operator=(Buffer&& other) noexcept {
+    if(this != &other){
+        destroy();
+        adopt(other);
+    }
+    return *this;
+}
+
 SME::Buffer::~Buffer(){
+    destroy();
+}
+
+void SME::Buffer::adopt(Buffer &other){
+    //the defragmentation refers to buffers by address, and may swap the
+    //handle of the other buffer at any time
+    TransferState* state = other.movable ? getTransferState(other.device) : nullptr;
+    std::unique_lock<std::mutex> lock;
+    if(state != nullptr){
+        lock = std::unique_lock<std::mutex>(state->mutex);
+        std::replace(state->buffers.begin(), state->buffers.end(), &other, this);
+        for(BufferMove &move : state->moves){
+            if(move.buffer == &other){
+                move.buffer = this;
+            }
+        }
+    }
+    
+    device = other.device;
+    handle = other.handle;
+    allocation = other.allocation;
+    transfer = other.transfer;
+    movable = other.movable;
+    size = other.size;
+    usage = other.usage;
+    writeCount = other.writeCount;
+    lastUpload = other.lastUpload;
+    released = other.released;
+    
+    other.handle = VK_NULL_HANDLE;
+    other.allocation = SME::Memory::Allocation();
+    other.movable = false;
+    other.released = false;
+    other.size = 0;
+}
+
+void SME::Buffer::destroy(){
+    TransferState* state = transfer && handle != VK_NULL_HANDLE ? getTransferState(device) : nullptr;
+    if(state != nullptr){
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if(movable){
+            state->buffers.erase(std::find(state->buffers.begin(), state->buffers.end(), this));
+            for(BufferMove &move : state->moves){
+                if(move.buffer == this){
+                    move.buffer = nullptr;
+                }
+            }
+        }
+        
+        //no ownership barriers for a destroyed buffer
+        state->acquires.erase(std::remove(state->acquires.begin(), state->acquires.end(), handle), state->acquires.end());
+        state->batch.buffers.erase(std::remove(state->batch.buffers.begin(), state->batch.buffers.end(), handle), state->batch.buffers.end());
+        for(StagingSubmission &submission : state->pending){
+            submission.buffers.erase(std::remove(submission.buffers.begin(), submission.buffers.end(), handle), submission.buffers.end());
+        }
+        size_t uploadCount = state->graphicsUploads.size();
+        for(size_t i = 0; i < state->graphicsUploads.size(); ){
+            if(!state->graphicsUploads[i].recorded && state->graphicsUploads[i].destination == handle){
+                state->graphicsStagingPool->release(std::move(state->graphicsUploads[i].staging));
+                state->graphicsUploads.erase(state->graphicsUploads.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        if(state->graphicsUploads.size() != uploadCount){
+            state->graphicsUploadsDone.notify_all();
+        }
+    }
+    
     if(handle != VK_NULL_HANDLE){
         vkDestroyBuffer(device, handle, nullptr);
         handle = VK_NULL_HANDLE;
     }
 
-    if(memory != VK_NULL_HANDLE){
-        vkFreeMemory(device, memory, nullptr);
-        memory = VK_NULL_HANDLE;
+    SME::Memory::release(device, &allocation);
+    movable = false;
+    released = false;
+    size = 0;
+}
+
+//size classes of pooled buffers, the same powers of two as the allocator's
+VkDeviceSize poolSizeClassSize(uint32_t sizeClass){
+    return static_cast<VkDeviceSize>(SME_MEMORY_MIN_ALLOCATION) << sizeClass;
+}
+
+SME::BufferPool::BufferPool(VkDevice device, VkPhysicalDevice physicalDevice) : device(device), physicalDevice(physicalDevice) {
+}
+
+bool SME::BufferPool::acquire(VkDeviceSize size, VkBufferUsageFlags usage, Buffer* buffer){
+    //smallest class that holds size
+    uint32_t sizeClass = 0;
+    while(poolSizeClassSize(sizeClass) < size){
+        sizeClass++;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::pair<VkBufferUsageFlags, uint32_t>, std::vector<PooledBuffer>>::iterator it = freeBuffers.find(std::make_pair(usage, sizeClass));
+        if(it != freeBuffers.end() && !it->second.empty()){
+            *buffer = std::move(it->second.back().buffer);
+            it->second.pop_back();
+            return true;
+        }
+    }
+    
+    VkBufferCreateInfo bufferInfo = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,   // sType
+        nullptr,                                // *pNext
+        0,                                      // flags
+        poolSizeClassSize(sizeClass),           // size
+        usage,                                  // usage
+        VK_SHARING_MODE_EXCLUSIVE,              // sharingMode
+        0,                                      // queueFamilyIndexCount
+        nullptr                                 // *pQueueFamilyIndices
+    };
+    
+    *buffer = Buffer();
+    return buffer->createBuffer(&bufferInfo, device, physicalDevice);
+}
+
+void SME::BufferPool::release(Buffer&& buffer){
+    if(*buffer.getHandle() == VK_NULL_HANDLE){
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    releasedBuffers.push_back({std::move(buffer), currentFrame});
+}
+
+void SME::BufferPool::beginFrame(uint64_t frame, uint64_t completedFrame){
+    std::lock_guard<std::mutex> lock(mutex);
+    currentFrame = frame;
+    
+    for(size_t i = 0; i < releasedBuffers.size(); ){
+        if(releasedBuffers[i].frame < completedFrame){
+            //largest class the buffer holds, buffers not made by the pool may be in between
+            VkDeviceSize size = releasedBuffers[i].buffer.getSize();
+            if(size >= poolSizeClassSize(0)){
+                uint32_t sizeClass = 0;
+                while(poolSizeClassSize(sizeClass + 1) <= size){
+                    sizeClass++;
+                }
+                freeBuffers[std::make_pair(releasedBuffers[i].buffer.getUsage(), sizeClass)].push_back(std::move(releasedBuffers[i]));
+            }
+            releasedBuffers[i] = std::move(releasedBuffers.back());
+            releasedBuffers.pop_back();
+        } else {
+            i++;
+        }
+    }
+    
+    for(std::pair<const std::pair<VkBufferUsageFlags, uint32_t>, std::vector<PooledBuffer>> &bucket : freeBuffers){
+        bucket.second.erase(std::remove_if(bucket.second.begin(), bucket.second.end(), [frame](const PooledBuffer &pooled){
+            return pooled.frame + SME_BUFFER_POOL_MAX_AGE < frame;
+        }), bucket.second.end());
     }
 }
\ No newline at end of file
@@ -2,35 +2,104 @@
 #define SME_BUFFER_H
 
 #ifndef SME_TRANSFER_BUFFER_SIZE
-#define SME_TRANSFER_BUFFER_SIZE 4096 //the transfer buffer size defaults to 4kb
+#define SME_TRANSFER_BUFFER_SIZE (8 * 1024 * 1024) //the staging ring size defaults to 8MB
+#endif
+
+#ifndef SME_STAGING_ALIGNMENT
+#define SME_STAGING_ALIGNMENT 256 //chunks in the staging ring start at multiples of this
+#endif
+
+#ifndef SME_BUFFER_POOL_MAX_AGE
+#define SME_BUFFER_POOL_MAX_AGE 256 //frames a pooled buffer can go unused before it is destroyed
+#endif
+
+#ifndef SME_DEFRAGMENT_BYTES
+#define SME_DEFRAGMENT_BYTES (4 * 1024 * 1024) //most buffer data a defragment call starts copying
+#endif
+
+#ifndef SME_DEFRAGMENT_BATCH_BYTES
+#define SME_DEFRAGMENT_BATCH_BYTES (32 * 1024 * 1024) //copied buffer data held back when swaps are batched
 #endif
 
 #include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <functional>
+
+#include "SME_memory.h"
+
+struct TransferState;
 
 namespace SME {
     class Buffer {
     public:
+        /**
+         * Identifies a batch of queued uploads. Tokens increase with every
+         * batch, and 0 is always complete. Uploads copied by the graphics
+         * queue, see queueUpload, are numbered separately and have
+         * graphicsQueueToken set.
+         */
+        typedef uint64_t UploadToken;
+        
+        static const UploadToken graphicsQueueToken = 1ULL << 63;
+        
+        Buffer() = default;
         ~Buffer();
         
         /**
-         * Initialises the transfer queue, command pool and buffer for transfer
-         * operations in the gpu.
+         * Buffers own their Vulkan handle and memory, so they can only be
+         * moved. The moved from buffer is left empty.
+         */
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        
+        /**
+         * Sets the size of the staging ring every upload to device local
+         * memory goes through. Uploads of any size work, bigger ones are
+         * split into chunks of up to half the ring. Must be called before
+         * init.
+         * @param size the size of the ring in bytes, defaults to
+         * SME_TRANSFER_BUFFER_SIZE
+         */
+        static void setStagingBufferSize(VkDeviceSize size);
+        
+        /**
+         * Initialises the transfer queue, command pool and staging ring for
+         * transfer operations in the gpu.
          * <b>Do not call directly! This gets automatically called when appropriate
          * by the render!</b>
          * @param familyIndex the family index on which the transfer queue should
          * be created
+         * @param graphicsFamilyIndex the family of the queue that uses the
+         * buffers. If it differs, uploaded buffers are released to it and
+         * must be acquired through acquireUploads
          * @param device logical device on which the queue, command pool and
          * buffer will reside
          * @param physicalDevice the physical representation of the previous
          * logical device
          * @return true if the buffer was successfully created or false otherwise
          */
-        static bool initTransferBuffer(uint32_t familyIndex, VkDevice device, VkPhysicalDevice physicalDevice);
+        static bool initTransferBuffer(uint32_t familyIndex, uint32_t graphicsFamilyIndex, VkDevice device, VkPhysicalDevice physicalDevice);
+        
+        /**
+         * Destroys the transfer command pool and buffer of the given device.
+         * <b>Do not call directly! This gets automatically called when appropriate
+         * by the render!</b>
+         * @param device logical device whose transfer resources are destroyed
+         */
+        static void destroyTransferBuffer(VkDevice device);
         
         /**
          * Creates a vulkan buffer with the passed information, device and
-         * physical device. The logical device is stored for future use when
-         * uploading or reuploading data to the device itself.
+         * physical device, and binds it to memory from SME::Memory. The
+         * logical device is stored for future use when uploading or
+         * reuploading data to the device itself.
          * @param bufferInfo the information required for creating the VkBuffer.
          * @param device the device on which the buffer will reside.
          * @param physicalDevice the physical representation of the logical device
@@ -40,6 +109,14 @@ namespace SME {
         
         /**
          * Uploads the specified data to the buffer and the device on which resides.
+         * Device local buffers are filled through the staging ring, in chunks
+         * whose ring space is reused as soon as the gpu has copied them.
+         * Returns once all the data is in place, use queueUpload to upload
+         * many buffers at once without waiting on each. The exception are
+         * buffers the graphics queue family already owns, see queueUpload:
+         * their data is only staged, and copied ahead of the next frame, so
+         * only frames rendered after this returns see it. Can be called from multiple
+         * threads, uploads through the staging ring are serialised.
          * @param data the data to be sent, of the same size as the one stated
          * in the bufferInfo passed onto the createBuffer function.
          * @param offset offset to be used when uploading the data to the device
@@ -48,12 +125,250 @@ namespace SME {
          */
         bool uploadDataToDevice(void* data, VkDeviceSize offset, VkDeviceSize size);
         
+        /**
+         * Queues an upload without waiting for it. The data is copied into
+         * the staging ring right away, so it can be freed once this returns,
+         * and the copy into the buffer is recorded into a batch that is
+         * submitted by flushUploads, by waitForUpload, or when the ring fills
+         * up. The buffer must not be used by the gpu before the upload is
+         * complete. Host visible buffers are written immediately. With a
+         * dedicated transfer queue family, a buffer belongs to the graphics
+         * queue family once its first upload is submitted. Later uploads to it
+         * are staged in a host visible buffer from a pool instead, and copied
+         * by the graphics queue ahead of the next frame acquireUploads
+         * records, after the frames before it are done reading the buffer.
+         * Every frame recorded after them sees the data. Their tokens have
+         * graphicsQueueToken set and complete once that frame is done, so
+         * they must not be waited on by the thread rendering the frames.
+         * @param data the data to be sent
+         * @param offset offset to be used when uploading the data to the device
+         * @param size size of the data to be uploaded
+         * @param token where to store the token of the batch holding the upload
+         * @return true if the upload was queued, false otherwise
+         */
+        bool queueUpload(const void* data, VkDeviceSize offset, VkDeviceSize size, UploadToken* token);
+        
+        /**
+         * Queues an upload whose data is written by a callback straight into
+         * the staging ring, or into the buffer if it is host visible, instead
+         * of being copied from an array. Otherwise behaves like queueUpload.
+         * The callback runs with the device's uploads locked, so it must not
+         * upload anything itself.
+         * @param offset offset to be used when uploading the data to the device
+         * @param size size of the data to be uploaded
+         * @param elementSize the upload is only split on multiples of this, so
+         * the callback never gets part of an element. At most half the
+         * staging ring
+         * @param write called for consecutive ranges of the upload, in order,
+         * with the address to fill, the offset of the range within the upload
+         * and its size. Returns false to abandon the upload
+         * @param token where to store the token of the batch holding the upload
+         * @return true if the upload was queued, false otherwise
+         */
+        bool queueUpload(VkDeviceSize offset, VkDeviceSize size, VkDeviceSize elementSize,
+                const std::function<bool(void* data, VkDeviceSize offset, VkDeviceSize size)>& write, UploadToken* token);
+        
+        /**
+         * Submits every upload queued on the device so far, in a single batch
+         * @param device the device the buffers reside on
+         * @return the token of the last batch, complete once everything queued
+         * until now is in place, apart from uploads copied by the graphics
+         * queue
+         */
+        static UploadToken flushUploads(VkDevice device);
+        
+        /**
+         * Checks, without blocking, whether the uploads of a batch are done
+         * @param device the device the buffers reside on
+         * @param token a token returned by queueUpload or flushUploads
+         * @return true if the batch and every earlier one are complete, for
+         * graphics queue tokens every earlier graphics queue upload
+         */
+        static bool isUploadComplete(VkDevice device, UploadToken token);
+        
+        /**
+         * Blocks until the uploads of a batch are done, submitting it first if
+         * needed. Only the transfer queue is waited on, rendering carries on.
+         * Graphics queue tokens are waited on until the frame copying them is
+         * done, which never happens if this thread renders the frames.
+         * @param device the device the buffers reside on
+         * @param token a token returned by queueUpload or flushUploads
+         * @return true once the batch is complete, false if it failed
+         */
+        static bool waitForUpload(VkDevice device, UploadToken token);
+        
+        /**
+         * Records the barriers that hand buffers uploaded through a dedicated
+         * transfer queue family over to the graphics queue family, for every
+         * upload batch that finished since the last call. The graphics queue
+         * may only read those buffers after this. Then records the copies of
+         * the uploads to buffers the graphics queue family already owns, see
+         * queueUpload, and recycles their staging once the frames copying them
+         * are done. Called by the render every frame.
+         * <b>Do not call directly! This gets automatically called when appropriate
+         * by the render!</b>
+         * @param device the device the buffers reside on
+         * @param commandBuffer command buffer submitted to the graphics queue
+         * ahead of the frame's commands
+         * @param frame number of the frame about to be recorded
+         * @param completedFrame every frame numbered below this one is done
+         */
+        static void acquireUploads(VkDevice device, VkCommandBuffer commandBuffer, uint64_t frame, uint64_t completedFrame);
+        
+        /**
+         * Runs a step of the incremental defragmentation of the device local
+         * vertex and index buffers of a device. Only buffers created with no
+         * other usage than those and transfers, in exclusive sharing mode, are
+         * moved, so their handles never end up in descriptor sets and shaders
+         * never write them. Buffers in sparse memory blocks are copied into
+         * fuller ones by the graphics queue, which owns them, and once the
+         * frame doing the copy is done the buffer's handle and memory are
+         * swapped for the new ones, which the graphics queue family keeps.
+         * Buffers with uploads in flight are left for later, and buffers never
+         * uploaded to aren't moved. Old buffers
+         * are destroyed once no frame that could use them is in flight, which
+         * lets emptied blocks be freed. A copy is discarded if the buffer is
+         * uploaded to meanwhile, writes to a moved buffer other than uploads,
+         * such as copies recorded by the caller, are lost. Called once per
+         * frame by the render, between
+         * frames, when a defragmentation budget is set.
+         * <b>Do not call directly! This gets automatically called when appropriate
+         * by the render!</b>
+         * @param device the device whose buffers are defragmented
+         * @param commandBuffer command buffer of the frame, submitted to the
+         * graphics queue after acquireUploads recorded into it
+         * @param frame number of the frame about to be recorded
+         * @param completedFrame every frame numbered below this one is done
+         * @param budgetMicroseconds cpu time after which no new copies are
+         * started, at most SME_DEFRAGMENT_BYTES are copied per call either way
+         * @param batchSwaps whether finished copies are held back until
+         * SME_DEFRAGMENT_BATCH_BYTES of them are ready, or until nothing is
+         * left to move, so they are swapped in all at once. For callers that
+         * have to stall to handle swaps
+         * @return the amount of buffers whose handle changed, command buffers
+         * referencing them must be recorded again, and handles stored
+         * elsewhere, such as in SME::FrameGraph::addBuffer, replaced
+         */
+        static uint32_t defragment(VkDevice device, VkCommandBuffer commandBuffer, uint64_t frame, uint64_t completedFrame, double budgetMicroseconds, bool batchSwaps);
+        
+        /**
+         * Returns where a host visible buffer is mapped. Buffers stay mapped
+         * for their whole lifetime, so per frame data can be written directly
+         * without going through uploadDataToDevice. Writes become visible to
+         * the device after flushMappedRange.
+         * @return the address of the start of the buffer, or null for device
+         * local buffers
+         */
+        void* getMappedData();
+        
+        /**
+         * @return true if the buffer is host visible and coherent, so writes
+         * through getMappedData need no flush
+         */
+        bool isCoherent();
+        
+        /**
+         * Makes writes through getMappedData visible to the device. Free for
+         * coherent memory, otherwise the range is widened to
+         * nonCoherentAtomSize.
+         * @param offset offset of the written range
+         * @param size size of the written range
+         * @return true on success, false if the buffer isn't host visible or
+         * the flush failed
+         */
+        bool flushMappedRange(VkDeviceSize offset, VkDeviceSize size);
+        
+        /**
+         * @return the buffer handle. Device local vertex and index buffers may
+         * get a new one when defragmented, read it again whenever recording.
+         */
         VkBuffer* getHandle();
+        
+        /**
+         * @return the size the buffer was created with
+         */
+        VkDeviceSize getSize();
+        
+        /**
+         * @return the usage flags the buffer was created with
+         */
+        VkBufferUsageFlags getUsage();
+    private:
+        void destroy();
+        void adopt(Buffer &other);
+        bool queueGraphicsUpload(TransferState* state, VkDeviceSize offset, VkDeviceSize size,
+                const std::function<bool(void*, VkDeviceSize, VkDeviceSize)>& write, UploadToken* token);
+        
+        VkDevice device = VK_NULL_HANDLE;
+        VkBuffer handle = VK_NULL_HANDLE;
+        SME::Memory::Allocation allocation;
+        bool transfer = false;
+        bool movable = false;   //vertex or index buffer registered for defragmentation
+        VkDeviceSize size = 0;
+        VkBufferUsageFlags usage = 0;
+        uint64_t writeCount = 0; //uploads queued, a move is discarded if it changes
+        UploadToken lastUpload = 0;
+        bool released = false;  //given to the graphics queue family, which copies later uploads
+    };
+    
+    /**
+     * Recycles buffers that only live for a frame or a few. Buffers are
+     * bucketed by usage and by size, rounded up to a power of two, and
+     * released ones are handed out again once the frames that could use them
+     * are done, so in steady state no Vulkan objects are created. Buffers
+     * unused for SME_BUFFER_POOL_MAX_AGE frames are destroyed. Safe to call
+     * from multiple threads.
+     */
+    class BufferPool {
+    public:
+        /**
+         * @param device the device on which the buffers will reside
+         * @param physicalDevice the physical representation of the device
+         */
+        BufferPool(VkDevice device, VkPhysicalDevice physicalDevice);
+        
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+        
+        /**
+         * Hands out a buffer of at least the given size, reusing a released
+         * one when possible. Its contents are undefined. Buffers with
+         * VK_BUFFER_USAGE_TRANSFER_DST_BIT are device local, others are host
+         * visible, as with createBuffer.
+         * @param size minimum size of the buffer
+         * @param usage usage flags of the buffer
+         * @param buffer where to store the buffer, anything it held is destroyed
+         * @return true on success, false if a new buffer couldn't be created
+         */
+        bool acquire(VkDeviceSize size, VkBufferUsageFlags usage, Buffer* buffer);
+        
+        /**
+         * Gives a buffer back to the pool. It may still be used by the frame
+         * being recorded, it's only handed out again once that frame is done.
+         * @param buffer the buffer to recycle, left empty
+         */
+        void release(Buffer&& buffer);
+        
+        /**
+         * Recycles the buffers released by finished frames, and destroys the
+         * ones that went unused for too long. Called by the render at the
+         * start of every frame.
+         * @param frame number of the frame about to be recorded
+         * @param completedFrame every frame numbered below this one is done
+         */
+        void beginFrame(uint64_t frame, uint64_t completedFrame);
     private:
+        struct PooledBuffer {
+            Buffer buffer;
+            uint64_t frame; //last frame that could use it
+        };
+        
         VkDevice device;
-        VkBuffer handle;
-        VkDeviceMemory memory;
-        bool transfer;
+        VkPhysicalDevice physicalDevice;
+        uint64_t currentFrame = 0;
+        std::map<std::pair<VkBufferUsageFlags, uint32_t>, std::vector<PooledBuffer>> freeBuffers; //by usage and size class
+        std::vector<PooledBuffer> releasedBuffers; //waiting for their frame to be done
+        std::mutex mutex;
     };
 }
 
@@ -0,0 +1,442 @@
+#include "SME_collada.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fstream>
+#include <algorithm>
+
+namespace {
+    //an element found in the document, all pointers point into it
+    struct Element {
+        const char* attributes;     //right after the name
+        const char* attributesEnd;  //the closing >
+        const char* content;
+        const char* contentEnd;     //the start of the end tag
+        const char* end;            //right after the element
+    };
+
+    /**
+     * Finds the next element with the given name. The elements the loader
+     * looks for never contain elements of their own name, so the first end
+     * tag closes them.
+     */
+    bool findElement(const char* begin, const char* end, const char* name, Element* element){
+        size_t length = strlen(name);
+        for(const char* tag = begin; (tag = static_cast<const char*>(memchr(tag, '<', end - tag))) != nullptr; tag++){
+            if(static_cast<size_t>(end - tag) <= length + 1 || strncmp(tag + 1, name, length) != 0){
+                continue;
+            }
+            char next = tag[length + 1];
+            if(next != '>' && next != '/' && !isspace(static_cast<unsigned char>(next))){
+                continue; //only starts with the name, like <p> and <param>
+            }
+
+            const char* close = static_cast<const char*>(memchr(tag, '>', end - tag));
+            if(close == nullptr){
+                return false;
+            }
+            element->attributes = tag + 1 + length;
+            element->attributesEnd = close;
+            element->content = close + 1;
+            if(close[-1] == '/'){
+                element->contentEnd = close + 1;
+                element->end = close + 1;
+                return true;
+            }
+
+            for(const char* endTag = close + 1; (endTag = static_cast<const char*>(memchr(endTag, '<', end - endTag))) != nullptr; endTag++){
+                if(static_cast<size_t>(end - endTag) > length + 2 && endTag[1] == '/' && strncmp(endTag + 2, name, length) == 0 && endTag[length + 2] == '>'){
+                    element->contentEnd = endTag;
+                    element->end = endTag + length + 3;
+                    return true;
+                }
+            }
+            return false;
+        }
+        return false;
+    }
+
+    std::string getAttribute(const Element &element, const char* name){
+        size_t length = strlen(name);
+        for(const char* attribute = element.attributes + 1; attribute + length + 2 <= element.attributesEnd; attribute++){
+            if(!isspace(static_cast<unsigned char>(attribute[-1])) || strncmp(attribute, name, length) != 0 || attribute[length] != '='){
+                continue;
+            }
+            char quote = attribute[length + 1];
+            const char* value = attribute + length + 2;
+            const char* valueEnd = static_cast<const char*>(memchr(value, quote, element.attributesEnd - value));
+            return valueEnd != nullptr ? std::string(value, valueEnd) : std::string();
+        }
+        return std::string();
+    }
+
+    uint32_t getUnsignedAttribute(const Element &element, const char* name, uint32_t defaultValue){
+        std::string value = getAttribute(element, name);
+        return value.empty() ? defaultValue : static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+    }
+
+    //references to other elements are urls of the form #id
+    std::string getReference(const Element &element, const char* name){
+        std::string value = getAttribute(element, name);
+        return !value.empty() && value[0] == '#' ? value.substr(1) : value;
+    }
+
+    bool parseUnsigned(const char** cursor, const char* end, uint32_t* value){
+        const char* character = *cursor;
+        while(character < end && isspace(static_cast<unsigned char>(*character))){
+            character++;
+        }
+        if(character == end || *character < '0' || *character > '9'){
+            return false;
+        }
+        uint32_t parsed = 0;
+        for(; character < end && *character >= '0' && *character <= '9'; character++){
+            parsed = parsed * 10 + (*character - '0');
+        }
+        *value = parsed;
+        *cursor = character;
+        return true;
+    }
+
+    /**
+     * Parses a decimal float like strtof would in the C locale, whatever the
+     * current locale, so a comma decimal separator doesn't break documents.
+     * The first 18 significant digits are kept, which is more than a float
+     * holds.
+     */
+    bool parseFloat(const char** cursor, const char* end, float* value){
+        const char* character = *cursor;
+        while(character < end && isspace(static_cast<unsigned char>(*character))){
+            character++;
+        }
+        bool negative = character < end && *character == '-';
+        if(character < end && (*character == '-' || *character == '+')){
+            character++;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        bool digits = false;
+        for(; character < end && *character >= '0' && *character <= '9'; character++){
+            digits = true;
+            if(mantissa < 100000000000000000ULL){
+                mantissa = mantissa * 10 + (*character - '0');
+            } else {
+                exponent++;
+            }
+        }
+        if(character < end && *character == '.'){
+            for(character++; character < end && *character >= '0' && *character <= '9'; character++){
+                digits = true;
+                if(mantissa < 100000000000000000ULL){
+                    mantissa = mantissa * 10 + (*character - '0');
+                    exponent--;
+                }
+            }
+        }
+        if(!digits){
+            return false;
+        }
+
+        //an exponent without digits isn't part of the number
+        if(character < end && (*character == 'e' || *character == 'E')){
+            const char* exponentCharacter = character + 1;
+            bool negativeExponent = exponentCharacter < end && *exponentCharacter == '-';
+            if(exponentCharacter < end && (*exponentCharacter == '-' || *exponentCharacter == '+')){
+                exponentCharacter++;
+            }
+            if(exponentCharacter < end && *exponentCharacter >= '0' && *exponentCharacter <= '9'){
+                int parsed = 0;
+                for(; exponentCharacter < end && *exponentCharacter >= '0' && *exponentCharacter <= '9'; exponentCharacter++){
+                    parsed = std::min(parsed * 10 + (*exponentCharacter - '0'), 1000);
+                }
+                exponent += negativeExponent ? -parsed : parsed;
+                character = exponentCharacter;
+            }
+        }
+
+        //dividing by an exact power of ten rounds better than multiplying by an inexact one
+        double result = exponent < 0 ? static_cast<double>(mantissa) / pow(10.0, -exponent) : static_cast<double>(mantissa) * pow(10.0, exponent);
+        *value = static_cast<float>(negative ? -result : result);
+        *cursor = character;
+        return true;
+    }
+
+    //the most whitespace separated numbers a range of the document can hold
+    size_t maxNumbers(const char* begin, const char* end){
+        return static_cast<size_t>(end - begin + 1) / 2;
+    }
+}
+
+bool SME::Collada::Mesh::load(const char* path){
+    document.clear();
+    sources.clear();
+    primitives.clear();
+    triangleCount = 0;
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file.is_open()){
+        fprintf(stderr, "Couldn't open %s\n", path);
+        return false;
+    }
+    std::streamsize size = file.tellg();
+    file.seekg(0);
+    document.resize(static_cast<size_t>(size));
+    if(size <= 0 || !file.read(&document[0], size)){
+        fprintf(stderr, "Couldn't read %s\n", path);
+        return false;
+    }
+
+    const char* begin = document.c_str();
+    const char* end = begin + document.size();
+
+    Element mesh;
+    for(const char* position = begin; findElement(position, end, "mesh", &mesh); position = mesh.end){
+        //float arrays are the only data parsed ahead of reading the vertices
+        Element source;
+        for(const char* sourcePosition = mesh.content; findElement(sourcePosition, mesh.contentEnd, "source", &source); sourcePosition = source.end){
+            Element array;
+            std::string id = getAttribute(source, "id");
+            if(id.empty() || !findElement(source.content, source.contentEnd, "float_array", &array)){
+                continue;
+            }
+
+            Source &parsed = sources[id];
+            parsed.stride = 1;
+            Element accessor;
+            if(findElement(source.content, source.contentEnd, "accessor", &accessor)){
+                parsed.stride = std::max(getUnsignedAttribute(accessor, "stride", 1), 1u);
+            }
+
+            //the count is only trusted as far as the content could hold it
+            parsed.data.clear();
+            parsed.data.reserve(std::min<size_t>(getUnsignedAttribute(array, "count", 0), maxNumbers(array.content, array.contentEnd)));
+            const char* number = array.content;
+            float value;
+            while(parseFloat(&number, array.contentEnd, &value)){
+                parsed.data.push_back(value);
+            }
+        }
+
+        //<vertices> bundle the per position inputs
+        std::map<std::string, std::pair<const Source*, const Source*>> vertices;
+        Element vertexElement;
+        for(const char* vertexPosition = mesh.content; findElement(vertexPosition, mesh.contentEnd, "vertices", &vertexElement); vertexPosition = vertexElement.end){
+            std::pair<const Source*, const Source*> &inputs = vertices[getAttribute(vertexElement, "id")];
+            Element input;
+            for(const char* inputPosition = vertexElement.content; findElement(inputPosition, vertexElement.contentEnd, "input", &input); inputPosition = input.end){
+                std::string semantic = getAttribute(input, "semantic");
+                std::map<std::string, Source>::iterator found = sources.find(getReference(input, "source"));
+                if(found == sources.end()){
+                    continue;
+                }
+                if(semantic == "POSITION"){
+                    inputs.first = &found->second;
+                } else if(semantic == "COLOR" && inputs.second == nullptr){
+                    inputs.second = &found->second;
+                }
+            }
+        }
+
+        const char* primitiveNames[] = {"triangles", "polylist"};
+        for(const char* name : primitiveNames){
+            bool polylist = strcmp(name, "polylist") == 0;
+            Element element;
+            for(const char* primitivePosition = mesh.content; findElement(primitivePosition, mesh.contentEnd, name, &element); primitivePosition = element.end){
+                Primitive primitive = {nullptr, 0, nullptr, 0, 0, std::vector<uint32_t>(), getUnsignedAttribute(element, "count", 0), nullptr, nullptr};
+
+                Element input;
+                for(const char* inputPosition = element.content; findElement(inputPosition, element.contentEnd, "input", &input); inputPosition = input.end){
+                    std::string semantic = getAttribute(input, "semantic");
+                    uint32_t offset = getUnsignedAttribute(input, "offset", 0);
+                    primitive.indexStride = std::max(primitive.indexStride, offset + 1);
+                    if(semantic == "VERTEX"){
+                        std::map<std::string, std::pair<const Source*, const Source*>>::iterator found = vertices.find(getReference(input, "source"));
+                        if(found != vertices.end()){
+                            primitive.position = found->second.first;
+                            primitive.positionOffset = offset;
+                            if(found->second.second != nullptr && primitive.color == nullptr){
+                                primitive.color = found->second.second;
+                                primitive.colorOffset = offset;
+                            }
+                        }
+                    } else if(semantic == "COLOR" && primitive.color == nullptr){
+                        std::map<std::string, Source>::iterator found = sources.find(getReference(input, "source"));
+                        if(found != sources.end()){
+                            primitive.color = &found->second;
+                            primitive.colorOffset = offset;
+                        }
+                    }
+                }
+
+                if(primitive.polygonCount == 0){
+                    continue;
+                }
+                if(primitive.position == nullptr || primitive.position->stride < 3 || (primitive.color != nullptr && primitive.color->stride < 3)){
+                    fprintf(stderr, "A <%s> element of %s has no usable positions or colors!\n", name, path);
+                    return false;
+                }
+
+                Element indices;
+                if(!findElement(element.content, element.contentEnd, "p", &indices)){
+                    fprintf(stderr, "A <%s> element of %s has no <p>!\n", name, path);
+                    return false;
+                }
+
+                //the counts are checked against the <p> that has to hold
+                //their corners before anything is sized by them
+                uint64_t cornerCount = 0;
+                uint64_t primitiveTriangles = 0;
+                if(polylist){
+                    Element counts;
+                    if(!findElement(element.content, element.contentEnd, "vcount", &counts)){
+                        fprintf(stderr, "A <polylist> element of %s has no <vcount>!\n", path);
+                        return false;
+                    }
+                    const char* cursor = counts.content;
+                    uint32_t count;
+                    while(primitive.vertexCounts.size() < primitive.polygonCount && parseUnsigned(&cursor, counts.contentEnd, &count)){
+                        primitive.vertexCounts.push_back(count);
+                        cornerCount += count;
+                        primitiveTriangles += count > 2 ? count - 2 : 0;
+                    }
+                    if(primitive.vertexCounts.size() < primitive.polygonCount){
+                        fprintf(stderr, "The <vcount> of a <polylist> of %s is too short!\n", path);
+                        return false;
+                    }
+                } else {
+                    cornerCount = 3 * static_cast<uint64_t>(primitive.polygonCount);
+                    primitiveTriangles = primitive.polygonCount;
+                }
+                if(cornerCount > maxNumbers(indices.content, indices.contentEnd) / primitive.indexStride || triangleCount + primitiveTriangles > UINT32_MAX){
+                    fprintf(stderr, "The <p> of a <%s> of %s is too short!\n", name, path);
+                    return false;
+                }
+                triangleCount += static_cast<uint32_t>(primitiveTriangles);
+                primitive.indices = indices.content;
+                primitive.indicesEnd = indices.contentEnd;
+                primitives.push_back(std::move(primitive));
+            }
+        }
+
+        #ifdef DEBUG
+        const char* unsupportedNames[] = {"polygons", "trifans", "tristrips", "lines", "linestrips"};
+        for(const char* name : unsupportedNames){
+            Element element;
+            if(findElement(mesh.content, mesh.contentEnd, name, &element)){
+                fprintf(stdout, "Ignoring the <%s> of a mesh in %s\n", name, path);
+            }
+        }
+        #endif
+    }
+
+    rewind();
+    if(triangleCount == 0){
+        fprintf(stderr, "%s has no triangles!\n", path);
+        return false;
+    }
+    return true;
+}
+
+uint32_t SME::Collada::Mesh::getTriangleCount(){
+    return triangleCount;
+}
+
+void SME::Collada::Mesh::rewind(){
+    primitive = 0;
+    cursor = primitives.empty() ? nullptr : primitives[0].indices;
+    polygon = 0;
+    corner = 0;
+}
+
+bool SME::Collada::Mesh::readCorner(const Primitive &primitive, Vertex* vertex){
+    uint32_t positionIndex = 0;
+    uint32_t colorIndex = 0;
+    for(uint32_t i = 0; i < primitive.indexStride; i++){
+        uint32_t index;
+        if(!parseUnsigned(&cursor, primitive.indicesEnd, &index)){
+            return false;
+        }
+        if(i == primitive.positionOffset){
+            positionIndex = index;
+        }
+        if(i == primitive.colorOffset){
+            colorIndex = index;
+        }
+    }
+
+    const Source &position = *primitive.position;
+    if(static_cast<size_t>(positionIndex) * position.stride + 3 > position.data.size()){
+        return false;
+    }
+    const float* positionData = &position.data[static_cast<size_t>(positionIndex) * position.stride];
+    vertex->position[0] = positionData[0];
+    vertex->position[1] = positionData[1];
+    vertex->position[2] = positionData[2];
+    vertex->position[3] = 1.0f;
+
+    if(primitive.color == nullptr){
+        vertex->color[0] = vertex->color[1] = vertex->color[2] = vertex->color[3] = 1.0f;
+        return true;
+    }
+    const Source &color = *primitive.color;
+    if(static_cast<size_t>(colorIndex) * color.stride + 3 > color.data.size()){
+        return false;
+    }
+    const float* colorData = &color.data[static_cast<size_t>(colorIndex) * color.stride];
+    vertex->color[0] = colorData[0];
+    vertex->color[1] = colorData[1];
+    vertex->color[2] = colorData[2];
+    vertex->color[3] = color.stride > 3 ? colorData[3] : 1.0f;
+    return true;
+}
+
+uint32_t SME::Collada::Mesh::readTriangles(Vertex* vertices, uint32_t count){
+    uint32_t written = 0;
+    while(written < count && primitive < primitives.size()){
+        const Primitive &current = primitives[primitive];
+        if(polygon == current.polygonCount){
+            primitive++;
+            cursor = primitive < primitives.size() ? primitives[primitive].indices : nullptr;
+            polygon = 0;
+            corner = 0;
+            continue;
+        }
+
+        //polygons are fans around their first corner
+        if(corner == 0){
+            cornerCount = current.vertexCounts.empty() ? 3 : current.vertexCounts[polygon];
+            if(cornerCount < 3){
+                for(uint32_t i = 0; i < cornerCount; i++){
+                    if(!readCorner(current, &fanLast)){
+                        return written;
+                    }
+                }
+                polygon++;
+                continue;
+            }
+            if(!readCorner(current, &fanFirst) || !readCorner(current, &fanLast)){
+                return written;
+            }
+            corner = 2;
+        }
+
+        Vertex* triangle = vertices + static_cast<size_t>(written) * 3;
+        if(!readCorner(current, &triangle[2])){
+            return written;
+        }
+        triangle[0] = fanFirst;
+        triangle[1] = fanLast;
+        fanLast = triangle[2];
+        written++;
+
+        if(++corner == cornerCount){
+            polygon++;
+            corner = 0;
+        }
+    }
+    return written;
+}
@@ -0,0 +1,99 @@
+#ifndef SME_COLLADA_H
+#define SME_COLLADA_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace SME { namespace Collada {
+
+    /**
+     * Interleaved vertex written by the loader, matching the vertex input of
+     * the test pipeline.
+     */
+    struct Vertex {
+        float position[4];  //xyzw, w is always 1
+        float color[4];     //rgba from the COLOR input, opaque white without one
+    };
+
+    /**
+     * The triangles of every <mesh> of a Collada (.dae) document, from its
+     * <triangles> and <polylist> primitives. Polygons are split into fans.
+     * The document is read into memory once and scanned in place: only the
+     * <float_array>s are parsed up front, the <p> index lists are parsed
+     * while the vertices are read, straight into the caller's memory, so no
+     * per vertex data is ever held. Transforms of the visual scene are
+     * ignored.
+     */
+    class Mesh {
+    public:
+        /**
+         * Reads and indexes a document. Anything loaded before is discarded.
+         * The counts the document states are checked against its data before
+         * anything is sized by them, and numbers are parsed the same way in
+         * every locale.
+         * @param path path of the .dae file
+         * @return true if the document has at least one triangle, false if it
+         * couldn't be read or its geometry is malformed
+         */
+        bool load(const char* path);
+
+        /**
+         * @return the amount of triangles in the document
+         */
+        uint32_t getTriangleCount();
+
+        /**
+         * Writes the next triangles of the document, three vertices each,
+         * carrying on where the previous call stopped.
+         * @param vertices where to write the vertices, room for three per
+         * triangle
+         * @param count amount of triangles to write
+         * @return the amount of triangles written, less than count at the end
+         * of the document or if an index list is malformed
+         */
+        uint32_t readTriangles(Vertex* vertices, uint32_t count);
+
+        /**
+         * Makes readTriangles start over from the first triangle.
+         */
+        void rewind();
+    private:
+        struct Source {
+            std::vector<float> data;
+            uint32_t stride;
+        };
+
+        struct Primitive {
+            const Source* position;
+            uint32_t positionOffset;
+            const Source* color;        //null if the primitive has no colors
+            uint32_t colorOffset;
+            uint32_t indexStride;       //indices per polygon corner
+            std::vector<uint32_t> vertexCounts; //corners of each polygon, empty for <triangles>
+            uint32_t polygonCount;
+            const char* indices;        //contents of <p>, within document
+            const char* indicesEnd;
+        };
+
+        bool readCorner(const Primitive &primitive, Vertex* vertex);
+
+        std::string document;
+        std::map<std::string, Source> sources; //by id
+        std::vector<Primitive> primitives;
+        uint32_t triangleCount = 0;
+
+        //where readTriangles carries on
+        size_t primitive = 0;
+        const char* cursor = nullptr;
+        uint32_t polygon = 0;
+        uint32_t corner = 0;
+        uint32_t cornerCount = 0;
+        Vertex fanFirst;
+        Vertex fanLast;
+    };
+}}
+
+#endif /* SME_COLLADA_H */
+
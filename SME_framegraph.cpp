@@ -0,0 +1,285 @@
+#include "SME_framegraph.h"
+#include "SME_pipeline.h"
+
+#include <stdio.h>
+
+namespace {
+    const VkAccessFlags writeAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+            VK_ACCESS_MEMORY_WRITE_BIT;
+
+    //what the passes compiled so far did to a resource
+    struct ResourceState {
+        VkImageLayout layout;
+        uint32_t owner;                     //queue family owning it
+        VkPipelineStageFlags writeStages;   //last write, or the semaphore wait making it available
+        VkAccessFlags writeAccess;
+        VkPipelineStageFlags readStages;    //reads since the last write
+        VkPipelineStageFlags visibleStages; //stages the last write was made visible to
+        VkAccessFlags visibleAccess;
+    };
+}
+
+void SME::FrameGraph::Pass::read(Resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout){
+    uses.push_back({resource, stages, access & ~writeAccessMask, layout, VK_IMAGE_LAYOUT_UNDEFINED});
+}
+
+void SME::FrameGraph::Pass::write(Resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout, VkImageLayout finalLayout){
+    uses.push_back({resource, stages, access, layout, finalLayout});
+}
+
+SME::FrameGraph::FrameGraph(uint32_t queueFamilyIndex) : queueFamilyIndex(queueFamilyIndex) {
+}
+
+SME::FrameGraph::Resource SME::FrameGraph::addImage(const std::vector<VkImage> &images, VkImageAspectFlags aspectMask,
+        VkImageLayout initialLayout, VkImageLayout finalLayout, bool output){
+    std::lock_guard<std::mutex> lock(mutex);
+    resources.push_back({true, images, VK_NULL_HANDLE, aspectMask, initialLayout, finalLayout, output, VK_QUEUE_FAMILY_IGNORED, 0});
+    return static_cast<Resource>(resources.size() - 1);
+}
+
+SME::FrameGraph::Resource SME::FrameGraph::addBuffer(VkBuffer buffer, bool output){
+    std::lock_guard<std::mutex> lock(mutex);
+    resources.push_back({false, std::vector<VkImage>(), buffer, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, output, VK_QUEUE_FAMILY_IGNORED, 0});
+    return static_cast<Resource>(resources.size() - 1);
+}
+
+void SME::FrameGraph::setImages(Resource resource, const std::vector<VkImage> &images){
+    std::lock_guard<std::mutex> lock(mutex);
+    resources[resource].images = images;
+}
+
+void SME::FrameGraph::setBuffer(Resource resource, VkBuffer buffer){
+    std::lock_guard<std::mutex> lock(mutex);
+    resources[resource].buffer = buffer;
+}
+
+void SME::FrameGraph::setExternal(Resource resource, uint32_t queueFamilyIndex, VkPipelineStageFlags waitStages){
+    std::lock_guard<std::mutex> lock(mutex);
+    resources[resource].queueFamilyIndex = queueFamilyIndex == this->queueFamilyIndex ? VK_QUEUE_FAMILY_IGNORED : queueFamilyIndex;
+    resources[resource].waitStages = waitStages;
+}
+
+bool SME::FrameGraph::compile(const std::vector<Pipeline*> &pipelines){
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<Pass> passes(pipelines.size());
+    for(size_t i = 0; i < pipelines.size(); i++){
+        pipelines[i]->declareResources(passes[i]);
+        for(const Pass::Use &use : passes[i].uses){
+            if(use.resource >= resources.size()){
+                fprintf(stderr, "Pass %zu uses unknown frame graph resource %u!\n", i, use.resource);
+                return false;
+            }
+        }
+    }
+
+    //walk back from the outputs, a pass is kept if something later reads what
+    //it writes. Overwriting a resource without reading it makes earlier
+    //writes to it pointless
+    culled.assign(passes.size(), true);
+    std::vector<bool> needed(resources.size());
+    for(size_t i = 0; i < resources.size(); i++){
+        needed[i] = resources[i].output;
+    }
+    for(size_t i = passes.size(); i-- > 0;){
+        for(const Pass::Use &use : passes[i].uses){
+            if((use.access & writeAccessMask) && needed[use.resource]){
+                culled[i] = false;
+            }
+        }
+        if(culled[i]){
+            continue;
+        }
+        for(const Pass::Use &use : passes[i].uses){
+            if((use.access & writeAccessMask) && !(use.access & ~writeAccessMask)){
+                needed[use.resource] = false;
+            }
+        }
+        for(const Pass::Use &use : passes[i].uses){
+            if(use.access & ~writeAccessMask){
+                needed[use.resource] = true;
+            }
+        }
+    }
+
+    std::vector<ResourceState> states(resources.size());
+    for(size_t i = 0; i < resources.size(); i++){
+        states[i] = {resources[i].initialLayout, resources[i].queueFamilyIndex, resources[i].waitStages, 0, 0, 0, 0};
+    }
+
+    batches.assign(passes.size() + 1, BarrierBatch());
+    #ifdef DEBUG
+    size_t culledCount = 0;
+    size_t barrierCount = 0;
+    #endif
+    for(size_t i = 0; i < passes.size(); i++){
+        if(culled[i]){
+            #ifdef DEBUG
+            culledCount++;
+            #endif
+            continue;
+        }
+
+        //hazards are checked against the state before the pass, so a
+        //resource used twice by the same pass doesn't wait on itself
+        BarrierBatch &batch = batches[i];
+        std::vector<ResourceState> updated = states;
+        for(const Pass::Use &use : passes[i].uses){
+            const ResourceInfo &info = resources[use.resource];
+            const ResourceState &state = states[use.resource];
+            ResourceState &next = updated[use.resource];
+            VkAccessFlags writes = use.access & writeAccessMask;
+            VkAccessFlags reads = use.access & ~writeAccessMask;
+
+            //contents that are overwritten or never defined need no ownership transfer
+            bool acquire = state.owner != VK_QUEUE_FAMILY_IGNORED && reads && state.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+            bool transition = info.image && ((use.layout != VK_IMAGE_LAYOUT_UNDEFINED && use.layout != state.layout) || acquire);
+            bool hazard = false;
+            if(writes){
+                hazard = state.writeStages != 0 || state.readStages != 0;
+            } else if(state.writeStages != 0){
+                //reads after the last write only wait once per stage and access
+                hazard = (use.stages & ~state.visibleStages) != 0 || (state.writeAccess != 0 && (reads & ~state.visibleAccess) != 0);
+            }
+
+            if(transition){
+                //layout transitions write the image, so they wait on the reads too
+                VkImageLayout newLayout = use.layout != VK_IMAGE_LAYOUT_UNDEFINED ? use.layout : state.layout;
+                batch.srcStages |= state.writeStages | state.readStages;
+                batch.dstStages |= use.stages;
+                batch.imageBarriers.push_back({
+                    use.resource,
+                    state.writeAccess,
+                    use.access,
+                    reads ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED,
+                    newLayout,
+                    acquire ? state.owner : VK_QUEUE_FAMILY_IGNORED,
+                    acquire ? queueFamilyIndex : VK_QUEUE_FAMILY_IGNORED
+                });
+                next.layout = newLayout;
+            } else if(hazard){
+                //a single global memory barrier covers every other resource
+                batch.srcStages |= writes ? state.writeStages | state.readStages : state.writeStages;
+                batch.dstStages |= use.stages;
+                if(state.writeAccess){
+                    batch.srcAccess |= state.writeAccess;
+                    batch.dstAccess |= use.access;
+                }
+            }
+
+            if(writes){
+                next.writeStages = use.stages;
+                next.writeAccess = writes;
+                next.readStages = 0;
+                next.visibleStages = 0;
+                next.visibleAccess = 0;
+            } else {
+                next.readStages |= use.stages;
+                if(transition || hazard){
+                    next.visibleStages |= use.stages;
+                    next.visibleAccess |= reads;
+                }
+            }
+            if(use.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED){
+                next.layout = use.finalLayout;
+            }
+            next.owner = VK_QUEUE_FAMILY_IGNORED;
+        }
+        states.swap(updated);
+        #ifdef DEBUG
+        barrierCount += batch.imageBarriers.size() + (batch.srcAccess != 0 ? 1 : 0);
+        #endif
+    }
+
+    //leave images the way the next frame or the presentation engine expects them
+    BarrierBatch &finalBatch = batches.back();
+    for(size_t i = 0; i < resources.size(); i++){
+        const ResourceInfo &info = resources[i];
+        const ResourceState &state = states[i];
+        if(!info.image){
+            continue;
+        }
+        bool release = state.owner == VK_QUEUE_FAMILY_IGNORED && info.queueFamilyIndex != VK_QUEUE_FAMILY_IGNORED;
+        VkImageLayout finalLayout = info.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED ? info.finalLayout : state.layout;
+        if(finalLayout == state.layout && !release){
+            continue;
+        }
+        finalBatch.srcStages |= state.writeStages | state.readStages;
+        finalBatch.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        finalBatch.imageBarriers.push_back({
+            static_cast<Resource>(i),
+            state.writeAccess,
+            0,
+            state.layout,
+            finalLayout,
+            release ? queueFamilyIndex : VK_QUEUE_FAMILY_IGNORED,
+            release ? info.queueFamilyIndex : VK_QUEUE_FAMILY_IGNORED
+        });
+    }
+
+    #ifdef DEBUG
+    barrierCount += finalBatch.imageBarriers.size();
+    fprintf(stdout, "Frame graph: %zu of %zu passes culled, %zu barriers per frame\n", culledCount, passes.size(), barrierCount);
+    #endif
+    return true;
+}
+
+bool SME::FrameGraph::isCulled(size_t pass){
+    return pass < culled.size() && culled[pass];
+}
+
+void SME::FrameGraph::recordBarriers(VkCommandBuffer commandBuffer, size_t pass, uint32_t imageIndex){
+    if(pass + 1 < batches.size()){
+        recordBatch(commandBuffer, batches[pass], imageIndex);
+    }
+}
+
+void SME::FrameGraph::recordFinalBarriers(VkCommandBuffer commandBuffer, uint32_t imageIndex){
+    if(!batches.empty()){
+        recordBatch(commandBuffer, batches.back(), imageIndex);
+    }
+}
+
+void SME::FrameGraph::recordBatch(VkCommandBuffer commandBuffer, const BarrierBatch &batch, uint32_t imageIndex){
+    if(batch.dstStages == 0){
+        return;
+    }
+
+    VkMemoryBarrier memoryBarrier = {
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER,   //sType
+        nullptr,                            //pNext
+        batch.srcAccess,                    //srcAccessMask
+        batch.dstAccess                     //dstAccessMask
+    };
+
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    imageBarriers.reserve(batch.imageBarriers.size());
+    for(const ImageBarrier &barrier : batch.imageBarriers){
+        const ResourceInfo &info = resources[barrier.resource];
+        imageBarriers.push_back({
+            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,         //sType
+            nullptr,                                        //pNext
+            barrier.srcAccess,                              //srcAccessMask
+            barrier.dstAccess,                              //dstAccessMask
+            barrier.oldLayout,                              //oldLayout
+            barrier.newLayout,                              //newLayout
+            barrier.srcQueueFamilyIndex,                    //srcQueueFamilyIndex
+            barrier.dstQueueFamilyIndex,                    //dstQueueFamilyIndex
+            info.images[imageIndex % info.images.size()],   //image
+            {                                               //subresourceRange
+                info.aspectMask,                            //aspectMask
+                0,                                          //baseMipLevel
+                VK_REMAINING_MIP_LEVELS,                    //levelCount
+                0,                                          //baseArrayLayer
+                VK_REMAINING_ARRAY_LAYERS                   //layerCount
+            }
+        });
+    }
+
+    //nothing to wait on if the resources weren't touched yet this frame
+    VkPipelineStageFlags srcStages = batch.srcStages != 0 ? batch.srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, srcStages, batch.dstStages, 0,
+            batch.srcAccess != 0 ? 1 : 0, &memoryBarrier, 0, nullptr,
+            static_cast<uint32_t>(imageBarriers.size()), imageBarriers.empty() ? nullptr : &imageBarriers[0]);
+}
@@ -0,0 +1,207 @@
+#ifndef SME_FRAMEGRAPH_H
+#define SME_FRAMEGRAPH_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+
+namespace SME {
+    class Pipeline;
+
+    /**
+     * Orders the synchronisation of a frame. Every pipeline is a pass that
+     * declares the resources it reads and writes, from which the graph works
+     * out the pipeline barriers and image layout transitions needed between
+     * passes, batched into one vkCmdPipelineBarrier per pass. Passes whose
+     * outputs are never used are culled. Passes run in the order the
+     * pipelines were added, the graph never reorders them.
+     */
+    class FrameGraph {
+    public:
+        typedef uint32_t Resource;
+
+        /**
+         * The resources used by a pass, handed to Pipeline::declareResources.
+         */
+        class Pass {
+        public:
+            /**
+             * Declares a resource the pass only reads.
+             * @param resource the resource that is read
+             * @param stages pipeline stages reading it
+             * @param access how it is read
+             * @param layout layout images must be in when the pass starts,
+             * VK_IMAGE_LAYOUT_UNDEFINED to leave it alone
+             */
+            void read(Resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+            /**
+             * Declares a resource the pass writes. The previous contents are
+             * only kept if access also has read bits, such as
+             * VK_ACCESS_COLOR_ATTACHMENT_READ_BIT for VK_ATTACHMENT_LOAD_OP_LOAD,
+             * otherwise passes that wrote it before may get culled.
+             * @param resource the resource that is written
+             * @param stages pipeline stages accessing it
+             * @param access how it is accessed
+             * @param layout layout images must be in when the pass starts, the
+             * initialLayout of render pass attachments. VK_IMAGE_LAYOUT_UNDEFINED
+             * to leave it alone
+             * @param finalLayout layout the pass leaves images in, the
+             * finalLayout of render pass attachments. VK_IMAGE_LAYOUT_UNDEFINED
+             * if it is left in layout
+             */
+            void write(Resource resource, VkPipelineStageFlags stages, VkAccessFlags access,
+                    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+        private:
+            friend class FrameGraph;
+
+            struct Use {
+                Resource resource;
+                VkPipelineStageFlags stages;
+                VkAccessFlags access;
+                VkImageLayout layout;
+                VkImageLayout finalLayout;
+            };
+
+            std::vector<Use> uses;
+        };
+
+        /**
+         * @param queueFamilyIndex family of the queue the passes are submitted to
+         */
+        FrameGraph(uint32_t queueFamilyIndex);
+
+        FrameGraph(const FrameGraph&) = delete;
+        FrameGraph& operator=(const FrameGraph&) = delete;
+
+        /**
+         * Adds an image used by the passes. Safe to call from multiple threads.
+         * @param images the image, or one image per swap chain image
+         * @param aspectMask aspects transitioned when the layout changes
+         * @param initialLayout layout the image is in when a frame starts,
+         * VK_IMAGE_LAYOUT_UNDEFINED if its contents don't carry over between
+         * frames
+         * @param finalLayout layout the image is transitioned to at the end of
+         * the frame, VK_IMAGE_LAYOUT_UNDEFINED to leave it in whatever layout
+         * the last pass left it. Must match initialLayout unless that is
+         * undefined.
+         * @param output whether the image is used after the frame, such as a
+         * swap chain image. Passes that only write unused resources are culled.
+         * @return the resource to declare in the passes
+         */
+        Resource addImage(const std::vector<VkImage> &images, VkImageAspectFlags aspectMask,
+                VkImageLayout initialLayout, VkImageLayout finalLayout, bool output = false);
+
+        /**
+         * Adds a buffer used by the passes. Safe to call from multiple threads.
+         * @param buffer the buffer
+         * @param output whether the buffer is used after the frame
+         * @return the resource to declare in the passes
+         */
+        Resource addBuffer(VkBuffer buffer, bool output = false);
+
+        /**
+         * Replaces the buffer of a resource, for instance after
+         * SME::Buffer::defragment moved it. Doesn't require compiling again.
+         * @param resource the buffer resource
+         * @param buffer the new buffer
+         */
+        void setBuffer(Resource resource, VkBuffer buffer);
+
+        /**
+         * Replaces the images of a resource, for instance after the swap chain
+         * got recreated. Doesn't require compiling again.
+         * @param resource the image resource
+         * @param images the new images, as many as before or a single one
+         */
+        void setImages(Resource resource, const std::vector<VkImage> &images);
+
+        /**
+         * Marks a resource as coming from outside the frame's queue, like swap
+         * chain images that are acquired from the presentation engine.
+         * Ownership is taken from the family on first use if the contents
+         * carry over, and given back at the end of the frame.
+         * @param resource the resource
+         * @param queueFamilyIndex family owning the resource between frames
+         * @param waitStages stages of the frame's semaphore wait that make the
+         * resource available, the first barrier waits on them
+         */
+        void setExternal(Resource resource, uint32_t queueFamilyIndex, VkPipelineStageFlags waitStages);
+
+        /**
+         * Collects the resources of every pipeline through
+         * Pipeline::declareResources, culls unused passes and computes the
+         * barriers. Must be called again when the pipelines or their
+         * declarations change.
+         * @param pipelines the passes, in submission order
+         * @return false if a pass declared an unknown resource
+         */
+        bool compile(const std::vector<Pipeline*> &pipelines);
+
+        /**
+         * @param pass index of the pass, as passed to compile
+         * @return true if the pass was culled and must not be recorded
+         */
+        bool isCulled(size_t pass);
+
+        /**
+         * Records the barriers needed before a pass.
+         * @param commandBuffer the command buffer the frame is recorded into
+         * @param pass index of the pass, as passed to compile
+         * @param imageIndex swap chain image the frame renders to, selects the
+         * images of resources that have one per swap chain image
+         */
+        void recordBarriers(VkCommandBuffer commandBuffer, size_t pass, uint32_t imageIndex);
+
+        /**
+         * Records the barriers bringing the resources into their final layout
+         * and returning ownership of external ones, after the last pass.
+         * @param commandBuffer the command buffer the frame is recorded into
+         * @param imageIndex swap chain image the frame renders to
+         */
+        void recordFinalBarriers(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    private:
+        struct ResourceInfo {
+            bool image;
+            std::vector<VkImage> images;
+            VkBuffer buffer;
+            VkImageAspectFlags aspectMask;
+            VkImageLayout initialLayout;
+            VkImageLayout finalLayout;
+            bool output;
+            uint32_t queueFamilyIndex; //owner between frames
+            VkPipelineStageFlags waitStages;
+        };
+
+        struct ImageBarrier {
+            Resource resource;
+            VkAccessFlags srcAccess;
+            VkAccessFlags dstAccess;
+            VkImageLayout oldLayout;
+            VkImageLayout newLayout;
+            uint32_t srcQueueFamilyIndex;
+            uint32_t dstQueueFamilyIndex;
+        };
+
+        //everything recorded before a pass, as a single vkCmdPipelineBarrier
+        struct BarrierBatch {
+            VkPipelineStageFlags srcStages;
+            VkPipelineStageFlags dstStages;
+            VkAccessFlags srcAccess; //of the global memory barrier
+            VkAccessFlags dstAccess;
+            std::vector<ImageBarrier> imageBarriers;
+        };
+
+        void recordBatch(VkCommandBuffer commandBuffer, const BarrierBatch &batch, uint32_t imageIndex);
+
+        uint32_t queueFamilyIndex;
+        std::vector<ResourceInfo> resources;
+        std::vector<bool> culled; //per pass
+        std::vector<BarrierBatch> batches; //one per pass, then the final one
+        std::mutex mutex;
+    };
+}
+
+#endif /* SME_FRAMEGRAPH_H */
+
@@ -0,0 +1,501 @@
+#include "SME_memory.h"
+#include "SME_VkUtil.h"
+#include <iostream>
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <initializer_list>
+
+struct SME::Memory::MemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memoryTypeIndex;
+    bool linear;
+    bool dedicated; //holds a single allocation bigger than a block
+    void* mapped;
+    VkDeviceSize usedBytes; //taken by allocations, blocks that are used the most are filled first
+    std::vector<std::set<VkDeviceSize>> freeLists; //free offsets per size class
+};
+
+//Running totals of a memory type or heap, the rest of the statistics is read from the blocks
+struct UsageCounters {
+    uint32_t allocationCount = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize requestedBytes = 0;
+    VkDeviceSize peakUsedBytes = 0;
+};
+
+//Allocator state of one logical device
+struct DeviceAllocator {
+    std::mutex mutex;
+    VkPhysicalDevice physicalDevice;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2; //null without VK_EXT_memory_budget
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize nonCoherentAtomSize;
+    uint32_t maxAllocationCount;
+    uint32_t allocationCount;
+    std::vector<SME::Memory::MemoryBlock*> blocks;
+    UsageCounters typeUsage[VK_MAX_MEMORY_TYPES];
+    UsageCounters heapUsage[VK_MAX_MEMORY_HEAPS];
+};
+
+std::mutex allocatorsMutex;
+std::map<VkDevice, DeviceAllocator*> allocators;
+
+DeviceAllocator* getAllocator(VkDevice device, VkPhysicalDevice physicalDevice){
+    std::lock_guard<std::mutex> lock(allocatorsMutex);
+    std::map<VkDevice, DeviceAllocator*>::iterator it = allocators.find(device);
+    if(it != allocators.end()){
+        return it->second;
+    }
+    if(physicalDevice == VK_NULL_HANDLE){
+        return nullptr;
+    }
+
+    DeviceAllocator* allocator = new DeviceAllocator();
+    allocator->physicalDevice = physicalDevice;
+    allocator->getMemoryProperties2 = nullptr;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &allocator->memoryProperties);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    allocator->nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+    allocator->maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+    allocator->allocationCount = 0;
+    allocators[device] = allocator;
+    return allocator;
+}
+
+void SME::Memory::initAllocator(VkDevice device, VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2){
+    DeviceAllocator* allocator = getAllocator(device, physicalDevice);
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+    allocator->getMemoryProperties2 = getMemoryProperties2;
+}
+
+VkDeviceSize sizeClassSize(uint32_t sizeClass){
+    return static_cast<VkDeviceSize>(SME_MEMORY_MIN_ALLOCATION) << sizeClass;
+}
+
+void trackUsage(DeviceAllocator* allocator, uint32_t memoryTypeIndex, VkDeviceSize usedBytes, VkDeviceSize requestedBytes, bool allocated){
+    UsageCounters* counters[] = {
+        &allocator->typeUsage[memoryTypeIndex],
+        &allocator->heapUsage[allocator->memoryProperties.memoryTypes[memoryTypeIndex].heapIndex]
+    };
+    for(UsageCounters* usage : counters){
+        if(allocated){
+            usage->allocationCount++;
+            usage->usedBytes += usedBytes;
+            usage->requestedBytes += requestedBytes;
+            usage->peakUsedBytes = std::max(usage->peakUsedBytes, usage->usedBytes);
+        } else {
+            usage->allocationCount--;
+            usage->usedBytes -= usedBytes;
+            usage->requestedBytes -= requestedBytes;
+        }
+    }
+}
+
+SME::Memory::MemoryBlock* allocateBlock(VkDevice device, DeviceAllocator* allocator, VkDeviceSize size, uint32_t memoryTypeIndex, bool linear, bool dedicated){
+    if(allocator->maxAllocationCount > 0 && allocator->allocationCount >= allocator->maxAllocationCount){
+        fprintf(stderr, "Reached the device limit of %u memory allocations!\n", allocator->maxAllocationCount);
+        return nullptr;
+    }
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,     // sType
+        nullptr,                                    // *pNext
+        size,                                       // allocationSize
+        memoryTypeIndex                             // memoryTypeIndex
+    };
+
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(device, &memoryAllocateInfo, nullptr, &memory);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Failed allocating memory block: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return nullptr;
+    }
+
+    void* mapped = nullptr;
+    if(allocator->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT){
+        result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        if(result != VK_SUCCESS){
+            fprintf(stderr, "Could not map memory block: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            vkFreeMemory(device, memory, nullptr);
+            return nullptr;
+        }
+    }
+    allocator->allocationCount++;
+
+    SME::Memory::MemoryBlock* block = new SME::Memory::MemoryBlock{memory, size, memoryTypeIndex, linear, dedicated, mapped, 0, {}};
+    if(!dedicated){
+        uint32_t sizeClasses = 1;
+        while(sizeClassSize(sizeClasses - 1) < size){
+            sizeClasses++;
+        }
+        block->freeLists.resize(sizeClasses);
+        block->freeLists.back().insert(0);
+    }
+    allocator->blocks.push_back(block);
+    return block;
+}
+
+//smallest size class with a free range that fits, or the class count if none does
+uint32_t findFreeSizeClass(SME::Memory::MemoryBlock* block, uint32_t sizeClass){
+    if(block->dedicated){
+        return static_cast<uint32_t>(block->freeLists.size());
+    }
+    uint32_t available = sizeClass;
+    while(available < block->freeLists.size() && block->freeLists[available].empty()){
+        available++;
+    }
+    return available;
+}
+
+//the fullest block of the kind with room for the size class, so sparse
+//blocks drain and can be freed
+SME::Memory::MemoryBlock* findBlock(DeviceAllocator* allocator, uint32_t memoryTypeIndex, bool linear, uint32_t sizeClass, SME::Memory::MemoryBlock* excluded){
+    SME::Memory::MemoryBlock* best = nullptr;
+    for(SME::Memory::MemoryBlock* candidate : allocator->blocks){
+        if(candidate != excluded && candidate->memoryTypeIndex == memoryTypeIndex && candidate->linear == linear
+                && findFreeSizeClass(candidate, sizeClass) < candidate->freeLists.size()
+                && (best == nullptr || candidate->usedBytes > best->usedBytes)){
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+bool allocateFromBlock(SME::Memory::MemoryBlock* block, uint32_t sizeClass, VkDeviceSize* offset){
+    //smallest free range that fits, split in halves until it is the right size
+    uint32_t available = findFreeSizeClass(block, sizeClass);
+    if(available == block->freeLists.size()){
+        return false;
+    }
+
+    *offset = *block->freeLists[available].begin();
+    block->freeLists[available].erase(block->freeLists[available].begin());
+    while(available > sizeClass){
+        available--;
+        block->freeLists[available].insert(*offset + sizeClassSize(available));
+    }
+    block->usedBytes += sizeClassSize(sizeClass);
+    return true;
+}
+
+void fillAllocation(DeviceAllocator* allocator, SME::Memory::MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size, uint32_t sizeClass, SME::Memory::Allocation* allocation){
+    trackUsage(allocator, block->memoryTypeIndex, block->dedicated ? block->size : sizeClassSize(sizeClass), size, true);
+    
+    allocation->memory = block->memory;
+    allocation->offset = offset;
+    allocation->size = size;
+    allocation->mapped = block->mapped != nullptr ? static_cast<char*>(block->mapped) + offset : nullptr;
+    allocation->memoryTypeIndex = block->memoryTypeIndex;
+    allocation->block = block;
+    allocation->sizeClass = sizeClass;
+}
+
+void freeBlock(VkDevice device, DeviceAllocator* allocator, SME::Memory::MemoryBlock* block){
+    vkFreeMemory(device, block->memory, nullptr);
+    allocator->allocationCount--;
+    allocator->blocks.erase(std::find(allocator->blocks.begin(), allocator->blocks.end(), block));
+    delete block;
+}
+
+bool SME::Memory::allocate(VkDevice device, VkPhysicalDevice physicalDevice, const VkMemoryRequirements &requirements,
+        VkMemoryPropertyFlags properties, bool linear, Allocation* allocation, VkMemoryPropertyFlags preferredProperties){
+    DeviceAllocator* allocator = getAllocator(device, physicalDevice);
+    if(allocator == nullptr){
+        return false;
+    }
+
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    for(VkMemoryPropertyFlags wanted : {properties | preferredProperties, properties}){
+        for(uint32_t i = 0; i < allocator->memoryProperties.memoryTypeCount && memoryTypeIndex == UINT32_MAX; i++){
+            if((requirements.memoryTypeBits & (1 << i))
+                    && (allocator->memoryProperties.memoryTypes[i].propertyFlags & wanted) == wanted){
+                memoryTypeIndex = i;
+            }
+        }
+    }
+    if(memoryTypeIndex == UINT32_MAX){
+        fprintf(stderr, "Couldn't find suitable memory to allocate the buffer.\n");
+        return false;
+    }
+
+    //offsets within a block are multiples of the size class, which covers the alignment
+    VkDeviceSize classSize = std::max(requirements.size, requirements.alignment);
+    uint32_t sizeClass = 0;
+    while(sizeClassSize(sizeClass) < classSize){
+        sizeClass++;
+    }
+
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+
+    MemoryBlock* block = nullptr;
+    VkDeviceSize offset = 0;
+    if(classSize > SME_MEMORY_BLOCK_SIZE){
+        block = allocateBlock(device, allocator, requirements.size, memoryTypeIndex, linear, true);
+        if(block == nullptr){
+            return false;
+        }
+    } else {
+        block = findBlock(allocator, memoryTypeIndex, linear, sizeClass, nullptr);
+        if(block != nullptr){
+            allocateFromBlock(block, sizeClass, &offset);
+        } else {
+            block = allocateBlock(device, allocator, SME_MEMORY_BLOCK_SIZE, memoryTypeIndex, linear, false);
+            if(block == nullptr || !allocateFromBlock(block, sizeClass, &offset)){
+                return false;
+            }
+        }
+    }
+
+    fillAllocation(allocator, block, offset, requirements.size, sizeClass, allocation);
+    return true;
+}
+
+bool SME::Memory::relocate(VkDevice device, const Allocation &allocation, Allocation* moved){
+    MemoryBlock* source = allocation.block;
+    if(source == nullptr || source->dedicated){
+        return false;
+    }
+    DeviceAllocator* allocator = getAllocator(device, VK_NULL_HANDLE);
+    if(allocator == nullptr){
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+    
+    //only towards blocks used more than the source, so moves always converge
+    MemoryBlock* target = findBlock(allocator, source->memoryTypeIndex, source->linear, allocation.sizeClass, source);
+    if(target == nullptr || target->usedBytes < source->usedBytes){
+        return false;
+    }
+    
+    VkDeviceSize offset;
+    allocateFromBlock(target, allocation.sizeClass, &offset);
+    fillAllocation(allocator, target, offset, allocation.size, allocation.sizeClass, moved);
+    return true;
+}
+
+void SME::Memory::release(VkDevice device, Allocation* allocation){
+    if(allocation->block == nullptr){
+        return;
+    }
+    DeviceAllocator* allocator = getAllocator(device, VK_NULL_HANDLE);
+    if(allocator == nullptr){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+    MemoryBlock* block = allocation->block;
+    trackUsage(allocator, allocation->memoryTypeIndex, block->dedicated ? block->size : sizeClassSize(allocation->sizeClass), allocation->size, false);
+    if(block->dedicated){
+        freeBlock(device, allocator, block);
+    } else {
+        //merge with the buddy range as long as it is free as well
+        VkDeviceSize offset = allocation->offset;
+        uint32_t sizeClass = allocation->sizeClass;
+        while(sizeClass + 1 < block->freeLists.size() && block->freeLists[sizeClass].erase(offset ^ sizeClassSize(sizeClass)) > 0){
+            offset &= ~sizeClassSize(sizeClass);
+            sizeClass++;
+        }
+        block->freeLists[sizeClass].insert(offset);
+        block->usedBytes -= sizeClassSize(allocation->sizeClass);
+        
+        //empty blocks are given back, except the last one of their kind so
+        //allocating and releasing a single resource doesn't hit the driver
+        if(block->usedBytes == 0){
+            for(MemoryBlock* other : allocator->blocks){
+                if(other != block && !other->dedicated && other->memoryTypeIndex == block->memoryTypeIndex && other->linear == block->linear){
+                    freeBlock(device, allocator, block);
+                    break;
+                }
+            }
+        }
+    }
+
+    *allocation = Allocation();
+}
+
+bool SME::Memory::isCoherent(VkDevice device, const Allocation &allocation){
+    DeviceAllocator* allocator = getAllocator(device, VK_NULL_HANDLE);
+    return allocator != nullptr && allocation.block != nullptr
+            && (allocator->memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+bool SME::Memory::flush(VkDevice device, const Allocation &allocation, VkDeviceSize offset, VkDeviceSize size){
+    DeviceAllocator* allocator = getAllocator(device, VK_NULL_HANDLE);
+    if(allocator == nullptr || allocation.block == nullptr){
+        return false;
+    }
+    if(allocator->memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT){
+        return true;
+    }
+
+    //flushed ranges must be aligned to the atom size, or reach the end of the memory
+    VkDeviceSize start = allocation.offset + offset;
+    VkDeviceSize end = start + size;
+    start -= start % allocator->nonCoherentAtomSize;
+    end += (allocator->nonCoherentAtomSize - end % allocator->nonCoherentAtomSize) % allocator->nonCoherentAtomSize;
+
+    VkMappedMemoryRange flushRange = {
+        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,            // sType
+        nullptr,                                          // *pNext
+        allocation.memory,                                // memory
+        start,                                            // offset
+        end >= allocation.block->size ? VK_WHOLE_SIZE : end - start // size
+    };
+
+    VkResult result = vkFlushMappedMemoryRanges(device, 1, &flushRange);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Could not flush mapped memory: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    return true;
+}
+
+bool SME::Memory::getStatistics(VkDevice device, Statistics* statistics){
+    DeviceAllocator* allocator = getAllocator(device, VK_NULL_HANDLE);
+    if(allocator == nullptr){
+        return false;
+    }
+    
+    *statistics = Statistics();
+    statistics->memoryTypeCount = allocator->memoryProperties.memoryTypeCount;
+    statistics->memoryHeapCount = allocator->memoryProperties.memoryHeapCount;
+    
+    //free bytes per type and heap, for the fragmentation
+    VkDeviceSize typeFreeBytes[VK_MAX_MEMORY_TYPES] = {};
+    VkDeviceSize heapFreeBytes[VK_MAX_MEMORY_HEAPS] = {};
+    
+    {
+        std::lock_guard<std::mutex> lock(allocator->mutex);
+        for(uint32_t i = 0; i < statistics->memoryTypeCount; i++){
+            Usage &usage = statistics->memoryTypes[i];
+            usage.allocationCount = allocator->typeUsage[i].allocationCount;
+            usage.usedBytes = allocator->typeUsage[i].usedBytes;
+            usage.requestedBytes = allocator->typeUsage[i].requestedBytes;
+            usage.peakUsedBytes = allocator->typeUsage[i].peakUsedBytes;
+        }
+        for(uint32_t i = 0; i < statistics->memoryHeapCount; i++){
+            Usage &usage = statistics->memoryHeaps[i];
+            usage.allocationCount = allocator->heapUsage[i].allocationCount;
+            usage.usedBytes = allocator->heapUsage[i].usedBytes;
+            usage.requestedBytes = allocator->heapUsage[i].requestedBytes;
+            usage.peakUsedBytes = allocator->heapUsage[i].peakUsedBytes;
+        }
+        
+        for(MemoryBlock* block : allocator->blocks){
+            uint32_t heapIndex = allocator->memoryProperties.memoryTypes[block->memoryTypeIndex].heapIndex;
+            VkDeviceSize freeBytes = 0;
+            VkDeviceSize largestFreeRange = 0;
+            for(uint32_t sizeClass = 0; sizeClass < block->freeLists.size(); sizeClass++){
+                if(!block->freeLists[sizeClass].empty()){
+                    freeBytes += block->freeLists[sizeClass].size() * sizeClassSize(sizeClass);
+                    largestFreeRange = sizeClassSize(sizeClass);
+                }
+            }
+            
+            for(Usage* usage : {&statistics->memoryTypes[block->memoryTypeIndex], &statistics->memoryHeaps[heapIndex]}){
+                usage->blockCount++;
+                usage->blockBytes += block->size;
+                usage->largestFreeRange = std::max(usage->largestFreeRange, largestFreeRange);
+            }
+            typeFreeBytes[block->memoryTypeIndex] += freeBytes;
+            heapFreeBytes[heapIndex] += freeBytes;
+        }
+    }
+    
+    for(uint32_t i = 0; i < statistics->memoryTypeCount; i++){
+        if(typeFreeBytes[i] > 0){
+            statistics->memoryTypes[i].fragmentation = 1.0f - static_cast<float>(statistics->memoryTypes[i].largestFreeRange) / typeFreeBytes[i];
+        }
+    }
+    for(uint32_t i = 0; i < statistics->memoryHeapCount; i++){
+        if(heapFreeBytes[i] > 0){
+            statistics->memoryHeaps[i].fragmentation = 1.0f - static_cast<float>(statistics->memoryHeaps[i].largestFreeRange) / heapFreeBytes[i];
+        }
+        statistics->heapSize[i] = allocator->memoryProperties.memoryHeaps[i].size;
+        statistics->heapBudget[i] = statistics->heapSize[i];
+        statistics->heapUsage[i] = statistics->memoryHeaps[i].blockBytes;
+    }
+    
+    //budgets change with what other processes use, so they are queried every time
+    if(allocator->getMemoryProperties2 != nullptr){
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2KHR memoryProperties = {};
+        memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        memoryProperties.pNext = &budgetProperties;
+        allocator->getMemoryProperties2(allocator->physicalDevice, &memoryProperties);
+        
+        statistics->budgetAvailable = true;
+        for(uint32_t i = 0; i < statistics->memoryHeapCount; i++){
+            statistics->heapBudget[i] = budgetProperties.heapBudget[i];
+            statistics->heapUsage[i] = budgetProperties.heapUsage[i];
+        }
+    }
+    return true;
+}
+
+void printUsage(const SME::Memory::Usage &usage){
+    printf("\t\t%u blocks of %.2f MB, %u allocations using %.2f MB (%.2f MB requested, peak %.2f MB)\n",
+            usage.blockCount, usage.blockBytes / (1024.0 * 1024.0), usage.allocationCount, usage.usedBytes / (1024.0 * 1024.0),
+            usage.requestedBytes / (1024.0 * 1024.0), usage.peakUsedBytes / (1024.0 * 1024.0));
+    printf("\t\tlargest free range %.2f MB, fragmentation %.1f%%\n", usage.largestFreeRange / (1024.0 * 1024.0), usage.fragmentation * 100.0f);
+}
+
+void SME::Memory::printStatistics(VkDevice device){
+    Statistics statistics;
+    if(!getStatistics(device, &statistics)){
+        printf("No memory allocated on this device\n");
+        return;
+    }
+    
+    DeviceAllocator* allocator = getAllocator(device, VK_NULL_HANDLE);
+    for(uint32_t heap = 0; heap < statistics.memoryHeapCount; heap++){
+        printf("Heap %u%s: %.2f MB used of a %.2f MB budget, %.2f MB in size\n", heap,
+                allocator->memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? " (device local)" : "",
+                statistics.heapUsage[heap] / (1024.0 * 1024.0), statistics.heapBudget[heap] / (1024.0 * 1024.0), statistics.heapSize[heap] / (1024.0 * 1024.0));
+        printUsage(statistics.memoryHeaps[heap]);
+        for(uint32_t type = 0; type < statistics.memoryTypeCount; type++){
+            if(allocator->memoryProperties.memoryTypes[type].heapIndex == heap && statistics.memoryTypes[type].blockCount > 0){
+                printf("\tType %u (flags 0x%x):\n", type, allocator->memoryProperties.memoryTypes[type].propertyFlags);
+                printUsage(statistics.memoryTypes[type]);
+            }
+        }
+    }
+}
+
+void SME::Memory::destroyAllocator(VkDevice device){
+    DeviceAllocator* allocator;
+    {
+        std::lock_guard<std::mutex> lock(allocatorsMutex);
+        std::map<VkDevice, DeviceAllocator*>::iterator it = allocators.find(device);
+        if(it == allocators.end()){
+            return;
+        }
+        allocator = it->second;
+        allocators.erase(it);
+    }
+
+    #ifdef DEBUG
+    uint32_t leakedAllocations = 0;
+    VkDeviceSize leakedBytes = 0;
+    for(uint32_t i = 0; i < allocator->memoryProperties.memoryHeapCount; i++){
+        leakedAllocations += allocator->heapUsage[i].allocationCount;
+        leakedBytes += allocator->heapUsage[i].requestedBytes;
+    }
+    if(leakedAllocations > 0){
+        fprintf(stderr, "%u allocations of %llu bytes in total were never released!\n", leakedAllocations, static_cast<unsigned long long>(leakedBytes));
+    }
+    #endif
+    
+    for(MemoryBlock* block : allocator->blocks){
+        vkFreeMemory(device, block->memory, nullptr);
+        delete block;
+    }
+    delete allocator;
+}
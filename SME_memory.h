@@ -0,0 +1,162 @@
+#ifndef SME_MEMORY_H
+#define SME_MEMORY_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+#ifndef SME_MEMORY_BLOCK_SIZE
+#define SME_MEMORY_BLOCK_SIZE (64 * 1024 * 1024) //device memory is requested from vulkan in blocks of 64MB
+#endif
+
+#ifndef SME_MEMORY_MIN_ALLOCATION
+#define SME_MEMORY_MIN_ALLOCATION 256 //smallest size class, sizes are rounded up to a power of two
+#endif
+
+namespace SME { namespace Memory {
+
+    struct MemoryBlock;
+
+    /**
+     * A range of device memory handed out by the allocator. Resources bind to
+     * memory at offset.
+     */
+    struct Allocation {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;          //size that was requested
+        void* mapped = nullptr;         //host address of offset, null unless host visible
+        uint32_t memoryTypeIndex = 0;
+        MemoryBlock* block = nullptr;   //block the range was taken from
+        uint32_t sizeClass = 0;
+    };
+    
+    /**
+     * Memory use of a memory type or heap. Sizes are in bytes.
+     */
+    struct Usage {
+        uint32_t blockCount;            //device memory allocations made from vulkan
+        uint32_t allocationCount;       //allocations handed out of the blocks
+        VkDeviceSize blockBytes;        //size of the blocks
+        VkDeviceSize usedBytes;         //taken by allocations, including the rounding to size classes
+        VkDeviceSize requestedBytes;    //requested by allocations
+        VkDeviceSize peakUsedBytes;     //highest usedBytes since the allocator was created
+        VkDeviceSize largestFreeRange;  //biggest allocation that fits without a new block
+        float fragmentation;            //0 if the free space is one range, close to 1 if it is scattered
+    };
+    
+    /**
+     * Memory use of a device, per memory type and per heap.
+     */
+    struct Statistics {
+        uint32_t memoryTypeCount;
+        Usage memoryTypes[VK_MAX_MEMORY_TYPES];
+        uint32_t memoryHeapCount;
+        Usage memoryHeaps[VK_MAX_MEMORY_HEAPS];
+        VkDeviceSize heapSize[VK_MAX_MEMORY_HEAPS];
+        bool budgetAvailable;                       //VK_EXT_memory_budget was used
+        VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS]; //what the process can use before it hurts, the heap size without the extension
+        VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];  //used by the whole process, including swap chain images, blockBytes without the extension
+    };
+    
+    /**
+     * Creates the allocator of a device ahead of its first allocation so the
+     * memory budget can be queried.
+     * <b>Do not call directly! This gets automatically called when appropriate
+     * by the render!</b>
+     * @param device the device whose memory will be allocated
+     * @param physicalDevice the physical representation of the device
+     * @param getMemoryProperties2 vkGetPhysicalDeviceMemoryProperties2KHR if
+     * VK_EXT_memory_budget is enabled on the device, null otherwise
+     */
+    void initAllocator(VkDevice device, VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2);
+
+    /**
+     * Sub-allocates memory for a resource. Memory is requested from Vulkan in
+     * blocks of SME_MEMORY_BLOCK_SIZE per memory type, which are split into
+     * power of two size classes (buddy allocation), so allocating and
+     * releasing usually don't call into the driver. The fullest block with
+     * room is used first. Allocations bigger than a
+     * block get dedicated memory. Linear and optimal tiling resources never
+     * share a block, so bufferImageGranularity is always respected. Host
+     * visible blocks stay mapped. Safe to call from multiple threads.
+     * @param device the device on which to allocate
+     * @param physicalDevice the physical representation of the device
+     * @param requirements the size, alignment and memory types the resource
+     * requires, as returned by vkGet*MemoryRequirements
+     * @param properties memory properties the memory type must have
+     * @param linear true for buffers and linear images, false for optimal
+     * tiling images
+     * @param allocation where to store the allocation
+     * @param preferredProperties additional properties of the memory type to
+     * use if there is one that has them
+     * @return true if the memory was allocated, false otherwise
+     */
+    bool allocate(VkDevice device, VkPhysicalDevice physicalDevice, const VkMemoryRequirements &requirements,
+            VkMemoryPropertyFlags properties, bool linear, Allocation* allocation, VkMemoryPropertyFlags preferredProperties = 0);
+
+    /**
+     * Allocates a new range for the contents of an allocation in a block of
+     * the same memory type that is used more than its current one, so moving
+     * the resource there lets sparse blocks empty out. Nothing is copied, and
+     * the old allocation must be released once the move is done.
+     * @param device the device the memory was allocated on
+     * @param allocation the allocation to move
+     * @param moved where to store the new allocation
+     * @return false if there is no better place for the allocation, or it
+     * has dedicated memory
+     */
+    bool relocate(VkDevice device, const Allocation &allocation, Allocation* moved);
+    
+    /**
+     * Gives the memory of an allocation back to its block. Resources bound to
+     * it must have been destroyed. The allocation is reset. Blocks left empty
+     * are freed, unless they are the last of their memory type.
+     * @param device the device the memory was allocated on
+     * @param allocation the allocation to release, ignored if empty
+     */
+    void release(VkDevice device, Allocation* allocation);
+
+    /**
+     * Makes host writes to a mapped allocation visible to the device. Does
+     * nothing for host coherent memory.
+     * @param device the device the memory was allocated on
+     * @param allocation the allocation written to
+     * @param offset offset of the written range within the allocation
+     * @param size size of the written range
+     * @return true on success, false otherwise
+     */
+    bool flush(VkDevice device, const Allocation &allocation, VkDeviceSize offset, VkDeviceSize size);
+
+    /**
+     * @param device the device the memory was allocated on
+     * @param allocation the allocation to check
+     * @return true if host writes to the allocation need no flush
+     */
+    bool isCoherent(VkDevice device, const Allocation &allocation);
+    
+    /**
+     * Collects how much memory the device uses. Walks every block, cheap
+     * enough to call every frame but not every allocation.
+     * @param device the device to query
+     * @param statistics where to store the statistics
+     * @return false if nothing was allocated on the device yet
+     */
+    bool getStatistics(VkDevice device, Statistics* statistics);
+    
+    /**
+     * Prints the statistics of every heap and used memory type to stdout.
+     * @param device the device to query
+     */
+    void printStatistics(VkDevice device);
+
+    /**
+     * Frees every block allocated on the device. Called by the render before
+     * the device is destroyed, allocations still held become invalid. In
+     * debug builds, allocations that were never released are reported.
+     * @param device the device whose memory is freed
+     */
+    void destroyAllocator(VkDevice device);
+}}
+
+#endif /* SME_MEMORY_H */
+
@@ -0,0 +1,379 @@
+#include "SME_mesh.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+namespace {
+    //FNV-1a
+    uint32_t hashVertex(const char* vertex, uint32_t size){
+        uint32_t hash = 2166136261u;
+        for(uint32_t i = 0; i < size; i++){
+            hash = (hash ^ static_cast<unsigned char>(vertex[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    //Forsyth's scoring, vertices used by the last triangle score a bit less so
+    //the strip doesn't double back on itself
+    float vertexScore(int cachePosition, uint32_t remainingTriangles){
+        if(remainingTriangles == 0){
+            return -1.0f;
+        }
+        float score = 0.0f;
+        if(cachePosition >= 0){
+            if(cachePosition < 3){
+                score = 0.75f;
+            } else {
+                score = powf(1.0f - static_cast<float>(cachePosition - 3) / (SME_MESH_OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+            }
+        }
+        //vertices with few triangles left get finished off before they are evicted
+        return score + 2.0f / sqrtf(static_cast<float>(remainingTriangles));
+    }
+    
+    //a cluster of triangles drawn together by optimizeOverdraw
+    struct Cluster {
+        size_t firstTriangle;
+        size_t triangleCount;
+        float sortKey;
+    };
+    
+    //LRU post transform cache of SME_MESH_OPTIMIZE_CACHE_SIZE entries, the
+    //one optimizeVertexCache orders triangles for
+    struct LruCache {
+        uint32_t entries[SME_MESH_OPTIMIZE_CACHE_SIZE];
+        uint32_t size = 0;
+        
+        //@return true if the vertex had to be transformed
+        bool access(uint32_t vertex){
+            uint32_t position = 0;
+            while(position < size && entries[position] != vertex){
+                position++;
+            }
+            bool miss = position == size;
+            if(miss){
+                position = size < SME_MESH_OPTIMIZE_CACHE_SIZE ? size++ : size - 1;
+            }
+            //most recently used first
+            for(; position > 0; position--){
+                entries[position] = entries[position - 1];
+            }
+            entries[0] = vertex;
+            return miss;
+        }
+    };
+
+    //smallest power of two that keeps the table at most half full
+    uint32_t tableSize(uint32_t vertexCount){
+        uint32_t size = 16;
+        while(size < vertexCount * 2){
+            size *= 2;
+        }
+        return size;
+    }
+}
+
+SME::Mesh::VertexWelder::VertexWelder(uint32_t vertexSize, uint32_t expectedVertexCount) : vertexSize(vertexSize) {
+    table.assign(tableSize(expectedVertexCount), UINT32_MAX);
+    mask = static_cast<uint32_t>(table.size() - 1);
+    vertices.reserve(static_cast<size_t>(expectedVertexCount) * vertexSize);
+}
+
+uint32_t SME::Mesh::VertexWelder::add(const void* vertex){
+    const char* data = static_cast<const char*>(vertex);
+    for(uint32_t slot = hashVertex(data, vertexSize) & mask; ; slot = (slot + 1) & mask){
+        uint32_t index = table[slot];
+        if(index == UINT32_MAX){
+            table[slot] = vertexCount;
+            vertices.insert(vertices.end(), data, data + vertexSize);
+            vertexCount++;
+            if(vertexCount * 2 > table.size()){
+                grow();
+            }
+            return vertexCount - 1;
+        }
+        if(memcmp(&vertices[static_cast<size_t>(index) * vertexSize], data, vertexSize) == 0){
+            return index;
+        }
+    }
+}
+
+void SME::Mesh::VertexWelder::grow(){
+    table.assign(table.size() * 2, UINT32_MAX);
+    mask = static_cast<uint32_t>(table.size() - 1);
+    for(uint32_t index = 0; index < vertexCount; index++){
+        uint32_t slot = hashVertex(&vertices[static_cast<size_t>(index) * vertexSize], vertexSize) & mask;
+        while(table[slot] != UINT32_MAX){
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = index;
+    }
+}
+
+const std::vector<char> &SME::Mesh::VertexWelder::getVertices(){
+    return vertices;
+}
+
+std::vector<char> SME::Mesh::VertexWelder::releaseVertices(){
+    //the table is as big as the vertices, free it along with them
+    std::vector<uint32_t>().swap(table);
+    vertexCount = 0;
+    return std::move(vertices);
+}
+
+uint32_t SME::Mesh::VertexWelder::getVertexCount(){
+    return vertexCount;
+}
+
+SME::Mesh::VertexCacheStatistics SME::Mesh::analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount){
+    //a vertex is still cached if fewer than SME_MESH_CACHE_SIZE misses happened since it was loaded
+    std::vector<uint32_t> loadedAt(vertexCount, 0);
+    uint32_t time = SME_MESH_CACHE_SIZE + 1;
+    uint32_t misses = 0;
+    for(size_t i = 0; i < indexCount; i++){
+        uint32_t vertex = indices[i];
+        if(time - loadedAt[vertex] > SME_MESH_CACHE_SIZE){
+            loadedAt[vertex] = time++;
+            misses++;
+        }
+    }
+    
+    VertexCacheStatistics statistics = {misses, 0.0f, 0.0f};
+    if(indexCount >= 3){
+        statistics.acmr = static_cast<float>(misses) / (indexCount / 3);
+    }
+    if(vertexCount > 0){
+        statistics.atvr = static_cast<float>(misses) / vertexCount;
+    }
+    return statistics;
+}
+
+void SME::Mesh::optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount){
+    size_t triangleCount = indexCount / 3;
+    if(triangleCount == 0){
+        return;
+    }
+    
+    //triangles of every vertex, the ones not drawn yet are kept at the front
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for(size_t i = 0; i < triangleCount * 3; i++){
+        remaining[indices[i]]++;
+    }
+    std::vector<size_t> firstAdjacent(vertexCount + 1, 0);
+    for(uint32_t vertex = 0; vertex < vertexCount; vertex++){
+        firstAdjacent[vertex + 1] = firstAdjacent[vertex] + remaining[vertex];
+    }
+    std::vector<uint32_t> adjacent(triangleCount * 3);
+    std::vector<size_t> filled(firstAdjacent.begin(), firstAdjacent.end() - 1);
+    for(size_t i = 0; i < triangleCount * 3; i++){
+        adjacent[filled[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+    
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for(uint32_t vertex = 0; vertex < vertexCount; vertex++){
+        scores[vertex] = vertexScore(-1, remaining[vertex]);
+    }
+    
+    std::vector<float> triangleScores(triangleCount);
+    size_t best = 0;
+    for(size_t triangle = 0; triangle < triangleCount; triangle++){
+        const uint32_t* corners = &indices[triangle * 3];
+        triangleScores[triangle] = scores[corners[0]] + scores[corners[1]] + scores[corners[2]];
+        if(triangleScores[triangle] > triangleScores[best]){
+            best = triangle;
+        }
+    }
+    
+    std::vector<char> drawn(triangleCount, false);
+    std::vector<uint32_t> output(triangleCount * 3);
+    uint32_t cache[SME_MESH_OPTIMIZE_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    size_t nextUndrawn = 0;
+    
+    for(size_t outputTriangle = 0; outputTriangle < triangleCount; outputTriangle++){
+        if(best == SIZE_MAX){
+            //nothing left around the cached vertices, carry on in input order
+            while(drawn[nextUndrawn]){
+                nextUndrawn++;
+            }
+            best = nextUndrawn;
+        }
+        
+        const uint32_t* corners = &indices[best * 3];
+        std::copy(corners, corners + 3, &output[outputTriangle * 3]);
+        drawn[best] = true;
+        
+        for(int corner = 0; corner < 3; corner++){
+            uint32_t vertex = corners[corner];
+            uint32_t* list = &adjacent[firstAdjacent[vertex]];
+            uint32_t* last = list + remaining[vertex] - 1;
+            std::iter_swap(std::find(list, last, static_cast<uint32_t>(best)), last);
+            remaining[vertex]--;
+        }
+        
+        //the triangle's vertices move to the front, the rest shifts back
+        uint32_t newCache[SME_MESH_OPTIMIZE_CACHE_SIZE + 3];
+        uint32_t newCacheCount = 0;
+        for(int corner = 0; corner < 3; corner++){
+            if(std::find(newCache, newCache + newCacheCount, corners[corner]) == newCache + newCacheCount){
+                newCache[newCacheCount++] = corners[corner];
+            }
+        }
+        for(uint32_t i = 0; i < cacheCount; i++){
+            if(std::find(newCache, newCache + newCacheCount, cache[i]) == newCache + newCacheCount){
+                newCache[newCacheCount++] = cache[i];
+            }
+        }
+        
+        for(uint32_t i = 0; i < newCacheCount; i++){
+            uint32_t vertex = newCache[i];
+            cachePosition[vertex] = i < SME_MESH_OPTIMIZE_CACHE_SIZE ? static_cast<int>(i) : -1;
+            scores[vertex] = vertexScore(cachePosition[vertex], remaining[vertex]);
+        }
+        
+        //only triangles around the touched vertices changed score
+        best = SIZE_MAX;
+        float bestScore = -1.0f;
+        for(uint32_t i = 0; i < newCacheCount; i++){
+            uint32_t vertex = newCache[i];
+            for(size_t j = firstAdjacent[vertex]; j < firstAdjacent[vertex] + remaining[vertex]; j++){
+                uint32_t triangle = adjacent[j];
+                const uint32_t* triangleCorners = &indices[static_cast<size_t>(triangle) * 3];
+                triangleScores[triangle] = scores[triangleCorners[0]] + scores[triangleCorners[1]] + scores[triangleCorners[2]];
+                if(triangleScores[triangle] > bestScore){
+                    bestScore = triangleScores[triangle];
+                    best = triangle;
+                }
+            }
+        }
+        
+        cacheCount = std::min(newCacheCount, static_cast<uint32_t>(SME_MESH_OPTIMIZE_CACHE_SIZE));
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+    
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void SME::Mesh::optimizeOverdraw(uint32_t* indices, size_t indexCount, const void* positions, uint32_t positionStride, float threshold){
+    size_t triangleCount = indexCount / 3;
+    if(triangleCount == 0){
+        return;
+    }
+    
+    LruCache cache;
+    uint32_t misses = 0;
+    for(size_t i = 0; i < triangleCount * 3; i++){
+        misses += cache.access(indices[i]);
+    }
+    float maxAcmr = static_cast<float>(misses) / triangleCount * threshold;
+    
+    //clusters are measured starting from an empty cache, so they can be drawn
+    //in any order without a worse ACMR. A cluster ends as soon as it makes up
+    //for the misses of its cold start, so clusters stay small where the
+    //order allows and reordering them has some effect
+    std::vector<Cluster> clusters;
+    uint32_t clusterMisses = 0;
+    for(size_t triangle = 0; triangle < triangleCount; triangle++){
+        if(clusters.empty() || static_cast<float>(clusterMisses) <= maxAcmr * clusters.back().triangleCount){
+            clusters.push_back({triangle, 0, 0.0f});
+            cache.size = 0;
+            clusterMisses = 0;
+        }
+        for(int corner = 0; corner < 3; corner++){
+            clusterMisses += cache.access(indices[triangle * 3 + corner]);
+        }
+        clusters.back().triangleCount++;
+    }
+    
+    //area weighted centroid and normal of every cluster
+    std::vector<float> clusterData(clusters.size() * 7, 0.0f); //centroid xyz, normal xyz, area
+    float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+    float meshArea = 0.0f;
+    for(size_t i = 0; i < clusters.size(); i++){
+        float* data = &clusterData[i * 7];
+        for(size_t triangle = clusters[i].firstTriangle; triangle < clusters[i].firstTriangle + clusters[i].triangleCount; triangle++){
+            const float* p[3];
+            for(int corner = 0; corner < 3; corner++){
+                p[corner] = reinterpret_cast<const float*>(static_cast<const char*>(positions) + static_cast<size_t>(indices[triangle * 3 + corner]) * positionStride);
+            }
+            float u[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+            float v[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+            float normal[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+            float area = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            for(int axis = 0; axis < 3; axis++){
+                data[axis] += (p[0][axis] + p[1][axis] + p[2][axis]) / 3.0f * area;
+                data[3 + axis] += normal[axis];
+            }
+            data[6] += area;
+        }
+        for(int axis = 0; axis < 3; axis++){
+            meshCentroid[axis] += data[axis];
+        }
+        meshArea += data[6];
+    }
+    if(meshArea > 0.0f){
+        for(int axis = 0; axis < 3; axis++){
+            meshCentroid[axis] /= meshArea;
+        }
+    }
+    
+    //clusters facing away from the centre are likely in front of the others
+    for(size_t i = 0; i < clusters.size(); i++){
+        const float* data = &clusterData[i * 7];
+        float normalLength = sqrtf(data[3] * data[3] + data[4] * data[4] + data[5] * data[5]);
+        if(data[6] <= 0.0f || normalLength <= 0.0f){
+            continue;
+        }
+        float key = 0.0f;
+        for(int axis = 0; axis < 3; axis++){
+            key += (data[axis] / data[6] - meshCentroid[axis]) * data[3 + axis] / normalLength;
+        }
+        clusters[i].sortKey = key;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b){
+        return a.sortKey > b.sortKey;
+    });
+    
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+    for(const Cluster &cluster : clusters){
+        output.insert(output.end(), indices + cluster.firstTriangle * 3, indices + (cluster.firstTriangle + cluster.triangleCount) * 3);
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+uint32_t SME::Mesh::optimizeVertexFetch(void* vertices, uint32_t vertexCount, uint32_t vertexSize, uint32_t* indices, size_t indexCount){
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    uint32_t next = 0;
+    for(size_t i = 0; i < indexCount; i++){
+        uint32_t &mapped = remap[indices[i]];
+        if(mapped == UINT32_MAX){
+            mapped = next++;
+        }
+        indices[i] = mapped;
+    }
+    
+    //unused vertices go after the used ones, so remap is a permutation
+    uint32_t usedCount = next;
+    for(uint32_t &mapped : remap){
+        if(mapped == UINT32_MAX){
+            mapped = next++;
+        }
+    }
+    
+    //every swap puts a vertex in its place, following the permutation's cycles
+    char* data = static_cast<char*>(vertices);
+    std::vector<char> swapped(vertexSize);
+    for(uint32_t i = 0; i < vertexCount; i++){
+        while(remap[i] != i){
+            uint32_t target = remap[i];
+            memcpy(&swapped[0], data + static_cast<size_t>(target) * vertexSize, vertexSize);
+            memcpy(data + static_cast<size_t>(target) * vertexSize, data + static_cast<size_t>(i) * vertexSize, vertexSize);
+            memcpy(data + static_cast<size_t>(i) * vertexSize, &swapped[0], vertexSize);
+            std::swap(remap[i], remap[target]);
+        }
+    }
+    return usedCount;
+}
@@ -0,0 +1,135 @@
+#ifndef SME_MESH_H
+#define SME_MESH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#ifndef SME_MESH_CACHE_SIZE
+#define SME_MESH_CACHE_SIZE 16 //entries of the FIFO post transform cache the statistics simulate
+#endif
+
+#ifndef SME_MESH_OPTIMIZE_CACHE_SIZE
+#define SME_MESH_OPTIMIZE_CACHE_SIZE 32 //entries of the LRU cache the triangle order is optimised for
+#endif
+
+#ifndef SME_MESH_OVERDRAW_THRESHOLD
+#define SME_MESH_OVERDRAW_THRESHOLD 1.05f //ACMR growth optimizeOverdraw may trade for less overdraw
+#endif
+
+namespace SME { namespace Mesh {
+
+    /**
+     * How well an index buffer uses the post transform vertex cache.
+     */
+    struct VertexCacheStatistics {
+        uint32_t transformedVertices;   //cache misses, each runs the vertex shader
+        float acmr;                     //average cache miss ratio, transformed vertices per triangle, 3 at worst
+        float atvr;                     //average transformed vertex ratio, transformed vertices per vertex, 1 at best
+    };
+
+    /**
+     * Merges identical vertices as they are added, so shared corners are
+     * stored and shaded once and referenced through indices. Vertices are
+     * compared bytewise and looked up in an open addressing hash table, so
+     * adding a vertex is a hash and usually a single comparison.
+     */
+    class VertexWelder {
+    public:
+        /**
+         * @param vertexSize size of a vertex in bytes
+         * @param expectedVertexCount amount of unique vertices expected, used
+         * to size the table and the vertex storage so they rarely grow
+         */
+        VertexWelder(uint32_t vertexSize, uint32_t expectedVertexCount);
+
+        /**
+         * Adds a vertex, unless an identical one was added before.
+         * @param vertex the vertex, vertexSize bytes
+         * @return the index of the vertex among the unique ones
+         */
+        uint32_t add(const void* vertex);
+
+        /**
+         * @return the unique vertices, in the order they were first added
+         */
+        const std::vector<char> &getVertices();
+
+        /**
+         * Takes the unique vertices out without copying them, and frees the
+         * hash table. The welder can't be used afterwards.
+         * @return the unique vertices, in the order they were first added
+         */
+        std::vector<char> releaseVertices();
+
+        /**
+         * @return the amount of unique vertices
+         */
+        uint32_t getVertexCount();
+    private:
+        void grow();
+
+        uint32_t vertexSize;
+        uint32_t vertexCount = 0;
+        std::vector<char> vertices;
+        std::vector<uint32_t> table; //index of a vertex per slot, UINT32_MAX if free
+        uint32_t mask;               //table size minus one, a power of two
+    };
+    
+    /**
+     * Simulates a FIFO post transform cache of SME_MESH_CACHE_SIZE entries
+     * over an indexed triangle list.
+     * @param indices the index buffer, three indices per triangle
+     * @param indexCount amount of indices
+     * @param vertexCount amount of vertices the indices refer to
+     * @return the statistics of the triangle order
+     */
+    VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+    
+    /**
+     * Reorders the triangles of an indexed triangle list so vertices are
+     * reused while they are still in the post transform cache, with Tom
+     * Forsyth's linear speed algorithm: triangles are picked greedily by the
+     * score of their vertices, which favours recently used vertices and
+     * vertices with few triangles left.
+     * @param indices the index buffer, reordered in place
+     * @param indexCount amount of indices, a multiple of three
+     * @param vertexCount amount of vertices the indices refer to
+     */
+    void optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+    
+    /**
+     * Reorders a cache optimised triangle list so triangles facing outwards
+     * are drawn first, which lets the depth test reject more of the
+     * triangles behind them, after Sander et al.'s Tipsy. The list is split
+     * into clusters whose ACMR, on the cache optimizeVertexCache orders for
+     * and starting out empty, is at most threshold times the ACMR of the
+     * whole list, so the clusters can be drawn in any order for about that
+     * cost.
+     * The clusters are then sorted by how far out they face.
+     * @param indices the index buffer, reordered in place
+     * @param indexCount amount of indices, a multiple of three
+     * @param positions the first vertex position, three floats
+     * @param positionStride bytes from one vertex position to the next
+     * @param threshold how much the ACMR may grow, like
+     * SME_MESH_OVERDRAW_THRESHOLD. Higher values make smaller clusters and
+     * less overdraw
+     */
+    void optimizeOverdraw(uint32_t* indices, size_t indexCount, const void* positions, uint32_t positionStride, float threshold);
+    
+    /**
+     * Reorders the vertices in the order the triangles first use them, so
+     * vertex fetches walk through memory linearly. The vertices are swapped
+     * in place, vertices no triangle uses end up at the end.
+     * @param vertices the vertices, vertexSize bytes each, reordered in place
+     * @param vertexCount amount of vertices
+     * @param vertexSize size of a vertex in bytes
+     * @param indices the index buffer, remapped in place
+     * @param indexCount amount of indices
+     * @return the amount of vertices the triangles use, the ones to keep
+     */
+    uint32_t optimizeVertexFetch(void* vertices, uint32_t vertexCount, uint32_t vertexSize, uint32_t* indices, size_t indexCount);
+}}
+
+#endif /* SME_MESH_H */
+
@@ -0,0 +1,203 @@
+#include "SME_meshcache.h"
+#include "SME_VkUtil.h"
+
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SME_MESH_CACHE_HASH_CHUNK 65536 //bytes of the source read at a time while hashing
+
+//the header is read in place, its layout must not depend on the compiler
+static_assert(sizeof(SME::MeshCache::Header) == 104, "Mesh cache header is not packed");
+
+namespace {
+    uint64_t align(uint64_t offset){
+        return (offset + SME_MESH_CACHE_ALIGNMENT - 1) & ~static_cast<uint64_t>(SME_MESH_CACHE_ALIGNMENT - 1);
+    }
+
+    uint64_t indexSize(uint32_t indexType){
+        return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    //an aligned section of count elements that lies within the file
+    bool checkSection(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize){
+        return offset % SME_MESH_CACHE_ALIGNMENT == 0 && offset <= fileSize && count * elementSize <= fileSize - offset;
+    }
+
+    bool writeSection(std::ofstream &file, uint64_t offset, const void* data, uint64_t size){
+        static const char padding[SME_MESH_CACHE_ALIGNMENT] = {};
+        uint64_t position = static_cast<uint64_t>(file.tellp());
+        return file.write(padding, offset - position) && file.write(static_cast<const char*>(data), size);
+    }
+
+    //the largest index, so damaged indices never reach the gpu, which may
+    //not check its reads
+    template<typename Index>
+    Index maxIndex(const char* indices, uint64_t count){
+        Index max = 0;
+        for(uint64_t i = 0; i < count; i++){
+            Index index;
+            memcpy(&index, indices + i * sizeof(Index), sizeof(Index));
+            max = std::max(max, index);
+        }
+        return max;
+    }
+}
+
+bool SME::MeshCache::hashFile(const char* path, uint64_t* hash){
+    std::ifstream file(path, std::ios::in|std::ios::binary);
+    if(!file.is_open()){
+        return false;
+    }
+
+    uint64_t value = 14695981039346656037ull;
+    std::vector<char> chunk(SME_MESH_CACHE_HASH_CHUNK);
+    while(file){
+        file.read(&chunk[0], chunk.size());
+        std::streamsize read = file.gcount();
+        for(std::streamsize i = 0; i < read; i++){
+            value = (value ^ static_cast<unsigned char>(chunk[i])) * 1099511628211ull;
+        }
+    }
+    if(!file.eof()){
+        return false;
+    }
+    *hash = value;
+    return true;
+}
+
+bool SME::MeshCache::write(const char* path, Header header, const Attribute* attributes, const Lod* lods, const void* vertices, const void* indices){
+    uint64_t attributeSize = static_cast<uint64_t>(header.attributeCount) * sizeof(Attribute);
+    uint64_t lodSize = static_cast<uint64_t>(header.lodCount) * sizeof(Lod);
+    uint64_t vertexSize = static_cast<uint64_t>(header.vertexCount) * header.vertexStride;
+    uint64_t indexDataSize = header.indexCount * indexSize(header.indexType);
+
+    header.magic = SME_MESH_CACHE_MAGIC;
+    header.version = SME_MESH_CACHE_VERSION;
+    header.attributeOffset = align(sizeof(Header));
+    header.lodOffset = align(header.attributeOffset + attributeSize);
+    header.vertexOffset = align(header.lodOffset + lodSize);
+    header.indexOffset = align(header.vertexOffset + vertexSize);
+    header.fileSize = header.indexOffset + indexDataSize;
+
+    //written aside and renamed, a crash or a concurrent load never sees half a cache
+    bool written = SME::VkUtil::replaceFile(path, [&](std::ofstream &file){
+        return file.write(reinterpret_cast<const char*>(&header), sizeof(header)) &&
+                writeSection(file, header.attributeOffset, attributes, attributeSize) &&
+                writeSection(file, header.lodOffset, lods, lodSize) &&
+                writeSection(file, header.vertexOffset, vertices, vertexSize) &&
+                writeSection(file, header.indexOffset, indices, indexDataSize);
+    });
+    if(!written){
+        fprintf(stderr, "Couldn't write mesh cache to %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+SME::MeshCache::File::~File(){
+    close();
+}
+
+bool SME::MeshCache::File::open(const char* path){
+    close();
+
+    #if defined(_WIN32)
+    std::ifstream stream(path, std::ios::in|std::ios::binary|std::ios::ate);
+    if(!stream.is_open()){
+        return false;
+    }
+    size = static_cast<size_t>(stream.tellg());
+    buffer.reset(new uint64_t[(size + 7) / 8]);
+    stream.seekg(0, std::ios::beg);
+    if(!stream.read(reinterpret_cast<char*>(buffer.get()), size)){
+        buffer.reset();
+        return false;
+    }
+    data = reinterpret_cast<const char*>(buffer.get());
+    #else
+    int descriptor = ::open(path, O_RDONLY);
+    if(descriptor == -1){
+        return false;
+    }
+    struct stat fileStat;
+    if(fstat(descriptor, &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) < sizeof(Header)){
+        ::close(descriptor);
+        return false;
+    }
+    //pages are aligned, so the sections can be used in place
+    void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if(mapping == MAP_FAILED){
+        return false;
+    }
+    data = static_cast<const char*>(mapping);
+    size = fileStat.st_size;
+    #endif
+
+    const Header &header = getHeader();
+    bool valid = size >= sizeof(Header) && header.magic == SME_MESH_CACHE_MAGIC && header.version == SME_MESH_CACHE_VERSION &&
+            header.fileSize == size && (header.indexType == VK_INDEX_TYPE_UINT16 || header.indexType == VK_INDEX_TYPE_UINT32) &&
+            checkSection(header.attributeOffset, header.attributeCount, sizeof(Attribute), size) &&
+            checkSection(header.lodOffset, header.lodCount, sizeof(Lod), size) &&
+            checkSection(header.vertexOffset, header.vertexCount, header.vertexStride, size) &&
+            checkSection(header.indexOffset, header.indexCount, indexSize(header.indexType), size);
+    for(uint32_t i = 0; valid && i < header.lodCount; i++){
+        const Lod &lod = getLods()[i];
+        valid = static_cast<uint64_t>(lod.firstIndex) + lod.indexCount <= header.indexCount;
+    }
+    if(valid && header.indexCount > 0){
+        const char* indices = static_cast<const char*>(getIndices());
+        uint64_t max = header.indexType == VK_INDEX_TYPE_UINT16 ? maxIndex<uint16_t>(indices, header.indexCount) : maxIndex<uint32_t>(indices, header.indexCount);
+        valid = max < header.vertexCount;
+    }
+    if(!valid){
+        #ifdef DEBUG
+        fprintf(stdout, "Mesh cache %s is damaged or of another version, ignoring it\n", path);
+        #endif
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SME::MeshCache::File::close(){
+    #if defined(_WIN32)
+    buffer.reset();
+    #else
+    if(data != nullptr){
+        munmap(const_cast<char*>(data), size);
+    }
+    #endif
+    data = nullptr;
+    size = 0;
+}
+
+const SME::MeshCache::Header &SME::MeshCache::File::getHeader() const{
+    return *reinterpret_cast<const Header*>(data);
+}
+
+const SME::MeshCache::Attribute* SME::MeshCache::File::getAttributes() const{
+    return reinterpret_cast<const Attribute*>(data + getHeader().attributeOffset);
+}
+
+const SME::MeshCache::Lod* SME::MeshCache::File::getLods() const{
+    return reinterpret_cast<const Lod*>(data + getHeader().lodOffset);
+}
+
+const void* SME::MeshCache::File::getVertices() const{
+    return data + getHeader().vertexOffset;
+}
+
+const void* SME::MeshCache::File::getIndices() const{
+    return data + getHeader().indexOffset;
+}
@@ -0,0 +1,146 @@
+#ifndef SME_MESHCACHE_H
+#define SME_MESHCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+#define SME_MESH_CACHE_MAGIC 0x4D454D53 //"SMEM"
+#define SME_MESH_CACHE_VERSION 1        //bumped whenever the layout of the file changes
+#define SME_MESH_CACHE_ALIGNMENT 16     //alignment of every section within the file
+
+namespace SME { namespace MeshCache {
+
+    /*
+     * A mesh cache file is a Header followed by the attribute table, the LOD
+     * table, the vertex blob and the index blob, each starting on a multiple
+     * of SME_MESH_CACHE_ALIGNMENT. The blobs are stored in the format they
+     * are drawn in, so loading is a copy into staging memory without
+     * touching a single element. Everything is little endian.
+     */
+
+    /**
+     * An attribute of the interleaved vertices, as in
+     * VkVertexInputAttributeDescription.
+     */
+    struct Attribute {
+        uint32_t location;
+        uint32_t format;    //VkFormat
+        uint32_t offset;    //within a vertex
+        uint32_t reserved;
+    };
+
+    /**
+     * A level of detail, a range of the index blob. LOD 0 is the full mesh.
+     */
+    struct Lod {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        float error;        //simplification error, 0 for the full mesh
+        uint32_t reserved;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceHash;        //of the contents of the source asset, see hashFile
+        uint64_t fileSize;
+        uint32_t vertexCount;
+        uint32_t vertexStride;
+        uint32_t indexCount;
+        uint32_t indexType;         //VkIndexType
+        uint32_t attributeCount;
+        uint32_t lodCount;
+        float boundsMin[3];         //axis aligned bounds of the positions
+        float boundsMax[3];
+        uint64_t attributeOffset;   //offsets of the sections from the start of the file
+        uint64_t lodOffset;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+    };
+
+    /**
+     * Hashes the contents of a file with 64 bit FNV-1a, to tell whether a
+     * cache was built from the current version of its source.
+     * @param path path of the file
+     * @param hash where to store the hash
+     * @return true if the file could be read, false otherwise
+     */
+    bool hashFile(const char* path, uint64_t* hash);
+
+    /**
+     * Writes a cache file. An existing file is only replaced once the new
+     * one is complete, see SME::VkUtil::replaceFile.
+     * @param path path of the cache file
+     * @param header the description of the mesh, magic, version, fileSize
+     * and the section offsets are filled in
+     * @param attributes header.attributeCount attributes
+     * @param lods header.lodCount LODs
+     * @param vertices header.vertexCount vertices, header.vertexStride bytes
+     * each
+     * @param indices header.indexCount indices of header.indexType
+     * @return true if the file was written, false otherwise
+     */
+    bool write(const char* path, Header header, const Attribute* attributes, const Lod* lods, const void* vertices, const void* indices);
+
+    /**
+     * Read only view of a cache file, memory mapped where available. The
+     * file is checked for consistency when it is opened, so the sections
+     * can be used as they are, even by a GPU without robust buffer access.
+     */
+    class File {
+    public:
+        File() = default;
+        File(const File&) = delete;
+        File &operator=(const File&) = delete;
+        ~File();
+
+        /**
+         * Maps a cache file and checks that it is complete, of the current
+         * version, that every section lies within it and that every index
+         * refers to a vertex. Anything opened before is closed.
+         * @param path path of the cache file
+         * @return true if the file is a usable cache, false otherwise
+         */
+        bool open(const char* path);
+
+        /**
+         * Unmaps the file.
+         */
+        void close();
+
+        /**
+         * @return the header of the open file
+         */
+        const Header &getHeader() const;
+
+        /**
+         * @return the header.attributeCount attributes of the open file
+         */
+        const Attribute* getAttributes() const;
+
+        /**
+         * @return the header.lodCount LODs of the open file
+         */
+        const Lod* getLods() const;
+
+        /**
+         * @return the vertex blob of the open file
+         */
+        const void* getVertices() const;
+
+        /**
+         * @return the index blob of the open file
+         */
+        const void* getIndices() const;
+    private:
+        const char* data = nullptr;
+        size_t size = 0;
+        #if defined(_WIN32)
+        std::unique_ptr<uint64_t[]> buffer;
+        #endif
+    };
+}}
+
+#endif /* SME_MESHCACHE_H */
+
@@ -1,46 +1,375 @@
 #include "SME_model.h"
 #include "SME_render.h"
 #include "SME_VkUtil.h"
+#include "SME_collada.h"
+#include "SME_mesh.h"
+#include "SME_meshcache.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <array>
+#include <vector>
+
+namespace {
+    //16 bit indices halve the index bandwidth whenever they can address every vertex
+    VkIndexType chooseIndexType(uint32_t vertexCount){
+        return vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    }
+    
+    void computeBounds(const SME::Collada::Vertex* vertices, uint32_t vertexCount, float* min, float* max){
+        for(int i = 0; i < 3; i++){
+            min[i] = vertexCount > 0 ? INFINITY : 0.0f;
+            max[i] = vertexCount > 0 ? -INFINITY : 0.0f;
+        }
+        for(uint32_t i = 0; i < vertexCount; i++){
+            for(int j = 0; j < 3; j++){
+                min[j] = std::min(min[j], vertices[i].position[j]);
+                max[j] = std::max(max[j], vertices[i].position[j]);
+            }
+        }
+    }
+    
+    const uint32_t colladaOffsets[] = {offsetof(SME::Collada::Vertex, position), offsetof(SME::Collada::Vertex, color)};
+    
+    //converts Collada vertices to the vertex layout within their own memory.
+    //Converted vertices are smaller, so writing out a block only overwrites
+    //source vertices of it or of earlier blocks
+    static_assert(SME::Model::VertexLayout::stride <= sizeof(SME::Collada::Vertex), "Vertices can't be converted in place");
+    void convertInPlace(char* vertices, uint32_t vertexCount){
+        char block[SME_MODEL_CONVERT_VERTICES * SME::Model::VertexLayout::stride];
+        for(uint32_t converted = 0; converted < vertexCount; converted += SME_MODEL_CONVERT_VERTICES){
+            uint32_t count = std::min(vertexCount - converted, static_cast<uint32_t>(SME_MODEL_CONVERT_VERTICES));
+            SME::Model::VertexLayout::convert(vertices + static_cast<size_t>(converted) * sizeof(SME::Collada::Vertex), sizeof(SME::Collada::Vertex),
+                    colladaOffsets, block, count);
+            memcpy(vertices + static_cast<size_t>(converted) * SME::Model::VertexLayout::stride, block, count * SME::Model::VertexLayout::stride);
+        }
+    }
+    
+    //narrows 32 bit indices to 16 bits within their own memory, index i is
+    //read before any write reaches its bytes
+    void narrowInPlace(uint32_t* indices, size_t indexCount){
+        char* narrowed = reinterpret_cast<char*>(indices);
+        for(size_t i = 0; i < indexCount; i++){
+            uint16_t index = static_cast<uint16_t>(indices[i]);
+            memcpy(narrowed + i * sizeof(uint16_t), &index, sizeof(index));
+        }
+    }
+}
 
 bool SME::Model::loadModel(){
-    float vertexData[] = {
-        -0.7f, -0.7f, 0.0f, 1.0f,    //xyzw vertex 1
-        1.0f, 0.0f, 0.0f, 1.0f,      //rgba vertex 1
-        -0.7f, 0.7f, 0.0f, 1.0f,     //xyzw vertex 2
-        0.0f, 1.0f, 0.0f, 1.0f,      //rgba vertex 2
-        0.7f, -0.7f, 0.0f, 1.0f,     //xyzw vertex 3
-        0.0f, 0.0f, 1.0f, 1.0f,      //rgba vertex 3
-        0.7f, 0.7f, 0.0f, 1.0f,      //xyzw vertex 4
-        0.3f, 0.3f, 0.3f, 1.0f       //rgba vertex 4
+    SME::Collada::Vertex vertexData[] = {
+        {{-0.7f, -0.7f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f, 1.0f}},    //xyzw, rgba vertex 1
+        {{-0.7f, 0.7f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}},     //xyzw, rgba vertex 2
+        {{0.7f, -0.7f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f, 1.0f}},     //xyzw, rgba vertex 3
+        {{0.7f, 0.7f, 0.0f, 1.0f}, {0.3f, 0.3f, 0.3f, 1.0f}}       //xyzw, rgba vertex 4
     };
+    //two triangles with the winding of a strip, every model is a triangle list
+    uint32_t indexData[] = {0, 1, 2, 2, 1, 3};
+    
+    loadedVertexCount = 4;
+    return createBuffers(vertexData, 4, indexData, 6);
+}
+
+bool SME::Model::loadModel(const char* path){
+    std::vector<char> vertices;
+    std::vector<uint32_t> indices;
+    if(!readModel(path, vertices, indices)){
+        return false;
+    }
+    return createBuffers(reinterpret_cast<const SME::Collada::Vertex*>(&vertices[0]), static_cast<uint32_t>(vertices.size() / sizeof(SME::Collada::Vertex)),
+            &indices[0], static_cast<uint32_t>(indices.size()));
+}
+
+bool SME::Model::loadModel(const char* path, const char* cachePath){
+    uint64_t sourceHash;
+    if(!SME::MeshCache::hashFile(path, &sourceHash)){
+        fprintf(stderr, "Couldn't load model %s!\n", path);
+        return false;
+    }
+    
+    SME::MeshCache::File cache;
+    if(cache.open(cachePath) && isCacheUsable(cache, sourceHash)){
+        const SME::MeshCache::Header &header = cache.getHeader();
+        #ifdef DEBUG
+        fprintf(stdout, "Loading %s from mesh cache %s\n", path, cachePath);
+        #endif
+        loadedVertexCount = header.vertexCount;
+        loadedCacheStatistics = {};
+        cacheStatistics = {};
+        memcpy(boundsMin, header.boundsMin, sizeof(boundsMin));
+        memcpy(boundsMax, header.boundsMax, sizeof(boundsMax));
+        lods.assign(cache.getLods(), cache.getLods() + header.lodCount);
+        return createBuffers(cache.getVertices(), header.vertexCount, cache.getIndices(), header.indexCount);
+    }
+    cache.close();
+    
+    std::vector<char> vertices;
+    std::vector<uint32_t> indices;
+    if(!readModel(path, vertices, indices)){
+        return false;
+    }
+    
+    //the blobs are stored the way they are drawn, converted and narrowed
+    //where they are so no second copy of the mesh is made
+    uint32_t vertexCount = static_cast<uint32_t>(vertices.size() / sizeof(SME::Collada::Vertex));
+    uint32_t indexCount = static_cast<uint32_t>(indices.size());
+    SME::MeshCache::Header header = {};
+    header.sourceHash = sourceHash;
+    header.vertexCount = vertexCount;
+    header.vertexStride = VertexLayout::stride;
+    header.indexCount = indexCount;
+    header.indexType = chooseIndexType(vertexCount);
+    header.attributeCount = VertexLayout::attributeCount;
+    header.lodCount = 1;
+    computeBounds(reinterpret_cast<const SME::Collada::Vertex*>(&vertices[0]), vertexCount, header.boundsMin, header.boundsMax);
+    
+    convertInPlace(&vertices[0], vertexCount);
+    const void* vertexData = &vertices[0];
+    if(header.indexType == VK_INDEX_TYPE_UINT16){
+        narrowInPlace(&indices[0], indices.size());
+    }
+    const void* indexData = &indices[0];
+    
+    std::array<VkVertexInputAttributeDescription, VertexLayout::attributeCount> layoutAttributes = VertexLayout::getAttributes();
+    SME::MeshCache::Attribute attributes[VertexLayout::attributeCount];
+    for(uint32_t i = 0; i < VertexLayout::attributeCount; i++){
+        attributes[i] = {layoutAttributes[i].location, static_cast<uint32_t>(layoutAttributes[i].format), layoutAttributes[i].offset, 0};
+    }
+    //no simplifier yet, the full mesh is the only LOD
+    SME::MeshCache::Lod lod = {0, indexCount, 0.0f, 0};
+    
+    #ifdef DEBUG
+    fprintf(stdout, "Writing mesh cache %s for %s\n", cachePath, path);
+    #endif
+    //failing to write the cache only costs the next load its speed
+    SME::MeshCache::write(cachePath, header, attributes, &lod, vertexData, indexData);
+    
+    memcpy(boundsMin, header.boundsMin, sizeof(boundsMin));
+    memcpy(boundsMax, header.boundsMax, sizeof(boundsMax));
+    lods.assign(1, lod);
+    return createBuffers(vertexData, vertexCount, indexData, indexCount);
+}
+
+bool SME::Model::readModel(const char* path, std::vector<char> &vertices, std::vector<uint32_t> &indices){
+    SME::Collada::Mesh mesh;
+    if(!mesh.load(path)){
+        fprintf(stderr, "Couldn't load model %s!\n", path);
+        return false;
+    }
+    
+    uint32_t triangleCount = mesh.getTriangleCount();
+    indices.clear();
+    indices.reserve(3 * static_cast<size_t>(triangleCount));
+    uint32_t weldedCount;
+    {
+        //a batch of triangles at a time, only unique vertices are kept. Closed
+        //meshes have about half as many as triangles, seams add some more
+        SME::Mesh::VertexWelder welder(sizeof(SME::Collada::Vertex), triangleCount);
+        std::vector<SME::Collada::Vertex> triangles(3 * SME_MODEL_READ_TRIANGLES);
+        for(uint32_t read = 0; read < triangleCount; ){
+            uint32_t count = std::min(triangleCount - read, static_cast<uint32_t>(SME_MODEL_READ_TRIANGLES));
+            if(mesh.readTriangles(&triangles[0], count) != count){
+                fprintf(stderr, "Malformed index list in %s!\n", path);
+                return false;
+            }
+            for(uint32_t i = 0; i < 3 * count; i++){
+                indices.push_back(welder.add(&triangles[i]));
+            }
+            read += count;
+        }
+        weldedCount = welder.getVertexCount();
+        vertices = welder.releaseVertices();
+    }
+    
+    //triangles are reordered for the post transform cache and for early depth
+    //rejection, then the vertices for linear fetches, all in place
+    uint32_t* indexData = &indices[0];
+    size_t indexCount = indices.size();
+    loadedCacheStatistics = SME::Mesh::analyzeVertexCache(indexData, indexCount, weldedCount);
+    SME::Mesh::optimizeVertexCache(indexData, indexCount, weldedCount);
+    #ifdef DEBUG
+    //the overdraw pass trades some of the cache efficiency away
+    SME::Mesh::VertexCacheStatistics cacheOptimisedStatistics = SME::Mesh::analyzeVertexCache(indexData, indexCount, weldedCount);
+    #endif
+    SME::Mesh::optimizeOverdraw(indexData, indexCount, &vertices[offsetof(SME::Collada::Vertex, position)],
+            sizeof(SME::Collada::Vertex), SME_MESH_OVERDRAW_THRESHOLD);
+    uint32_t vertexCount = SME::Mesh::optimizeVertexFetch(&vertices[0], weldedCount, sizeof(SME::Collada::Vertex), indexData, indexCount);
+    vertices.resize(static_cast<size_t>(vertexCount) * sizeof(SME::Collada::Vertex));
+    cacheStatistics = SME::Mesh::analyzeVertexCache(indexData, indexCount, vertexCount);
+    
+    #ifdef DEBUG
+    fprintf(stdout, "Welded %s: %u vertices before, %u after\n", path, 3 * triangleCount, vertexCount);
+    fprintf(stdout, "Optimised %s: ACMR %.3f before, %.3f for the cache, %.3f with overdraw, ATVR %.3f before, %.3f after\n", path,
+            loadedCacheStatistics.acmr, cacheOptimisedStatistics.acmr, cacheStatistics.acmr, loadedCacheStatistics.atvr, cacheStatistics.atvr);
+    #endif
+    
+    loadedVertexCount = 3 * triangleCount;
+    return true;
+}
+
+bool SME::Model::isCacheUsable(const SME::MeshCache::File &cache, uint64_t sourceHash){
+    const SME::MeshCache::Header &header = cache.getHeader();
+    if(header.sourceHash != sourceHash || header.vertexStride != VertexLayout::stride || header.attributeCount != VertexLayout::attributeCount ||
+            header.indexType != static_cast<uint32_t>(chooseIndexType(header.vertexCount)) || header.lodCount == 0){
+        return false;
+    }
+    //a cache written for another vertex layout is stale as well
+    std::array<VkVertexInputAttributeDescription, VertexLayout::attributeCount> attributes = VertexLayout::getAttributes();
+    for(uint32_t i = 0; i < VertexLayout::attributeCount; i++){
+        const SME::MeshCache::Attribute &attribute = cache.getAttributes()[i];
+        if(attribute.location != attributes[i].location || attribute.format != static_cast<uint32_t>(attributes[i].format) ||
+                attribute.offset != attributes[i].offset){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SME::Model::allocateBuffers(uint32_t vertexCount, uint32_t indexCount){
+    indexType = chooseIndexType(vertexCount);
+    VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
     
     VkBufferCreateInfo bufferInfo = {
         VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,   // sType
         nullptr,                                // *pNext
         0,                                      // flags
-        sizeof(vertexData),                     // size
+        static_cast<VkDeviceSize>(vertexCount) * VertexLayout::stride, // size
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, // usage
         VK_SHARING_MODE_EXCLUSIVE,              // sharingMode
         0,                                      // queueFamilyIndexCount
         nullptr                                 // *pQueueFamilyIndices
     };
     
-    if(!buffer.createBuffer(&bufferInfo, SME::Render::getLogicalDevice(), SME::Render::getPhysicalDevice())){
+    if(!vertexBuffer.createBuffer(&bufferInfo, SME::Render::getLogicalDevice(), SME::Render::getPhysicalDevice())){
         fprintf(stderr, "Couldn't create vertex buffer for model!\n");
         return false;
     }
     
-    if(!buffer.uploadDataToDevice(vertexData, 0, bufferInfo.size)){
+    bufferInfo.size = indexCount * indexSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if(!indexBuffer.createBuffer(&bufferInfo, SME::Render::getLogicalDevice(), SME::Render::getPhysicalDevice())){
+        fprintf(stderr, "Couldn't create index buffer for model!\n");
+        return false;
+    }
+    
+    this->vertexCount = vertexCount;
+    this->indexCount = indexCount;
+    lod = 0;
+    return true;
+}
+
+bool SME::Model::createBuffers(const SME::Collada::Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount){
+    if(!allocateBuffers(vertexCount, indexCount)){
+        return false;
+    }
+    VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    computeBounds(vertices, vertexCount, boundsMin, boundsMax);
+    lods.assign(1, SME::MeshCache::Lod{0, indexCount, 0.0f, 0});
+    
+    //quantised to the vertex layout while being written into the staging memory
+    SME::Buffer::UploadToken vertexToken;
+    bool uploaded = vertexBuffer.queueUpload(0, static_cast<VkDeviceSize>(vertexCount) * VertexLayout::stride, VertexLayout::stride,
+            [vertices](void* data, VkDeviceSize offset, VkDeviceSize size){
+        VertexLayout::convert(vertices + offset / VertexLayout::stride, sizeof(SME::Collada::Vertex), colladaOffsets, data,
+                static_cast<size_t>(size / VertexLayout::stride));
+        return true;
+    }, &vertexToken);
+    if(!uploaded){
         fprintf(stderr, "Couldn't upload vertex data to GPU!\n");
         return false;
     }
     
-    return true;    
+    //narrowed while being written into the staging memory
+    SME::Buffer::UploadToken indexToken;
+    uploaded = indexBuffer.queueUpload(0, indexCount * indexSize, indexSize, [indices, indexSize, this](void* data, VkDeviceSize offset, VkDeviceSize size){
+        const uint32_t* source = indices + offset / indexSize;
+        size_t count = static_cast<size_t>(size / indexSize);
+        if(indexType == VK_INDEX_TYPE_UINT32){
+            memcpy(data, source, count * sizeof(uint32_t));
+        } else {
+            uint16_t* destination = static_cast<uint16_t*>(data);
+            for(size_t i = 0; i < count; i++){
+                destination[i] = static_cast<uint16_t>(source[i]);
+            }
+        }
+        return true;
+    }, &indexToken);
+    
+    //batches complete in order, the later token covers both uploads
+    if(!uploaded || !SME::Buffer::waitForUpload(SME::Render::getLogicalDevice(), std::max(vertexToken, indexToken))){
+        fprintf(stderr, "Couldn't upload index data to GPU!\n");
+        return false;
+    }
+    return true;
+}
+
+bool SME::Model::createBuffers(const void* vertices, uint32_t vertexCount, const void* indices, uint32_t indexCount){
+    if(!allocateBuffers(vertexCount, indexCount)){
+        return false;
+    }
+    VkDeviceSize indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    
+    SME::Buffer::UploadToken vertexToken;
+    if(!vertexBuffer.queueUpload(vertices, 0, static_cast<VkDeviceSize>(vertexCount) * VertexLayout::stride, &vertexToken)){
+        fprintf(stderr, "Couldn't upload vertex data to GPU!\n");
+        return false;
+    }
+    
+    SME::Buffer::UploadToken indexToken;
+    if(!indexBuffer.queueUpload(indices, 0, indexCount * indexSize, &indexToken) ||
+            !SME::Buffer::waitForUpload(SME::Render::getLogicalDevice(), std::max(vertexToken, indexToken))){
+        fprintf(stderr, "Couldn't upload index data to GPU!\n");
+        return false;
+    }
+    return true;
 }
 
 void SME::Model::draw(VkCommandBuffer commandBuffer){
     VkDeviceSize offset = 0;
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffer.getHandle(), &offset );
-    vkCmdDraw(commandBuffer, 4, 1, 0, 0);
-}
\ No newline at end of file
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffer.getHandle(), &offset );
+    vkCmdBindIndexBuffer(commandBuffer, *indexBuffer.getHandle(), 0, indexType);
+    vkCmdDrawIndexed(commandBuffer, lods[lod].indexCount, 1, lods[lod].firstIndex, 0, 0);
+}
+
+bool SME::Model::setLod(uint32_t lod){
+    if(lod >= lods.size()){
+        return false;
+    }
+    this->lod = lod;
+    return true;
+}
+
+uint32_t SME::Model::getLodCount(){
+    return static_cast<uint32_t>(lods.size());
+}
+
+void SME::Model::getBounds(float* min, float* max){
+    memcpy(min, boundsMin, sizeof(boundsMin));
+    memcpy(max, boundsMax, sizeof(boundsMax));
+}
+
+uint32_t SME::Model::getVertexCount(){
+    return vertexCount;
+}
+
+uint32_t SME::Model::getLoadedVertexCount(){
+    return loadedVertexCount;
+}
+
+uint32_t SME::Model::getIndexCount(){
+    return indexCount;
+}
+
+VkIndexType SME::Model::getIndexType(){
+    return indexType;
+}
+
+SME::Mesh::VertexCacheStatistics SME::Model::getLoadedCacheStatistics(){
+    return loadedCacheStatistics;
+}
+
+SME::Mesh::VertexCacheStatistics SME::Model::getCacheStatistics(){
+    return cacheStatistics;
+}
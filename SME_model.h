@@ -4,27 +4,158 @@
 #include <vulkan/vulkan.h>
 
 #include "SME_buffer.h"
+#include "SME_mesh.h"
+#include "SME_vertex.h"
+#include "SME_meshcache.h"
+#include "SME_collada.h"
+
+#include <vector>
+
+#ifndef SME_MODEL_READ_TRIANGLES
+#define SME_MODEL_READ_TRIANGLES 4096 //triangles read from a model file at a time while welding
+#endif
+
+#ifndef SME_MODEL_CONVERT_VERTICES
+#define SME_MODEL_CONVERT_VERTICES 256 //vertices converted at a time when writing a mesh cache
+#endif
 
 namespace SME {
     class Model {
     public:
         /**
-         * Loads the model and creates the necessary vertex buffers.
-         * TODO: load the model from a collada (.dae) file.
+         * Topology every model is drawn with, whichever way it was loaded.
+         */
+        static const VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        
+        /**
+         * Layout of the vertex buffer: half float positions and 8 bit colors,
+         * 12 bytes per vertex instead of the 32 of the float vertices loaded.
+         */
+        typedef SME::Vertex::Layout<SME::Vertex::Float16x4, SME::Vertex::Unorm8x4> VertexLayout;
+        
+        /**
+         * Loads a test quad, drawn as an indexed triangle list, and creates the
+         * necessary vertex and index buffers.
          * @return true if the model was successfully loaded, false otherwise
          */
         bool loadModel();
         
+        /**
+         * Loads the triangles of a collada (.dae) file, drawn as an indexed
+         * triangle list, see SME::Collada::Mesh. The triangles are read a few
+         * at a time and welded as they come in, so only a batch of
+         * SME_MODEL_READ_TRIANGLES, the unique vertices and the indices are
+         * ever held in memory. The triangles are then reordered for the post
+         * transform cache and against overdraw, and the vertices in the order
+         * they are fetched, in place, see SME::Mesh. The vertices are
+         * quantised while they are written into staging memory. Debug
+         * builds print the vertex counts and cache statistics before and
+         * after.
+         * @param path path of the .dae file
+         * @return true if the model was successfully loaded, false otherwise
+         */
+        bool loadModel(const char* path);
+        
+        /**
+         * Loads a collada (.dae) file through a binary mesh cache. If the
+         * cache was built from the current contents of the file for the
+         * current vertex layout, its vertex and index blobs are mapped and
+         * copied into staging memory as they are, without parsing anything.
+         * Otherwise the file is loaded like loadModel(path) and the cache is
+         * written for the next time, see SME::MeshCache. The vertices and
+         * indices are converted to the cache's format in place, so no second
+         * copy of the mesh is made.
+         * @param path path of the .dae file
+         * @param cachePath path of the cache file
+         * @return true if the model was successfully loaded, false otherwise
+         */
+        bool loadModel(const char* path, const char* cachePath);
+        
         /**
          * Records the rendering commands to the passed commandBuffer.
          * @param commandBuffer the command buffer to send the draw commands.
          */
         void draw(VkCommandBuffer commandBuffer);
+        
+        /**
+         * Selects the level of detail drawn, 0 being the full mesh.
+         * @param lod the level of detail
+         * @return true if the model has that level of detail, false otherwise
+         */
+        bool setLod(uint32_t lod);
+        
+        /**
+         * @return the amount of levels of detail of the model
+         */
+        uint32_t getLodCount();
+        
+        /**
+         * Gets the axis aligned bounds of the vertex positions.
+         * @param min where to store the three minimum coordinates
+         * @param max where to store the three maximum coordinates
+         */
+        void getBounds(float* min, float* max);
+        
+        /**
+         * @return the amount of vertices in the vertex buffer
+         */
+        uint32_t getVertexCount();
+        
+        /**
+         * @return the amount of vertices the model file described, one per
+         * triangle corner, before identical ones were welded, the welded
+         * count for cached models
+         */
+        uint32_t getLoadedVertexCount();
+        
+        /**
+         * @return the amount of indices drawn
+         */
+        uint32_t getIndexCount();
+        
+        /**
+         * @return VK_INDEX_TYPE_UINT16 if every vertex can be addressed with
+         * 16 bits, VK_INDEX_TYPE_UINT32 otherwise
+         */
+        VkIndexType getIndexType();
+        
+        /**
+         * @return how well the triangle order of the model file used the
+         * post transform cache, zero for the test quad and cached models
+         */
+        SME::Mesh::VertexCacheStatistics getLoadedCacheStatistics();
+        
+        /**
+         * @return how well the triangle order drawn uses the post transform
+         * cache, after the optimisations made while loading, zero for cached
+         * models
+         */
+        SME::Mesh::VertexCacheStatistics getCacheStatistics();
     private:
-        SME::Buffer buffer;
+        //welded and optimised Collada::Vertex vertices of a model file
+        bool readModel(const char* path, std::vector<char> &vertices, std::vector<uint32_t> &indices);
+        bool isCacheUsable(const SME::MeshCache::File &cache, uint64_t sourceHash);
+        bool allocateBuffers(uint32_t vertexCount, uint32_t indexCount);
+        //converted to VertexLayout while they are uploaded
+        bool createBuffers(const SME::Collada::Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount);
+        //vertices already in VertexLayout and indices of the index type the
+        //vertex count calls for, copied as they are
+        bool createBuffers(const void* vertices, uint32_t vertexCount, const void* indices, uint32_t indexCount);
+        
+        SME::Buffer vertexBuffer;
+        SME::Buffer indexBuffer;
+        VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+        uint32_t vertexCount = 0;
+        uint32_t loadedVertexCount = 0;
+        uint32_t indexCount = 0;
+        SME::Mesh::VertexCacheStatistics loadedCacheStatistics = {};
+        SME::Mesh::VertexCacheStatistics cacheStatistics = {};
+        std::vector<SME::MeshCache::Lod> lods;
+        uint32_t lod = 0;
+        float boundsMin[3] = {};
+        float boundsMax[3] = {};
     };
     
 }
 
 #endif /* SME_MODEL_H */
-
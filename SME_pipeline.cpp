@@ -1,8 +1,8 @@
 #include "SME_pipeline.h"
 #include "SME_render.h"
 #include "SME_VkUtil.h"
-#include <SME_window.h>
 #include <iostream>
+#include <array>
 
 VkRenderPass SME::Pipeline::getRenderPass(){
     return renderPass;
@@ -12,7 +12,14 @@ void SME::Pipeline::attachFramebuffer(VkFramebuffer framebuffer){
     attachedFramebuffers.push_back(framebuffer);
 }
 
-void SME::Pipeline::recordCommandBuffers(VkCommandBuffer commandBuffer, int framebufferIndex){
+void SME::Pipeline::destroyFramebuffers(){
+    for(VkFramebuffer framebuffer : attachedFramebuffers){
+        vkDestroyFramebuffer(SME::Render::getLogicalDevice(), framebuffer, nullptr);
+    }
+    attachedFramebuffers.clear();
+}
+
+void SME::Pipeline::beginRenderPass(VkCommandBuffer commandBuffer, int framebufferIndex, VkSubpassContents contents){
     VkClearValue clearValue = {{0.0f, 0.0f, 0.0f, 1.0f}};
     VkRenderPassBeginInfo renderPassBeginInfo = {
         VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,       // sType
@@ -24,30 +31,110 @@ void SME::Pipeline::recordCommandBuffers(VkCommandBuffer commandBuffer, int fram
                 0,                                      // x
                 0                                       // y
             },
-            {                                           // extent
-                static_cast<uint32_t>(SME::Window::getWidth()),           // width
-                static_cast<uint32_t>(SME::Window::getHeight()),          // height
-            }
+            SME::Render::getSwapChainExtent()           // extent
         },
         1,                                              // clearValueCount
         &clearValue                                     // *pClearValues
     };
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, contents);
+}
 
+void SME::Pipeline::bindPipelineState(VkCommandBuffer commandBuffer){
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
     
+    if(dynamicViewport){
+        VkExtent2D extent = SME::Render::getSwapChainExtent();
+        VkViewport viewport = {
+            0.0f,                               //x
+            0.0f,                               //y
+            (float) extent.width,               //width
+            (float) extent.height,              //height
+            0.0f,                               //minDepth
+            1.0f                                //maxDepth
+        };
+        VkRect2D scissor = {
+            {//offset
+                0,  //x
+                0   //y
+            },
+            extent  //extent
+        };
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+}
+
+void SME::Pipeline::recordCommandBuffers(VkCommandBuffer commandBuffer, int framebufferIndex){
+    beginRenderPass(commandBuffer, framebufferIndex, VK_SUBPASS_CONTENTS_INLINE);
+
+    bindPipelineState(commandBuffer);
+    
     recordDrawCommands(commandBuffer, framebufferIndex);
 
     vkCmdEndRenderPass(commandBuffer);
 }
 
+bool SME::Pipeline::recordSecondaryCommandBuffer(VkCommandBuffer commandBuffer, int framebufferIndex, uint32_t chunk, uint32_t chunkCount){
+    VkCommandBufferInheritanceInfo inheritanceInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,  //sType
+        nullptr,                                            //pNext
+        renderPass,                                         //renderPass
+        0,                                                  //subpass
+        attachedFramebuffers[framebufferIndex],             //framebuffer
+        VK_FALSE,                                           //occlusionQueryEnable
+        0,                                                  //queryFlags
+        0                                                   //pipelineStatistics
+    };
+    
+    VkCommandBufferBeginInfo beginInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        //sType
+        nullptr,                                            //pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT, //flags
+        &inheritanceInfo                                    //pInheritanceInfo
+    };
+    
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    
+    bindPipelineState(commandBuffer);
+    
+    recordDrawChunk(commandBuffer, framebufferIndex, chunk, chunkCount);
+    
+    VkResult result = vkEndCommandBuffer(commandBuffer);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Could not record secondary command buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    return true;
+}
+
+uint32_t SME::Pipeline::getDrawChunkCount(){
+    return 1;
+}
+
+void SME::Pipeline::declareResources(SME::FrameGraph::Pass &pass){
+    pass.write(SME::Render::getSwapChainResource(), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, SME::Render::getSwapChain().imageLayout);
+}
+
+void SME::Pipeline::recordDrawChunk(VkCommandBuffer commandBuffer, int framebufferIndex, uint32_t chunk, uint32_t chunkCount){
+    recordDrawCommands(commandBuffer, framebufferIndex);
+}
+
 SME::Pipeline::~Pipeline(){
+    destroyFramebuffers();
+    
     if(pipeline != VK_NULL_HANDLE){
         vkDestroyPipeline(SME::Render::getLogicalDevice(), pipeline, nullptr);
         pipeline = VK_NULL_HANDLE;
     }
     
+    if(pipelineLayout != VK_NULL_HANDLE){
+        vkDestroyPipelineLayout(SME::Render::getLogicalDevice(), pipelineLayout, nullptr);
+        pipelineLayout = VK_NULL_HANDLE;
+    }
+    
     if(renderPass != VK_NULL_HANDLE){
         vkDestroyRenderPass(SME::Render::getLogicalDevice(), renderPass, nullptr);
         renderPass = VK_NULL_HANDLE;
@@ -58,6 +145,12 @@ void SME::TestPipeline::recordDrawCommands(VkCommandBuffer commandBuffer, int fr
     model.draw(commandBuffer);
 }
 
+void SME::TestPipeline::declareResources(SME::FrameGraph::Pass &pass){
+    //the attachment is cleared, whatever was drawn before is overwritten
+    pass.write(SME::Render::getSwapChainResource(), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, SME::Render::getSwapChain().imageLayout);
+}
+
 bool SME::TestPipeline::createRenderPass(){  
     if(!model.loadModel()){
         fprintf(stderr, "Failed loading test model!\n");
@@ -74,8 +167,8 @@ bool SME::TestPipeline::createRenderPass(){
             VK_ATTACHMENT_STORE_OP_STORE,                   //storeOp
             VK_ATTACHMENT_LOAD_OP_DONT_CARE,                //stencilLoadOp
             VK_ATTACHMENT_STORE_OP_DONT_CARE,               //stencilLoadOp
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,                //initialLayout
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR                 //finalLayout               
+            VK_IMAGE_LAYOUT_UNDEFINED,                      //initialLayout, cleared anyway
+            swapchain.imageLayout                           //finalLayout
         }
     };
     
@@ -126,12 +219,12 @@ bool SME::TestPipeline::createRenderPass(){
 }
 
 bool SME::TestPipeline::createPipeline(){
-    if(!SME::VkUtil::createShaderModule(&vertexShader, SME::Render::getLogicalDevice(), "shadersrc/vert.spv")){
+    if(!SME::VkUtil::acquireShaderModule(&vertexShader, SME::Render::getLogicalDevice(), "shadersrc/vert.spv")){
         fprintf(stderr, "There was an error while loading the vertex shader!");
         return false;
     }
     
-    if(!SME::VkUtil::createShaderModule(&fragmentShader, SME::Render::getLogicalDevice(), "shadersrc/frag.spv")){
+    if(!SME::VkUtil::acquireShaderModule(&fragmentShader, SME::Render::getLogicalDevice(), "shadersrc/frag.spv")){
         fprintf(stderr, "There was an error while loading the fragment shader!");
         return false;
     }
@@ -157,26 +250,10 @@ bool SME::TestPipeline::createPipeline(){
         }
     };
     
-    VkVertexInputBindingDescription vertexBindingDescription = {
-        0,                                              // binding
-        8 * sizeof(float),                              // stride
-        VK_VERTEX_INPUT_RATE_VERTEX                     // inputRate
-    };
-
-    VkVertexInputAttributeDescription vertexAttributeDescriptions[] = {
-        {
-            0,                                          // location
-            vertexBindingDescription.binding,         // binding
-            VK_FORMAT_R32G32B32A32_SFLOAT,              // format
-            0                                           // offset
-        },
-        {
-            1,                                          // location
-            vertexBindingDescription.binding,         // binding
-            VK_FORMAT_R32G32B32A32_SFLOAT,              // format
-            4 * sizeof(float)                           // offset
-        }
-    };
+    //the vertex input is generated from the layout the model buffers are written in
+    VkVertexInputBindingDescription vertexBindingDescription = SME::Model::VertexLayout::getBinding();
+    std::array<VkVertexInputAttributeDescription, SME::Model::VertexLayout::attributeCount> vertexAttributeDescriptions =
+            SME::Model::VertexLayout::getAttributes(vertexBindingDescription.binding);
     
     //vertex input description
     
@@ -186,8 +263,8 @@ bool SME::TestPipeline::createPipeline(){
         0,                                                          //flags
         1,                                                          //vertexBindingDescriptionCount
         &vertexBindingDescription,                                  //pVertexbindingDescriptions
-        2,                                                          //vertexAttributeDescriptionCount
-        vertexAttributeDescriptions                                 //pVertexAttributeDescriptions
+        static_cast<uint32_t>(vertexAttributeDescriptions.size()),  //vertexAttributeDescriptionCount
+        vertexAttributeDescriptions.data()                          //pVertexAttributeDescriptions
     };  
     
     //input assembly description
@@ -196,41 +273,35 @@ bool SME::TestPipeline::createPipeline(){
         VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,    //sType
         nullptr,                                                        //pNext
         0,                                                              //flags
-        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,                           //topology
+        SME::Model::topology,                                           //topology
         VK_FALSE                                                        //primitveRestartEnable
     };
     
     //viewport description
     //TODO: add cameras and stuff
-    
-    VkViewport viewport = {
-        0.0f,                               //x
-        0.0f,                               //y
-        (float) SME::Window::getWidth(),    //width
-        (float) SME::Window::getHeight(),   //height
-        0.0f,                               //minDepth
-        1.0f                                //maxDepth
-    };
-        
-    VkRect2D scissor = {
-        {//offset
-            0,  //x
-            0   //y
-        },//extent
-        {
-            (uint32_t) SME::Window::getWidth(),
-            (uint32_t) SME::Window::getHeight()
-        }
-    };
+    //the viewport and scissor are dynamic so resizing doesn't require a new pipeline
     
     VkPipelineViewportStateCreateInfo viewportStateInfo = {
         VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,  //sType
         nullptr,                                                //pNext
         0,                                                      //flags
         1,                                                      //viewportCount
-        &viewport,                                              //pViewports
+        nullptr,                                                //pViewports
         1,                                                      //scissorCount
-        &scissor                                                //pScissors
+        nullptr                                                 //pScissors
+    };
+    
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+    
+    VkPipelineDynamicStateCreateInfo dynamicStateInfo = {
+        VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,   //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        2,                                                      //dynamicStateCount
+        dynamicStates                                           //pDynamicStates
     };
     
     //resterization description
@@ -324,7 +395,7 @@ bool SME::TestPipeline::createPipeline(){
         &multisampleInfo,                                             // *pMultisampleState
         nullptr,                                                      // *pDepthStencilState
         &colorBlendStateInfo,                                         // *pColorBlendState
-        nullptr,                                                      // *pDynamicState
+        &dynamicStateInfo,                                            // *pDynamicState
         pipelineLayout,                                               // layout
         renderPass,                                                   // renderPass
         0,                                                            // subpass
@@ -332,14 +403,24 @@ bool SME::TestPipeline::createPipeline(){
         -1                                                            // basePipelineIndex
     };
     
-    result = vkCreateGraphicsPipelines(SME::Render::getLogicalDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+    result = vkCreateGraphicsPipelines(SME::Render::getLogicalDevice(), SME::Render::getPipelineCache(), 1, &pipelineInfo, nullptr, &pipeline);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed creating pipeline: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
+    dynamicViewport = true;
     return true;
 }
 
+SME::TestPipeline::~TestPipeline(){
+    if(vertexShader != VK_NULL_HANDLE){
+        SME::VkUtil::releaseShaderModule(SME::Render::getLogicalDevice(), vertexShader);
+    }
+    if(fragmentShader != VK_NULL_HANDLE){
+        SME::VkUtil::releaseShaderModule(SME::Render::getLogicalDevice(), fragmentShader);
+    }
+}
+
 void SME::TestPipeline::onPipelineAdded(){
     //required extensions blah blah
 }
\ No newline at end of file
@@ -5,11 +5,12 @@
 #include <vector>
 
 #include "SME_model.h"
+#include "SME_framegraph.h"
 
 namespace SME {
     class Pipeline {
     public:
-        ~Pipeline();
+        virtual ~Pipeline();
         
         /**
          * Creates the Vulkan render pass and its associated subpasses, as well
@@ -33,6 +34,46 @@ namespace SME {
          */
         virtual void recordCommandBuffers(VkCommandBuffer commandBuffer, int framebufferIndex);
         
+        /**
+         * Records one chunk of the draw operations onto a secondary command
+         * buffer that continues the pipeline's render pass. Used when recording
+         * on multiple threads, in which case different chunks of the same
+         * pipeline are recorded concurrently.
+         * @param commandBuffer the secondary command buffer to record into, it
+         * gets begun and ended by this function
+         * @param framebufferIndex the framebuffer index to be used
+         * @param chunk the index of the chunk to record
+         * @param chunkCount the total amount of chunks, as returned by
+         * getDrawChunkCount
+         * @return true if the command buffer was recorded, false otherwise
+         */
+        bool recordSecondaryCommandBuffer(VkCommandBuffer commandBuffer, int framebufferIndex, uint32_t chunk, uint32_t chunkCount);
+        
+        /**
+         * Begins the pipeline's render pass on the given framebuffer.
+         * @param commandBuffer the primary command buffer to record into
+         * @param framebufferIndex the framebuffer index to be used
+         * @param contents whether the draws are recorded inline or executed
+         * from secondary command buffers
+         */
+        void beginRenderPass(VkCommandBuffer commandBuffer, int framebufferIndex, VkSubpassContents contents);
+        
+        /**
+         * Returns in how many pieces the draw operations can be split so they
+         * can be recorded in parallel. Defaults to 1.
+         * @return the amount of draw chunks
+         */
+        virtual uint32_t getDrawChunkCount();
+        
+        /**
+         * Declares the resources the pipeline reads and writes, from which the
+         * frame graph places the barriers around it. Called once the pipeline
+         * is created. Defaults to loading and storing the swap chain image as
+         * a color attachment, left in the swap chain's image layout.
+         * @param pass where to declare the resources
+         */
+        virtual void declareResources(SME::FrameGraph::Pass &pass);
+        
         /**
          * Event function called when the pipeline is added to the Render system.
          * Used for declaring the necessary extensions or other requirements to
@@ -48,29 +89,65 @@ namespace SME {
          */
         void attachFramebuffer(VkFramebuffer framebuffer);
         
+        /**
+         * Destroys all the attached framebuffers. Called by the render system
+         * when the swap chain gets recreated, before attaching the new ones.
+         */
+        void destroyFramebuffers();
+        
         VkRenderPass getRenderPass();
     protected:
-        VkRenderPass renderPass;
-        VkPipelineLayout pipelineLayout;
-        VkPipeline pipeline;
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
         std::vector<VkFramebuffer> attachedFramebuffers;
+        
+        /**
+         * Whether the pipeline was created with VK_DYNAMIC_STATE_VIEWPORT and
+         * VK_DYNAMIC_STATE_SCISSOR. If set, the viewport and scissor are
+         * recorded with the swap chain size, so the pipeline doesn't need to be
+         * rebuilt when the window is resized.
+         */
+        bool dynamicViewport = false;
         virtual void recordDrawCommands(VkCommandBuffer commandBuffer, int framebufferIndex) = 0;
+        
+        /**
+         * Records a subset of the draw operations. Must be safe to call from
+         * several threads at once for different chunks. Defaults to recording
+         * everything through recordDrawCommands, which requires a chunk count
+         * of 1.
+         * @param commandBuffer the command buffer to send the commands to
+         * @param framebufferIndex the framebuffer index to be used
+         * @param chunk the index of the chunk to record
+         * @param chunkCount the total amount of chunks
+         */
+        virtual void recordDrawChunk(VkCommandBuffer commandBuffer, int framebufferIndex, uint32_t chunk, uint32_t chunkCount);
+        
+        /**
+         * Binds the pipeline and sets the dynamic state it uses
+         * @param commandBuffer the command buffer to send the commands to
+         */
+        void bindPipelineState(VkCommandBuffer commandBuffer);
     };
     
     class TestPipeline : public Pipeline {
     public:
+        ~TestPipeline();
+        
         bool createRenderPass();
         
         bool createPipeline();
         
         bool recordCommandBuffers();
         
+        void declareResources(SME::FrameGraph::Pass &pass);
+        
         void onPipelineAdded();
     protected:
         void recordDrawCommands(VkCommandBuffer commandBuffer, int framebufferIndex);
     private:
-        VkShaderModule vertexShader;
-        VkShaderModule fragmentShader;
+        VkShaderModule vertexShader = VK_NULL_HANDLE;
+        VkShaderModule fragmentShader = VK_NULL_HANDLE;
         SME::Model model;
     };
 }
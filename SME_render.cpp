@@ -5,174 +5,944 @@
 #include <SME_window.h>
 #include <SME_core.h>
 #include "SME_buffer.h"
-#ifdef BENCHMARK
+#include "SME_threadpool.h"
+#include "SME_timing.h"
 #include <chrono>
-uint32_t frames;
-std::chrono::high_resolution_clock::time_point lastAverage = std::chrono::high_resolution_clock::now();
-#endif
-
-#ifdef DEBUG
+#include <fstream>
+#include <string>
 #include <cstring>
-#endif
+#include <atomic>
+#include <algorithm>
+
+//Command buffers of one recording thread for one frame in flight
+struct SecondaryCommandPool {
+    VkCommandPool handle = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;
+    size_t used = 0;
+};
+
+//Renderer state, one per logical device. See SME::Render::createContext
+struct SME::Render::Context {
+    VkInstance instance = VK_NULL_HANDLE; //Vulkan instance of the engine
+
+    VkSurfaceKHR surface = VK_NULL_HANDLE; //Vulkan surface that will output the graphics
+
+    VkPhysicalDevice physicalDevice = 0; //Physical device being used
+
+    VkDevice device = VK_NULL_HANDLE; //Logical device used for referencing on vulkan
+
+    //Queue family indices
+    uint32_t presentQueueFamilyIndex = UINT32_MAX;
+    uint32_t graphicsQueueFamilyIndex = UINT32_MAX;
+
+    //Queues
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkQueue presentQueue = VK_NULL_HANDLE;
+
+    //Frames in flight
+    uint32_t framesInFlight = SME_FRAMES_IN_FLIGHT;
+    uint32_t currentFrame = 0;
+    uint64_t lastFenceWaitTime = 0; //microseconds the cpu spent waiting on fences last frame
+
+    //Semaphores, one pair per frame in flight
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderingFinishedSemaphores;
+
+    //Fences
+    std::vector<VkFence> inFlightFences; //one per frame in flight
+    std::vector<VkFence> imagesInFlight; //fence of the frame using each swapchain image, if any
+
+    //Swapchains
+    SME::Render::SwapChain swapChain = {};
+    int swapChainWindowWidth = 0; //window size when the swap chain was last created
+    int swapChainWindowHeight = 0;
+    uint32_t lastImageIndex = 0; //image rendered to by the last submitted frame
+    SME::Render::PresentPolicy presentPolicy = SME_PRESENT_POLICY;
+    VkPresentModeKHR currentPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    uint32_t requestedImageCount = SME_SWAPCHAIN_IMAGES;
+    bool swapChainOutdated = false; //options changed, rebuild before the next frame
+
+    //Headless rendering, the swap chain structure describes the offscreen targets
+    bool headless = false;
+    uint32_t headlessWidth = 0;
+    uint32_t headlessHeight = 0;
+    uint32_t headlessImageCount = 0;
+    uint32_t nextOffscreenImage = 0;
+    std::vector<SME::Memory::Allocation> offscreenImageMemory;
+
+    //Command Pools
+    VkCommandPool graphicsQueueCmdPool = VK_NULL_HANDLE;
+
+    //Command Buffers
+    std::vector<VkCommandBuffer> graphicsCommandBuffers; //prerecorded, one per swapchain image
+    std::vector<VkCommandBuffer> frameCommandBuffers; //rerecorded every frame, one per frame in flight
+    std::vector<VkCommandBuffer> uploadCommandBuffers; //upload acquires and defragmentation copies, one per frame in flight
+
+    //Multithreaded recording
+    uint32_t recordingThreadCount = SME_RECORDING_THREADS;
+    uint32_t pipelineCreationThreadCount = SME_PIPELINE_CREATION_THREADS;
+    SME::ThreadPool* recordingThreadPool = nullptr;
+    std::vector<SecondaryCommandPool> secondaryCommandPools; //one per thread per frame in flight
 
-VkInstance instance; //Vulkan instance of the engine
+    //Benchmark counters
+    #ifdef BENCHMARK
+    bool benchmarkEnabled = true;
+    #else
+    bool benchmarkEnabled = false;
+    #endif
+    uint32_t benchmarkFrames = 0;
+    std::chrono::high_resolution_clock::time_point lastAverage = std::chrono::high_resolution_clock::now();
+
+    //Frame timing
+    bool frameTimingEnabled = benchmarkEnabled;
+    uint64_t frameNumber = 0;
+    std::chrono::high_resolution_clock::time_point lastFrameStart;
+    SME::Timing::RingBuffer<SME::Timing::FrameTiming, SME_TIMING_HISTORY> frameTimings;
+    std::vector<VkQueryPool> timestampQueryPools; //one per swapchain image, two queries per pipeline
+    std::vector<SME::Timing::FrameTiming> pendingFrameTimings; //waiting for the gpu timestamps, one per image
+    std::vector<bool> pendingFrameTimingValid;
+    uint32_t timestampValidBits = 0; //0 if the graphics queue doesn't support timestamps
+    float timestampPeriod = 0.0f; //nanoseconds per timestamp tick
 
-VkSurfaceKHR surface; //Vulkan surface that will output the graphics
+    //Pipeline cache
+    std::string pipelineCachePath;
+    bool pipelineCachePathSet = false; //otherwise the default for the device is used
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    bool pipelineCacheWarm = false; //valid data was loaded from disk
+    std::chrono::high_resolution_clock::time_point initStart;
+    double startupTime = -1.0; //microseconds from init until the first frame was submitted
 
-VkPhysicalDevice physicalDevice = 0; //Physical device being used
+    double defragmentationBudget = SME_DEFRAGMENTATION_BUDGET; //microseconds per frame
+    SME::BufferPool* bufferPool = nullptr; //transient buffers
+    SME::FrameGraph* frameGraph = nullptr; //barriers between the pipelines
+    SME::FrameGraph::Resource swapChainResource = 0;
 
-VkDevice device; //Logical device used for referencing on vulkan
+    //Uniform ring, one slice per frame in flight handed out by a bump pointer
+    VkDeviceSize uniformRingSize = SME_UNIFORM_RING_SIZE;
+    SME::Buffer* uniformBuffer = nullptr;
+    VkDeviceSize uniformAlignment = 1; //minUniformBufferOffsetAlignment
+    VkDeviceSize uniformRange = 0; //range of the dynamic descriptor
+    VkDeviceSize uniformSliceSize = 0; //ring size rounded up to the alignment
+    VkDeviceSize uniformSliceStart = 0; //slice of the frame being recorded
+    std::atomic<VkDeviceSize> uniformHead{0}; //next free byte within the slice
+    VkDescriptorSetLayout uniformDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool uniformDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet uniformDescriptorSet = VK_NULL_HANDLE;
 
-//Queue family indices
-uint32_t presentQueueFamilyIndex = UINT32_MAX;
-uint32_t graphicsQueueFamilyIndex = UINT32_MAX;
+    //Pipelines
+    std::vector<SME::Pipeline*> pipelines;
+    
+    uint32_t physicalDeviceIndex = UINT32_MAX; //device to use, any compatible one if UINT32_MAX
+};
 
-//Queues
-VkQueue graphicsQueue;
-VkQueue presentQueue;
+SME::Render::Context defaultContext; //used by the window, and by threads that never set a context
+thread_local SME::Render::Context* context = &defaultContext;
 
-//Semaphores
-VkSemaphore imageAvailableSemaphore;
-VkSemaphore renderingFinishedSemaphore;
+SME::Render::Context* SME::Render::createContext(){
+    return new Context();
+}
 
-//Swapchains
-SME::Render::SwapChain swapChain;
+void SME::Render::destroyContext(Context* destroyed){
+    if(destroyed == nullptr || destroyed == &defaultContext){
+        return;
+    }
+    
+    //pipelines look up the device through the current context while being destroyed
+    Context* previous = context;
+    context = destroyed;
+    cleanup();
+    context = previous == destroyed ? &defaultContext : previous;
+    delete destroyed;
+}
 
-//Command Pools
-VkCommandPool graphicsQueueCmdPool;
+void SME::Render::makeContextCurrent(Context* current){
+    context = current != nullptr ? current : &defaultContext;
+}
 
-//Command Buffers
-std::vector<VkCommandBuffer> graphicsCommandBuffers;
+SME::Render::Context* SME::Render::getCurrentContext(){
+    return context;
+}
 
-//Pipelines
-std::vector<SME::Pipeline*> pipelines;
+void SME::Render::setPhysicalDeviceIndex(uint32_t index){
+    context->physicalDeviceIndex = index;
+}
 
 void SME::Render::addPipeline(SME::Pipeline* pipeline){
-    pipelines.push_back(pipeline);
+    context->pipelines.push_back(pipeline);
     pipeline->onPipelineAdded();
 }
 
 SME::Render::SwapChain SME::Render::getSwapChain(){
-    return swapChain;
+    return context->swapChain;
 }
 
 VkDevice SME::Render::getLogicalDevice(){
-    return device;
+    return context->device;
 }
 
 VkPhysicalDevice SME::Render::getPhysicalDevice(){
-    return physicalDevice;
+    return context->physicalDevice;
 }
 
-void render(){
-    vkDeviceWaitIdle(device);
+void SME::Render::setFramesInFlight(uint32_t count){
+    if(count == 0){
+        count = 1;
+    }
+    context->framesInFlight = count;
+}
+
+uint32_t SME::Render::getFramesInFlight(){
+    return context->framesInFlight;
+}
+
+void SME::Render::setRecordingThreadCount(uint32_t threadCount){
+    context->recordingThreadCount = threadCount;
+}
+
+void SME::Render::setPipelineCreationThreadCount(uint32_t threadCount){
+    context->pipelineCreationThreadCount = threadCount;
+}
+
+uint64_t SME::Render::getLastFenceWaitTime(){
+    return context->lastFenceWaitTime;
+}
+
+void SME::Render::setPresentPolicy(SME::Render::PresentPolicy policy){
+    if(policy != context->presentPolicy){
+        context->presentPolicy = policy;
+        context->swapChainOutdated = true;
+    }
+}
+
+SME::Render::PresentPolicy SME::Render::getPresentPolicy(){
+    return context->presentPolicy;
+}
+
+VkPresentModeKHR SME::Render::getPresentMode(){
+    return context->currentPresentMode;
+}
+
+void SME::Render::setSwapChainImageCount(uint32_t count){
+    if(count != context->requestedImageCount){
+        context->requestedImageCount = count;
+        context->swapChainOutdated = true;
+    }
+}
+
+void SME::Render::setBenchmarkEnabled(bool enabled){
+    context->benchmarkEnabled = enabled;
+    context->benchmarkFrames = 0;
+    context->lastAverage = std::chrono::high_resolution_clock::now();
+    if(enabled){
+        context->frameTimingEnabled = true;
+    }
+}
+
+bool SME::Render::isBenchmarkEnabled(){
+    return context->benchmarkEnabled;
+}
+
+void SME::Render::setPipelineCachePath(const char* path){
+    context->pipelineCachePath = path != nullptr ? path : "";
+    context->pipelineCachePathSet = true;
+}
+
+VkPipelineCache SME::Render::getPipelineCache(){
+    return context->pipelineCache;
+}
+
+bool SME::Render::isPipelineCacheWarm(){
+    return context->pipelineCacheWarm;
+}
+
+double SME::Render::getStartupTime(){
+    return context->startupTime;
+}
+
+void SME::Render::setFrameTimingEnabled(bool enabled){
+    context->frameTimingEnabled = enabled;
+}
+
+bool SME::Render::pollFrameTiming(SME::Timing::FrameTiming* timing){
+    return context->frameTimings.pop(*timing);
+}
+
+bool SME::Render::getFrameStatistics(SME::Timing::Statistics* cpuFrameTime, SME::Timing::Statistics* gpuFrameTime){
+    std::vector<double> cpuSamples;
+    std::vector<double> gpuSamples;
+    SME::Timing::FrameTiming timing;
+    while(context->frameTimings.pop(timing)){
+        cpuSamples.push_back(timing.frameTime);
+        gpuSamples.push_back(timing.gpuTime);
+    }
+    
+    if(cpuFrameTime != nullptr){
+        *cpuFrameTime = SME::Timing::computeStatistics(cpuSamples);
+    }
+    if(gpuFrameTime != nullptr){
+        *gpuFrameTime = SME::Timing::computeStatistics(gpuSamples);
+    }
+    return !cpuSamples.empty();
+}
+
+SME::BufferPool* SME::Render::getBufferPool(){
+    return context->bufferPool;
+}
+
+SME::FrameGraph* SME::Render::getFrameGraph(){
+    return context->frameGraph;
+}
+
+SME::FrameGraph::Resource SME::Render::getSwapChainResource(){
+    return context->swapChainResource;
+}
+
+void SME::Render::setDefragmentationBudget(double microseconds){
+    context->defragmentationBudget = microseconds;
+}
+
+void SME::Render::setUniformRingSize(VkDeviceSize size){
+    context->uniformRingSize = size;
+}
+
+bool SME::Render::allocateUniforms(VkDeviceSize size, void** data, uint32_t* dynamicOffset){
+    if(context->uniformBuffer == nullptr || size == 0 || size > context->uniformRange){
+        return false;
+    }
+    
+    VkDeviceSize alignedSize = (size + context->uniformAlignment - 1) / context->uniformAlignment * context->uniformAlignment;
+    VkDeviceSize offset = context->uniformHead.fetch_add(alignedSize, std::memory_order_relaxed);
+    if(offset + alignedSize > context->uniformSliceSize){
+        return false;
+    }
+    
+    offset += context->uniformSliceStart;
+    *data = static_cast<char*>(context->uniformBuffer->getMappedData()) + offset;
+    *dynamicOffset = static_cast<uint32_t>(offset);
+    return true;
+}
+
+VkDescriptorSetLayout SME::Render::getUniformDescriptorSetLayout(){
+    return context->uniformDescriptorSetLayout;
+}
+
+VkDescriptorSet SME::Render::getUniformDescriptorSet(){
+    return context->uniformDescriptorSet;
+}
+
+VkDeviceSize SME::Render::getUniformRange(){
+    return context->uniformRange;
+}
+
+double elapsedMicroseconds(std::chrono::high_resolution_clock::time_point start){
+    return std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+VkExtent2D SME::Render::getSwapChainExtent(){
+    return context->swapChain.extent;
+}
+
+void SME::Render::setHeadless(uint32_t width, uint32_t height, uint32_t imageCount){
+    context->headless = true;
+    context->headlessWidth = width;
+    context->headlessHeight = height;
+    context->headlessImageCount = imageCount;
+}
+
+bool SME::Render::isHeadless(){
+    return context->headless;
+}
+
+bool recreateSwapchain();
+bool recordFrameCommandBuffer(uint32_t frameIndex, uint32_t imageIndex);
+bool recordCommandBuffers();
+
+void publishPendingFrameTiming(uint32_t imageIndex){
+    if(imageIndex >= context->pendingFrameTimings.size() || !context->pendingFrameTimingValid[imageIndex]){
+        return;
+    }
+    context->pendingFrameTimingValid[imageIndex] = false;
+    
+    SME::Timing::FrameTiming &timing = context->pendingFrameTimings[imageIndex];
+    timing.pipelineCount = static_cast<uint32_t>(std::min<size_t>(context->pipelines.size(), SME_TIMING_MAX_PIPELINES));
+    for(uint32_t i = 0; i < timing.pipelineCount; i++){
+        timing.pipelineGpuTime[i] = -1.0;
+    }
+    
+    if(!context->timestampQueryPools.empty()){
+        std::vector<uint64_t> timestamps(context->pipelines.size() * 2);
+        VkResult result = vkGetQueryPoolResults(context->device, context->timestampQueryPools[imageIndex], 0, static_cast<uint32_t>(timestamps.size()),
+                timestamps.size() * sizeof(uint64_t), &timestamps[0], sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if(result == VK_SUCCESS){
+            uint64_t mask = context->timestampValidBits >= 64 ? UINT64_MAX : ((1ULL << context->timestampValidBits) - 1);
+            double microsecondsPerTick = context->timestampPeriod / 1000.0;
+            timing.gpuTime = ((timestamps.back() - timestamps.front()) & mask) * microsecondsPerTick;
+            for(uint32_t i = 0; i < timing.pipelineCount; i++){
+                timing.pipelineGpuTime[i] = ((timestamps[i * 2 + 1] - timestamps[i * 2]) & mask) * microsecondsPerTick;
+            }
+        }
+    }
+    
+    //dropped if the application isn't polling fast enough
+    context->frameTimings.push(timing);
+}
+
+//only once the device is idle, publishes the frames whose images haven't come round again
+void publishPendingFrameTimings(){
+    std::vector<uint32_t> imageIndices;
+    for(uint32_t i = 0; i < context->pendingFrameTimings.size(); i++){
+        if(context->pendingFrameTimingValid[i]){
+            imageIndices.push_back(i);
+        }
+    }
+    std::sort(imageIndices.begin(), imageIndices.end(), [](uint32_t a, uint32_t b){
+        return context->pendingFrameTimings[a].frameNumber < context->pendingFrameTimings[b].frameNumber;
+    });
+    for(uint32_t imageIndex : imageIndices){
+        publishPendingFrameTiming(imageIndex);
+    }
+}
+
+bool createTimestampQueryPools(){
+    //cpu timings are collected even without gpu timestamps
+    context->pendingFrameTimings.assign(context->swapChain.imageCount, SME::Timing::FrameTiming());
+    context->pendingFrameTimingValid.assign(context->swapChain.imageCount, false);
+    if(context->timestampValidBits == 0 || context->pipelines.empty()){
+        return true;
+    }
+    
+    VkQueryPoolCreateInfo queryPoolInfo = {
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,               //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        VK_QUERY_TYPE_TIMESTAMP,                                //queryType
+        static_cast<uint32_t>(context->pipelines.size() * 2),            //queryCount, start and end of each pipeline
+        0                                                       //pipelineStatistics
+    };
+    
+    context->timestampQueryPools.resize(context->swapChain.imageCount, VK_NULL_HANDLE);
+    for(VkQueryPool &queryPool : context->timestampQueryPools){
+        VkResult result = vkCreateQueryPool(context->device, &queryPoolInfo, nullptr, &queryPool);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating timestamp query pool: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+    }
+    return true;
+}
+
+void destroyTimestampQueryPools(){
+    for(VkQueryPool queryPool : context->timestampQueryPools){
+        if(queryPool != VK_NULL_HANDLE){
+            vkDestroyQueryPool(context->device, queryPool, nullptr);
+        }
+    }
+    context->timestampQueryPools.clear();
+    context->pendingFrameTimings.clear();
+    context->pendingFrameTimingValid.clear();
+}
+
+bool createUniformRing(){
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context->physicalDevice, &properties);
+    context->uniformAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+    context->uniformRange = std::min<VkDeviceSize>(SME_UNIFORM_RANGE, properties.limits.maxUniformBufferRange);
+    context->uniformSliceSize = (context->uniformRingSize + context->uniformAlignment - 1) / context->uniformAlignment * context->uniformAlignment;
+    
+    //a full range must be readable from the last offset of the last slice
+    VkBufferCreateInfo bufferInfo = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,                           // sType
+        nullptr,                                                        // *pNext
+        0,                                                              // flags
+        context->uniformSliceSize * context->framesInFlight + context->uniformRange, // size
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,                             // usage
+        VK_SHARING_MODE_EXCLUSIVE,                                      // sharingMode
+        0,                                                              // queueFamilyIndexCount
+        nullptr                                                         // *pQueueFamilyIndices
+    };
+    
+    context->uniformBuffer = new SME::Buffer();
+    if(!context->uniformBuffer->createBuffer(&bufferInfo, context->device, context->physicalDevice)){
+        fprintf(stderr, "Failed creating uniform ring buffer!\n");
+        return false;
+    }
+    
+    VkDescriptorSetLayoutBinding binding = {
+        0,                                          // binding
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,  // descriptorType
+        1,                                          // descriptorCount
+        VK_SHADER_STAGE_ALL_GRAPHICS,               // stageFlags
+        nullptr                                     // *pImmutableSamplers
+    };
+    
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    // sType
+        nullptr,                                                // *pNext
+        0,                                                      // flags
+        1,                                                      // bindingCount
+        &binding                                                // *pBindings
+    };
+    
+    VkResult result = vkCreateDescriptorSetLayout(context->device, &layoutInfo, nullptr, &context->uniformDescriptorSetLayout);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Failed creating uniform descriptor set layout: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    VkDescriptorPoolSize poolSize = {
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,  // type
+        1                                           // descriptorCount
+    };
+    
+    VkDescriptorPoolCreateInfo poolInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,  // sType
+        nullptr,                                        // *pNext
+        0,                                              // flags
+        1,                                              // maxSets
+        1,                                              // poolSizeCount
+        &poolSize                                       // *pPoolSizes
+    };
+    
+    result = vkCreateDescriptorPool(context->device, &poolInfo, nullptr, &context->uniformDescriptorPool);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Failed creating uniform descriptor pool: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    VkDescriptorSetAllocateInfo allocateInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, // sType
+        nullptr,                                        // *pNext
+        context->uniformDescriptorPool,                 // descriptorPool
+        1,                                              // descriptorSetCount
+        &context->uniformDescriptorSetLayout            // *pSetLayouts
+    };
+    
+    result = vkAllocateDescriptorSets(context->device, &allocateInfo, &context->uniformDescriptorSet);
+    if(result != VK_SUCCESS){
+        fprintf(stderr, "Failed allocating uniform descriptor set: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    //written once, blocks are selected by the dynamic offset when binding
+    VkDescriptorBufferInfo descriptorBufferInfo = {
+        *context->uniformBuffer->getHandle(),   // buffer
+        0,                                      // offset
+        context->uniformRange                   // range
+    };
+    
+    VkWriteDescriptorSet descriptorWrite = {
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,     // sType
+        nullptr,                                    // *pNext
+        context->uniformDescriptorSet,              // dstSet
+        0,                                          // dstBinding
+        0,                                          // dstArrayElement
+        1,                                          // descriptorCount
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,  // descriptorType
+        nullptr,                                    // *pImageInfo
+        &descriptorBufferInfo,                      // *pBufferInfo
+        nullptr                                     // *pTexelBufferView
+    };
+    
+    vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, nullptr);
+    return true;
+}
+
+void destroyUniformRing(){
+    if(context->uniformDescriptorPool != VK_NULL_HANDLE){
+        vkDestroyDescriptorPool(context->device, context->uniformDescriptorPool, nullptr);
+        context->uniformDescriptorPool = VK_NULL_HANDLE;
+        context->uniformDescriptorSet = VK_NULL_HANDLE;
+    }
+    if(context->uniformDescriptorSetLayout != VK_NULL_HANDLE){
+        vkDestroyDescriptorSetLayout(context->device, context->uniformDescriptorSetLayout, nullptr);
+        context->uniformDescriptorSetLayout = VK_NULL_HANDLE;
+    }
+    delete context->uniformBuffer;
+    context->uniformBuffer = nullptr;
+}
+
+void recordPipelineCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, size_t pipelineIndex, const std::vector<VkCommandBuffer>* secondaries){
+    bool timestamps = !context->timestampQueryPools.empty();
+    if(context->frameGraph->isCulled(pipelineIndex)){
+        //both queries are still written so the frame's results become available
+        if(timestamps){
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, context->timestampQueryPools[imageIndex], static_cast<uint32_t>(pipelineIndex * 2));
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, context->timestampQueryPools[imageIndex], static_cast<uint32_t>(pipelineIndex * 2 + 1));
+        }
+        return;
+    }
+    
+    context->frameGraph->recordBarriers(commandBuffer, pipelineIndex, imageIndex);
+    
+    if(timestamps){
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, context->timestampQueryPools[imageIndex], static_cast<uint32_t>(pipelineIndex * 2));
+    }
+    
+    SME::Pipeline* pipeline = context->pipelines[pipelineIndex];
+    if(secondaries == nullptr){
+        pipeline->recordCommandBuffers(commandBuffer, imageIndex);
+    } else {
+        pipeline->beginRenderPass(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        if(!secondaries->empty()){
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries->size()), &(*secondaries)[0]);
+        }
+        vkCmdEndRenderPass(commandBuffer);
+    }
+    
+    if(timestamps){
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, context->timestampQueryPools[imageIndex], static_cast<uint32_t>(pipelineIndex * 2 + 1));
+    }
+}
+
+bool renderFrame(){
+    //some platforms don't report a resize through the swap chain, check manually
+    if(!context->headless && (context->swapChainOutdated || SME::Window::getWidth() != context->swapChainWindowWidth || SME::Window::getHeight() != context->swapChainWindowHeight)){
+        if(!recreateSwapchain()){
+            return true;
+        }
+    }
+    
+    std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
+    SME::Timing::FrameTiming timing = {};
+    timing.frameNumber = context->frameNumber;
+    timing.frameTime = context->frameNumber > 0 ? std::chrono::duration<double, std::micro>(frameStart - context->lastFrameStart).count() : -1.0;
+    timing.gpuTime = -1.0;
+    
+    //wait until the gpu is done with the frame that last used this slot
+    vkWaitForFences(context->device, 1, &context->inFlightFences[context->currentFrame], VK_TRUE, UINT64_MAX);
+    double inFlightWaitTime = elapsedMicroseconds(frameStart);
+    
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(device, swapChain.handle, UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
-    switch(result){
-        case VK_SUCCESS:
-        case VK_SUBOPTIMAL_KHR:
-            break;
-        case VK_ERROR_OUT_OF_DATE_KHR:
-            //window size changed
-            break;
-        default:
-            fprintf(stderr, "Problem occurred during swap chain image acquisition: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-            abort();
+    VkResult result;
+    std::chrono::high_resolution_clock::time_point stepStart = std::chrono::high_resolution_clock::now();
+    if(context->headless){
+        //offscreen targets are simply used in order
+        imageIndex = context->nextOffscreenImage;
+        context->nextOffscreenImage = (context->nextOffscreenImage + 1) % context->swapChain.imageCount;
+    } else {
+        result = vkAcquireNextImageKHR(context->device, context->swapChain.handle, UINT64_MAX, context->imageAvailableSemaphores[context->currentFrame], VK_NULL_HANDLE, &imageIndex);
+        switch(result){
+            case VK_SUCCESS:
+            case VK_SUBOPTIMAL_KHR:
+                break;
+            case VK_ERROR_OUT_OF_DATE_KHR:
+                //window size changed, no image was acquired so skip this frame
+                recreateSwapchain();
+                return true;
+            default:
+                fprintf(stderr, "Problem occurred during swap chain image acquisition: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+                return false;
+        }
+    }
+    
+    timing.acquireTime = elapsedMicroseconds(stepStart);
+    
+    //the image may be out of order and still in use by an older frame
+    stepStart = std::chrono::high_resolution_clock::now();
+    if(context->imagesInFlight[imageIndex] != VK_NULL_HANDLE && context->imagesInFlight[imageIndex] != context->inFlightFences[context->currentFrame]){
+        vkWaitForFences(context->device, 1, &context->imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+    }
+    context->imagesInFlight[imageIndex] = context->inFlightFences[context->currentFrame];
+    
+    timing.fenceWaitTime = inFlightWaitTime + elapsedMicroseconds(stepStart);
+    context->lastFenceWaitTime = static_cast<uint64_t>(timing.fenceWaitTime);
+    
+    //the previous frame on this image is done, its gpu timestamps can be read
+    publishPendingFrameTiming(imageIndex);
+    
+    //the gpu is done reading this frame's uniform slice
+    context->uniformSliceStart = context->currentFrame * context->uniformSliceSize;
+    context->uniformHead.store(0, std::memory_order_relaxed);
+    
+    //frames up to the one that last used this slot are done
+    uint64_t completedFrame = context->frameNumber + 1 > context->framesInFlight ? context->frameNumber + 1 - context->framesInFlight : 0;
+    context->bufferPool->beginFrame(context->frameNumber, completedFrame);
+    
+    //runs ahead of the frame's commands in the same submission
+    VkCommandBuffer uploadCommandBuffer = context->uploadCommandBuffers[context->currentFrame];
+    VkCommandBufferBeginInfo uploadBeginInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        //sType
+        nullptr,                                            //*pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,        //flags
+        nullptr                                             //*pInheritanceInfo
+    };
+    vkBeginCommandBuffer(uploadCommandBuffer, &uploadBeginInfo);
+    SME::Buffer::acquireUploads(context->device, uploadCommandBuffer, context->frameNumber, completedFrame);
+    
+    if(context->defragmentationBudget > 0.0){
+        //prerecorded command buffers still reference the old buffers, swaps
+        //are batched so the stall to record them again is rare
+        bool prerecorded = context->recordingThreadPool == nullptr;
+        if(SME::Buffer::defragment(context->device, uploadCommandBuffer, context->frameNumber, completedFrame, context->defragmentationBudget, prerecorded) > 0 && prerecorded){
+            vkDeviceWaitIdle(context->device);
+            vkFreeCommandBuffers(context->device, context->graphicsQueueCmdPool, static_cast<uint32_t>(context->graphicsCommandBuffers.size()), &context->graphicsCommandBuffers[0]);
+            if(!recordCommandBuffers()){
+                return false;
+            }
+        }
+    }
+    
+    result = vkEndCommandBuffer(uploadCommandBuffer);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Could not record upload command buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    stepStart = std::chrono::high_resolution_clock::now();
+    VkCommandBuffer commandBuffer = context->graphicsCommandBuffers.empty() ? VK_NULL_HANDLE : context->graphicsCommandBuffers[imageIndex];
+    if(context->recordingThreadPool != nullptr){
+        if(!recordFrameCommandBuffer(context->currentFrame, imageIndex)){
+            return false;
+        }
+        commandBuffer = context->frameCommandBuffers[context->currentFrame];
+        timing.recordTime = elapsedMicroseconds(stepStart);
+    }
+    
+    if(context->uniformBuffer != nullptr && !context->uniformBuffer->isCoherent()){
+        VkDeviceSize used = std::min(context->uniformHead.load(std::memory_order_relaxed), context->uniformSliceSize);
+        if(used > 0 && !context->uniformBuffer->flushMappedRange(context->uniformSliceStart, used)){
+            return false;
+        }
     }
+    
+    vkResetFences(context->device, 1, &context->inFlightFences[context->currentFrame]);
 
     VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     VkSubmitInfo submitInfo;
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.pNext = nullptr;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &imageAvailableSemaphore;
+    submitInfo.waitSemaphoreCount = context->headless ? 0 : 1;
+    submitInfo.pWaitSemaphores = &context->imageAvailableSemaphores[context->currentFrame];
     submitInfo.pWaitDstStageMask = &waitDstStageMask;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &graphicsCommandBuffers[imageIndex];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderingFinishedSemaphore;
+    VkCommandBuffer commandBuffers[] = {uploadCommandBuffer, commandBuffer};
+    submitInfo.commandBufferCount = 2;
+    submitInfo.pCommandBuffers = commandBuffers;
+    submitInfo.signalSemaphoreCount = context->headless ? 0 : 1;
+    submitInfo.pSignalSemaphores = &context->renderingFinishedSemaphores[context->currentFrame];
 
-    result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    stepStart = std::chrono::high_resolution_clock::now();
+    result = vkQueueSubmit(context->graphicsQueue, 1, &submitInfo, context->inFlightFences[context->currentFrame]);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed submitting drawing queue: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-        abort();
+        return false;
     }
+    timing.submitTime = elapsedMicroseconds(stepStart);
+    
+    context->lastImageIndex = imageIndex;
 
-    VkPresentInfoKHR presentInfo;
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.pNext = nullptr;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &renderingFinishedSemaphore;
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &swapChain.handle;
-    presentInfo.pImageIndices = &imageIndex;
-    presentInfo.pResults = nullptr;
+    if(!context->headless){
+        VkPresentInfoKHR presentInfo;
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.pNext = nullptr;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = &context->renderingFinishedSemaphores[context->currentFrame];
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = &context->swapChain.handle;
+        presentInfo.pImageIndices = &imageIndex;
+        presentInfo.pResults = nullptr;
 
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
-    switch(result){
-        case VK_SUCCESS:
-            break;
-        case VK_SUBOPTIMAL_KHR:
-        case VK_ERROR_OUT_OF_DATE_KHR:
-            //window size changed
-            break;
-        default:
-            fprintf(stderr, "Problem occurred during swap chain image present: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-            abort();
+        stepStart = std::chrono::high_resolution_clock::now();
+        result = vkQueuePresentKHR(context->presentQueue, &presentInfo);
+        timing.presentTime = elapsedMicroseconds(stepStart);
+        switch(result){
+            case VK_SUCCESS:
+                break;
+            case VK_SUBOPTIMAL_KHR:
+            case VK_ERROR_OUT_OF_DATE_KHR:
+                //window size changed
+                recreateSwapchain();
+                break;
+            default:
+                fprintf(stderr, "Problem occurred during swap chain image present: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+                return false;
+        }
     }
-    #ifdef BENCHMARK
-    frames++;
-    if(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - lastAverage).count() > 1000000){
-        printf("%u fps\n", frames);
-        frames = 0;
-        lastAverage = std::chrono::high_resolution_clock::now();
+    
+    //completed once the gpu timestamps are available
+    if(context->frameTimingEnabled && imageIndex < context->pendingFrameTimings.size()){
+        context->pendingFrameTimings[imageIndex] = timing;
+        context->pendingFrameTimingValid[imageIndex] = true;
     }
-    #endif
+    
+    if(context->frameNumber == 0){
+        context->startupTime = elapsedMicroseconds(context->initStart);
+        if(context->benchmarkEnabled){
+            printf("Startup took %.3f ms with a %s pipeline cache\n", context->startupTime / 1000.0, context->pipelineCacheWarm ? "warm" : "cold");
+        }
+    }
+    
+    context->lastFrameStart = frameStart;
+    context->frameNumber++;
+    context->currentFrame = (context->currentFrame + 1) % context->framesInFlight;
+    if(context->benchmarkEnabled){
+        context->benchmarkFrames++;
+        if(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - context->lastAverage).count() > 1000000){
+            SME::Timing::Statistics cpuStatistics;
+            SME::Timing::Statistics gpuStatistics;
+            SME::Render::getFrameStatistics(&cpuStatistics, &gpuStatistics);
+            printf("%u fps, frame time min %.3f avg %.3f p99 %.3f ms, gpu avg %.3f p99 %.3f ms\n", context->benchmarkFrames,
+                    cpuStatistics.min / 1000.0, cpuStatistics.average / 1000.0, cpuStatistics.p99 / 1000.0,
+                    gpuStatistics.average / 1000.0, gpuStatistics.p99 / 1000.0);
+            context->benchmarkFrames = 0;
+            context->lastAverage = std::chrono::high_resolution_clock::now();
+        }
+    }
+    return true;
 }
 
-bool createSwapchain(){
-    if(swapChain.handle != VK_NULL_HANDLE){
-        vkDestroySwapchainKHR(device, swapChain.handle, nullptr);
+void render(){
+    if(!renderFrame()){
+        abort();
+    }
+}
+
+bool SME::Render::submitFrame(){
+    return renderFrame();
+}
+
+uint32_t SME::Render::getLastFrameImageIndex(){
+    return context->lastImageIndex;
+}
+
+bool SME::Render::waitIdle(){
+    VkResult result = vkDeviceWaitIdle(context->device);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed waiting for the device to become idle: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    publishPendingFrameTimings();
+    return true;
+}
+
+bool createOffscreenTargets(){
+    context->swapChain.surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
+    context->swapChain.surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+    context->swapChain.extent = {context->headlessWidth, context->headlessHeight};
+    context->swapChain.imageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; //ready to be copied out
+    context->swapChain.imageCount = context->headlessImageCount > 0 ? context->headlessImageCount : context->framesInFlight;
+    context->swapChain.images.resize(context->swapChain.imageCount, VK_NULL_HANDLE);
+    context->swapChain.imageViews.resize(context->swapChain.imageCount, VK_NULL_HANDLE);
+    context->offscreenImageMemory.resize(context->swapChain.imageCount);
+    
+    VkImageCreateInfo imageInfo = {
+        VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,        //sType
+        nullptr,                                    //pNext
+        0,                                          //flags
+        VK_IMAGE_TYPE_2D,                           //imageType
+        context->swapChain.surfaceFormat.format,             //format
+        {                                           //extent
+            context->headlessWidth,                          //width
+            context->headlessHeight,                         //height
+            1                                       //depth
+        },
+        1,                                          //mipLevels
+        1,                                          //arrayLayers
+        VK_SAMPLE_COUNT_1_BIT,                      //samples
+        VK_IMAGE_TILING_OPTIMAL,                    //tiling
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, //usage, rendered to and read back
+        VK_SHARING_MODE_EXCLUSIVE,                  //sharingMode
+        0,                                          //queueFamilyIndexCount
+        nullptr,                                    //pQueueFamilyIndices
+        VK_IMAGE_LAYOUT_UNDEFINED                   //initialLayout
+    };
+    
+    VkImageViewCreateInfo imageViewInfo = {
+        VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,   //sType
+        nullptr,                                    //pNext
+        0,                                          //flags
+        VK_NULL_HANDLE,                             //image
+        VK_IMAGE_VIEW_TYPE_2D,                      //viewType
+        context->swapChain.surfaceFormat.format,             //format
+        {                                           //components
+            VK_COMPONENT_SWIZZLE_IDENTITY,
+            VK_COMPONENT_SWIZZLE_IDENTITY,
+            VK_COMPONENT_SWIZZLE_IDENTITY,
+            VK_COMPONENT_SWIZZLE_IDENTITY
+        },
+        {                                           //subresourceRange
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            0,
+            1,
+            0,
+            1
+        }
+    };
+    
+    for(uint32_t i = 0; i < context->swapChain.imageCount; i++){
+        VkResult result = vkCreateImage(context->device, &imageInfo, nullptr, &context->swapChain.images[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating offscreen image: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+        
+        VkMemoryRequirements memoryRequirements;
+        vkGetImageMemoryRequirements(context->device, context->swapChain.images[i], &memoryRequirements);
+        
+        //optimal tiling, kept out of the blocks buffers live in
+        if(!SME::Memory::allocate(context->device, context->physicalDevice, memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, &context->offscreenImageMemory[i])){
+            fprintf(stderr, "Failed allocating offscreen image memory!\n");
+            return false;
+        }
+        
+        result = vkBindImageMemory(context->device, context->swapChain.images[i], context->offscreenImageMemory[i].memory, context->offscreenImageMemory[i].offset);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed binding offscreen image memory: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+        
+        imageViewInfo.image = context->swapChain.images[i];
+        result = vkCreateImageView(context->device, &imageViewInfo, nullptr, &context->swapChain.imageViews[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating offscreen image view: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
     }
     
+    return true;
+}
+
+bool createSwapchain(){
     VkResult result;
     
     VkSurfaceCapabilitiesKHR surfaceCapabilities;
-    result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+    result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(context->physicalDevice, context->surface, &surfaceCapabilities);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed acquiring surface capabilities: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
     uint32_t formatCount = 0;
-    result = vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+    result = vkGetPhysicalDeviceSurfaceFormatsKHR(context->physicalDevice, context->surface, &formatCount, nullptr);
     if (result != VK_SUCCESS || formatCount == 0) {
         fprintf(stderr, "Failed enumerating available surface formats: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
     std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, &surfaceFormats[0]);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(context->physicalDevice, context->surface, &formatCount, &surfaceFormats[0]);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed acquiring surface formats: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
     uint32_t presentModesCount;
-    result = vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModesCount, nullptr);
+    result = vkGetPhysicalDeviceSurfacePresentModesKHR(context->physicalDevice, context->surface, &presentModesCount, nullptr);
     if (result != VK_SUCCESS || presentModesCount == 0) {
         fprintf(stderr, "Failed enumerating present modes: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
     std::vector<VkPresentModeKHR> presentModes(presentModesCount);
-    result = vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModesCount, &presentModes[0]);
+    result = vkGetPhysicalDeviceSurfacePresentModesKHR(context->physicalDevice, context->surface, &presentModesCount, &presentModes[0]);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed acquiring present modes: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
-    uint32_t swapchainImageCount = surfaceCapabilities.minImageCount + 1;
+    uint32_t swapchainImageCount = context->requestedImageCount > 0 ? context->requestedImageCount : surfaceCapabilities.minImageCount + 1;
+    if(swapchainImageCount < surfaceCapabilities.minImageCount){
+        swapchainImageCount = surfaceCapabilities.minImageCount;
+    }
     if(surfaceCapabilities.maxImageCount > 0 && swapchainImageCount > surfaceCapabilities.maxImageCount){
         swapchainImageCount = surfaceCapabilities.maxImageCount;
         #ifdef DEBUG
@@ -181,25 +951,28 @@ bool createSwapchain(){
     }    
     
     if(surfaceFormats.size() == 1 && surfaceFormats[0].format == VK_FORMAT_UNDEFINED){
-        swapChain.surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
-        swapChain.surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+        context->swapChain.surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
+        context->swapChain.surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
     } else {
         bool formatFound = false;
         for(VkSurfaceFormatKHR &format : surfaceFormats){
             if(format.format == VK_FORMAT_R8G8B8A8_UNORM){
-                swapChain.surfaceFormat = format;
+                context->swapChain.surfaceFormat = format;
                 formatFound = true;
                 break;
             }
         }
         if(!formatFound){
-            swapChain.surfaceFormat = surfaceFormats[0];
+            context->swapChain.surfaceFormat = surfaceFormats[0];
         }
     }
     
     VkExtent2D swapChainExtent = { static_cast<uint32_t>(SME::Window::getWidth()), static_cast<uint32_t>(SME::Window::getHeight()) };
     
-    if(surfaceCapabilities.currentExtent.width == -1){
+    if(surfaceCapabilities.currentExtent.width != UINT32_MAX){
+        //the surface size is dictated by the window
+        swapChainExtent = surfaceCapabilities.currentExtent;
+    } else {
         if( swapChainExtent.width < surfaceCapabilities.minImageExtent.width){
             swapChainExtent.width = surfaceCapabilities.minImageExtent.width;
         }
@@ -235,129 +1008,609 @@ bool createSwapchain(){
         return false;
     }
     
-    VkSurfaceTransformFlagBitsKHR transformFlags;
+    VkSurfaceTransformFlagBitsKHR transformFlags;
+    
+    //don't apply any transformation
+    if(surfaceCapabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR){
+        transformFlags = VK_SURFACE_TRANSFORM_INHERIT_BIT_KHR;
+    } else {
+        transformFlags = surfaceCapabilities.currentTransform;
+    }
+    
+    //modes to try in order of preference, FIFO is always supported
+    std::vector<VkPresentModeKHR> preferredModes;
+    switch(context->presentPolicy){
+        case SME::Render::PRESENT_POLICY_LOW_LATENCY:
+            //never tears, so it falls back to FIFO rather than IMMEDIATE
+            preferredModes = {VK_PRESENT_MODE_MAILBOX_KHR};
+            break;
+        case SME::Render::PRESENT_POLICY_UNCAPPED:
+            preferredModes = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+            break;
+        case SME::Render::PRESENT_POLICY_POWER_SAVING:
+            break;
+    }
+    preferredModes.push_back(VK_PRESENT_MODE_FIFO_KHR);
+    
+    VkPresentModeKHR presentMode;
+    bool presentModeSet = false;
+    for(VkPresentModeKHR &preferredMode : preferredModes){
+        for(VkPresentModeKHR &presentModeAvailable : presentModes){
+            if(presentModeAvailable == preferredMode){
+                presentMode = presentModeAvailable;
+                presentModeSet = true;
+                break;
+            }
+        }
+        if(presentModeSet){
+            break;
+        }
+    }
+    if(!presentModeSet){
+        fprintf(stderr, "Couldn't set suitable present mode!");
+        return false;
+    }
+    #ifdef DEBUG
+    if(presentMode != preferredModes[0]){
+        fprintf(stdout, "Preferred present mode %d unavailable, using %d\n", preferredModes[0], presentMode);
+    }
+    #endif
+    context->currentPresentMode = presentMode;
+    
+    VkSwapchainKHR oldSwapchain = context->swapChain.handle;
+    
+    VkSwapchainCreateInfoKHR swapChainInfo;
+    swapChainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapChainInfo.pNext = nullptr;
+    swapChainInfo.flags = 0;
+    swapChainInfo.surface = context->surface;
+    swapChainInfo.minImageCount = swapchainImageCount;
+    swapChainInfo.imageFormat = context->swapChain.surfaceFormat.format;
+    swapChainInfo.imageColorSpace = context->swapChain.surfaceFormat.colorSpace;
+    swapChainInfo.imageExtent = swapChainExtent;
+    swapChainInfo.imageArrayLayers = 1;
+    swapChainInfo.imageUsage = imageUsageFlags;
+    swapChainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    swapChainInfo.queueFamilyIndexCount = 0;
+    swapChainInfo.pQueueFamilyIndices = nullptr;
+    swapChainInfo.preTransform = transformFlags;
+    swapChainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapChainInfo.presentMode = presentMode;
+    swapChainInfo.clipped = VK_TRUE;
+    swapChainInfo.oldSwapchain = oldSwapchain; //previous swapchain, in case of resize
+    
+    result = vkCreateSwapchainKHR(context->device, &swapChainInfo, nullptr, &context->swapChain.handle);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed creating swapchain: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    context->swapChain.extent = swapChainExtent;
+    context->swapChain.imageLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    context->swapChainWindowWidth = SME::Window::getWidth();
+    context->swapChainWindowHeight = SME::Window::getHeight();
+    
+    //the old swapchain has been handed over, its images are no longer needed
+    for(VkImageView imageView : context->swapChain.imageViews){
+        vkDestroyImageView(context->device, imageView, nullptr);
+    }
+    context->swapChain.imageViews.clear();
+    
+    if(oldSwapchain != VK_NULL_HANDLE){
+        vkDestroySwapchainKHR(context->device, oldSwapchain, nullptr);
+    }
+    
+    result = vkGetSwapchainImagesKHR(context->device, context->swapChain.handle, &context->swapChain.imageCount, nullptr);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed getting swapchain image count: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    context->swapChain.images.resize(context->swapChain.imageCount);
+    result = vkGetSwapchainImagesKHR(context->device, context->swapChain.handle, &context->swapChain.imageCount, &context->swapChain.images[0]);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed getting swapchain images: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    //create image views
+    context->swapChain.imageViews.resize(context->swapChain.imageCount);
+    
+    VkImageViewCreateInfo imageViewInfo;
+    imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewInfo.pNext = nullptr;
+    imageViewInfo.flags = 0;    
+    imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewInfo.format = context->swapChain.surfaceFormat.format;
+    imageViewInfo.components = {
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY
+    };
+    imageViewInfo.subresourceRange = {
+        VK_IMAGE_ASPECT_COLOR_BIT,
+        0,
+        1,
+        0,
+        1
+    };
+    
+    for(size_t i = 0; i < context->swapChain.imageCount; i++){
+        imageViewInfo.image = context->swapChain.images[i];
+        
+        result = vkCreateImageView(context->device, &imageViewInfo, nullptr, &context->swapChain.imageViews[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating image view: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool createFramebuffers(SME::Pipeline* pipeline){
+    VkFramebufferCreateInfo framebufferInfo;
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.pNext = nullptr;
+    framebufferInfo.flags = 0;
+    framebufferInfo.renderPass = pipeline->getRenderPass();
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.width = context->swapChain.extent.width;
+    framebufferInfo.height = context->swapChain.extent.height;
+    framebufferInfo.layers = 1;
+    
+    for(size_t i = 0; i < context->swapChain.imageCount; i++){
+        framebufferInfo.pAttachments = &context->swapChain.imageViews[i];
+
+        VkFramebuffer framebuffer;
+        VkResult result = vkCreateFramebuffer(context->device, &framebufferInfo, nullptr, &framebuffer);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating framebuffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        } else {
+            pipeline->attachFramebuffer(framebuffer);
+        }
+    }
+    return true;
+}
+
+bool recordCommandBuffers(){
+    //multithreaded recording rerecords every frame instead
+    if(context->recordingThreadPool != nullptr){
+        return true;
+    }
+    
+    context->graphicsCommandBuffers.resize(context->swapChain.imageCount, VK_NULL_HANDLE);
+    
+    VkCommandBufferAllocateInfo cmdBufferAllocateInfo;    
+    cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufferAllocateInfo.pNext = nullptr;
+    cmdBufferAllocateInfo.commandPool = context->graphicsQueueCmdPool;
+    cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufferAllocateInfo.commandBufferCount = context->swapChain.imageCount;
+    
+    VkResult result = vkAllocateCommandBuffers(context->device, &cmdBufferAllocateInfo, &context->graphicsCommandBuffers[0]);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed allocating graphics command buffers: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    VkCommandBufferBeginInfo graphicsCmdBufferBeginInfo;
+    graphicsCmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    graphicsCmdBufferBeginInfo.pNext = nullptr;
+    graphicsCmdBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    graphicsCmdBufferBeginInfo.pInheritanceInfo = nullptr;
+        
+    for(uint32_t i = 0; i < context->swapChain.imageCount; i++){
+        vkBeginCommandBuffer(context->graphicsCommandBuffers[i], &graphicsCmdBufferBeginInfo);
+        
+        if(!context->timestampQueryPools.empty()){
+            vkCmdResetQueryPool(context->graphicsCommandBuffers[i], context->timestampQueryPools[i], 0, static_cast<uint32_t>(context->pipelines.size() * 2));
+        }
+
+        for(size_t pipelineIndex = 0; pipelineIndex < context->pipelines.size(); pipelineIndex++){
+            recordPipelineCommands(context->graphicsCommandBuffers[i], i, pipelineIndex, nullptr);
+        }
+        
+        context->frameGraph->recordFinalBarriers(context->graphicsCommandBuffers[i], i);
+
+        result = vkEndCommandBuffer(context->graphicsCommandBuffers[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Could not record graphics command buffers: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool createRecordingResources(){
+    context->recordingThreadPool = new SME::ThreadPool(context->recordingThreadCount);
+    
+    VkCommandPoolCreateInfo cmdPoolInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        nullptr,
+        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,   //reset as a whole every frame
+        context->graphicsQueueFamilyIndex
+    };
+    
+    //each thread records into its own pool, and each frame in flight has its
+    //own set so pools can be reset while older frames are still executing
+    context->secondaryCommandPools.resize(context->recordingThreadPool->getThreadCount() * context->framesInFlight);
+    for(SecondaryCommandPool &pool : context->secondaryCommandPools){
+        VkResult result = vkCreateCommandPool(context->device, &cmdPoolInfo, nullptr, &pool.handle);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating secondary command pool: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+    }
+    
+    context->frameCommandBuffers.resize(context->framesInFlight, VK_NULL_HANDLE);
+    
+    VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, //sType
+        nullptr,                                        //pNext
+        context->graphicsQueueCmdPool,                           //commandPool
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,                //level
+        context->framesInFlight                                  //commandBufferCount
+    };
+    
+    VkResult result = vkAllocateCommandBuffers(context->device, &cmdBufferAllocateInfo, &context->frameCommandBuffers[0]);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed allocating frame command buffers: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    
+    return true;
+}
+
+VkCommandBuffer getSecondaryCommandBuffer(SecondaryCommandPool &pool){
+    if(pool.used == pool.commandBuffers.size()){
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, //sType
+            nullptr,                                        //pNext
+            pool.handle,                                    //commandPool
+            VK_COMMAND_BUFFER_LEVEL_SECONDARY,              //level
+            1                                               //commandBufferCount
+        };
+        
+        VkCommandBuffer commandBuffer;
+        VkResult result = vkAllocateCommandBuffers(context->device, &cmdBufferAllocateInfo, &commandBuffer);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed allocating secondary command buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return VK_NULL_HANDLE;
+        }
+        pool.commandBuffers.push_back(commandBuffer);
+    }
+    return pool.commandBuffers[pool.used++];
+}
+
+bool recordFrameCommandBuffer(uint32_t frameIndex, uint32_t imageIndex){
+    uint32_t threadCount = context->recordingThreadPool->getThreadCount();
+    
+    //the fence of this frame has been waited on, its pools are no longer in use
+    for(uint32_t thread = 0; thread < threadCount; thread++){
+        SecondaryCommandPool &pool = context->secondaryCommandPools[frameIndex * threadCount + thread];
+        vkResetCommandPool(context->device, pool.handle, 0);
+        pool.used = 0;
+    }
+    
+    //one task per chunk of every pipeline, in submission order
+    struct RecordTask {
+        SME::Pipeline* pipeline;
+        uint32_t chunk;
+        uint32_t chunkCount;
+        VkCommandBuffer commandBuffer;
+        bool recorded;
+    };
+    
+    std::vector<RecordTask> tasks;
+    for(size_t pipelineIndex = 0; pipelineIndex < context->pipelines.size(); pipelineIndex++){
+        if(context->frameGraph->isCulled(pipelineIndex)){
+            continue;
+        }
+        SME::Pipeline* pipeline = context->pipelines[pipelineIndex];
+        uint32_t chunkCount = pipeline->getDrawChunkCount();
+        for(uint32_t chunk = 0; chunk < chunkCount; chunk++){
+            tasks.push_back({pipeline, chunk, chunkCount, VK_NULL_HANDLE, false});
+        }
+    }
+    
+    SME::Render::Context* owner = context;
+    context->recordingThreadPool->run(static_cast<uint32_t>(tasks.size()), [&](uint32_t taskIndex, uint32_t thread){
+        context = owner;
+        RecordTask &task = tasks[taskIndex];
+        task.commandBuffer = getSecondaryCommandBuffer(context->secondaryCommandPools[frameIndex * threadCount + thread]);
+        if(task.commandBuffer != VK_NULL_HANDLE){
+            task.recorded = task.pipeline->recordSecondaryCommandBuffer(task.commandBuffer, imageIndex, task.chunk, task.chunkCount);
+        }
+    });
+    
+    VkCommandBuffer commandBuffer = context->frameCommandBuffers[frameIndex];
+    
+    VkCommandBufferBeginInfo beginInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,    //sType
+        nullptr,                                        //pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,    //flags
+        nullptr                                         //pInheritanceInfo
+    };
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    
+    if(!context->timestampQueryPools.empty()){
+        vkCmdResetQueryPool(commandBuffer, context->timestampQueryPools[imageIndex], 0, static_cast<uint32_t>(context->pipelines.size() * 2));
+    }
+    
+    std::vector<VkCommandBuffer> secondaries;
+    size_t taskIndex = 0;
+    for(size_t pipelineIndex = 0; pipelineIndex < context->pipelines.size(); pipelineIndex++){
+        secondaries.clear();
+        for(; taskIndex < tasks.size() && tasks[taskIndex].pipeline == context->pipelines[pipelineIndex]; taskIndex++){
+            if(!tasks[taskIndex].recorded){
+                fprintf(stderr, "Failed recording chunk %u of pipeline %zu!\n", tasks[taskIndex].chunk, pipelineIndex);
+                vkEndCommandBuffer(commandBuffer);
+                return false;
+            }
+            secondaries.push_back(tasks[taskIndex].commandBuffer);
+        }
+        
+        recordPipelineCommands(commandBuffer, imageIndex, pipelineIndex, &secondaries);
+    }
+    
+    context->frameGraph->recordFinalBarriers(commandBuffer, imageIndex);
+    
+    VkResult result = vkEndCommandBuffer(commandBuffer);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Could not record frame command buffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return false;
+    }
+    return true;
+}
+
+bool recreateSwapchain(){
+    //minimised windows can't have a swap chain, wait until they are restored
+    if(SME::Window::getWidth() == 0 || SME::Window::getHeight() == 0){
+        return false;
+    }
+    
+    //the command buffers and framebuffers about to be replaced may still be in use
+    vkDeviceWaitIdle(context->device);
+    
+    for(SME::Pipeline* pipeline : context->pipelines){
+        pipeline->destroyFramebuffers();
+    }
+    
+    if(context->graphicsCommandBuffers.size() > 0 && context->graphicsCommandBuffers[0] != VK_NULL_HANDLE){
+        vkFreeCommandBuffers(context->device, context->graphicsQueueCmdPool, static_cast<uint32_t>(context->graphicsCommandBuffers.size()), &context->graphicsCommandBuffers[0]);
+        context->graphicsCommandBuffers.clear();
+    }
+    
+    VkFormat previousFormat = context->swapChain.surfaceFormat.format;
+    if(!createSwapchain()){
+        fprintf(stderr, "Couldn't recreate swap chain!\n");
+        abort();
+    }
+    
+    if(context->swapChain.surfaceFormat.format != previousFormat){
+        //render passes were created against the old format and would be incompatible
+        fprintf(stderr, "Swap chain format changed during recreation, this is not supported!\n");
+        abort();
+    }
+    
+    context->imagesInFlight.assign(context->swapChain.imageCount, VK_NULL_HANDLE);
+    context->swapChainOutdated = false;
+    context->frameGraph->setImages(context->swapChainResource, context->swapChain.images);
+    
+    publishPendingFrameTimings();
+    destroyTimestampQueryPools();
+    if(!createTimestampQueryPools()){
+        abort();
+    }
+    
+    for(SME::Pipeline* pipeline : context->pipelines){
+        if(!createFramebuffers(pipeline)){
+            abort();
+        }
+    }
     
-    //don't apply any transformation
-    if(surfaceCapabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR){
-        transformFlags = VK_SURFACE_TRANSFORM_INHERIT_BIT_KHR;
-    } else {
-        transformFlags = surfaceCapabilities.currentTransform;
+    if(!recordCommandBuffers()){
+        abort();
     }
     
-    VkPresentModeKHR presentMode;
-    bool presentModeSet = false;
+    return true;
+}
+
+//written in front of the driver's cache data, so data from another device
+//or driver version is never handed to the driver
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+};
+
+#define SME_PIPELINE_CACHE_MAGIC 0x43454D53 //"SMEC"
+
+bool readPipelineCacheFile(const VkPhysicalDeviceProperties &properties, std::vector<char> &data){
+    std::ifstream file(context->pipelineCachePath, std::ios::in|std::ios::binary);
+    if(!file.is_open()){
+        return false;
+    }
     
-    #ifdef BENCHMARK
-    for(VkPresentModeKHR &presentModeAvailable : presentModes){
-        if(presentModeAvailable == VK_PRESENT_MODE_IMMEDIATE_KHR){
-            presentMode = presentModeAvailable;
-            presentModeSet = true;
-            break;
-        }
+    PipelineCacheFileHeader fileHeader;
+    if(!file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader))){
+        return false;
     }
-    if(!presentModeSet){
-        fprintf(stderr, "Couldn't set suitable present mode! Please disable benchmark mode.\n");
+    if(fileHeader.magic != SME_PIPELINE_CACHE_MAGIC || fileHeader.vendorID != properties.vendorID ||
+            fileHeader.deviceID != properties.deviceID || fileHeader.driverVersion != properties.driverVersion ||
+            memcmp(fileHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0){
+        #ifdef DEBUG
+        fprintf(stdout, "Pipeline cache %s belongs to another device or driver, ignoring it\n", context->pipelineCachePath.c_str());
+        #endif
         return false;
     }
-    #else
-    for(VkPresentModeKHR &presentModeAvailable : presentModes){
-        if(presentModeAvailable == VK_PRESENT_MODE_MAILBOX_KHR){
-            presentMode = presentModeAvailable;
-            presentModeSet = true;
-            break;
-        }
+    
+    //a damaged size must not be allocated, it has to fit in the rest of the file
+    std::streamoff dataStart = file.tellg();
+    if(!file.seekg(0, std::ios::end)){
+        return false;
     }
-    if(!presentModeSet){
-        for(VkPresentModeKHR &presentModeAvailable : presentModes){
-            if(presentModeAvailable == VK_PRESENT_MODE_FIFO_KHR){
-                presentMode = presentModeAvailable;
-                presentModeSet = true;
-                break;
-            }
-        }
-        if(!presentModeSet){
-            fprintf(stderr, "Couldn't set suitable present mode!");
-            return false;
-        }
+    uint64_t remaining = static_cast<uint64_t>(file.tellg() - dataStart);
+    if(fileHeader.dataSize < sizeof(VkPipelineCacheHeaderVersionOne) || fileHeader.dataSize > remaining){
+        #ifdef DEBUG
+        fprintf(stdout, "Pipeline cache %s is damaged, ignoring it\n", context->pipelineCachePath.c_str());
+        #endif
+        return false;
     }
-    #endif
     
-    VkSwapchainCreateInfoKHR swapChainInfo;
-    swapChainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    swapChainInfo.pNext = nullptr;
-    swapChainInfo.flags = 0;
-    swapChainInfo.surface = surface;
-    swapChainInfo.minImageCount = swapchainImageCount;
-    swapChainInfo.imageFormat = swapChain.surfaceFormat.format;
-    swapChainInfo.imageColorSpace = swapChain.surfaceFormat.colorSpace;
-    swapChainInfo.imageExtent = swapChainExtent;
-    swapChainInfo.imageArrayLayers = 1;
-    swapChainInfo.imageUsage = imageUsageFlags;
-    swapChainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    swapChainInfo.queueFamilyIndexCount = 0;
-    swapChainInfo.pQueueFamilyIndices = nullptr;
-    swapChainInfo.preTransform = transformFlags;
-    swapChainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    swapChainInfo.presentMode = presentMode;
-    swapChainInfo.clipped = VK_TRUE;
-    swapChainInfo.oldSwapchain = swapChain.handle; //previous swapchain, in case of resize
+    data.resize(fileHeader.dataSize);
+    if(!file.seekg(dataStart) || !file.read(&data[0], data.size())){
+        return false;
+    }
+    
+    //the driver should reject bad data itself, but not all of them do
+    VkPipelineCacheHeaderVersionOne cacheHeader;
+    memcpy(&cacheHeader, &data[0], sizeof(cacheHeader));
+    return cacheHeader.headerSize >= sizeof(cacheHeader) && cacheHeader.headerSize <= data.size() &&
+            cacheHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            cacheHeader.vendorID == properties.vendorID && cacheHeader.deviceID == properties.deviceID &&
+            memcmp(cacheHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool createPipelineCache(){
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context->physicalDevice, &properties);
+    
+    //each device model gets its own file, so different devices don't keep
+    //replacing each other's cache
+    if(!context->pipelineCachePathSet){
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "_%04x_%04x.bin", properties.vendorID, properties.deviceID);
+        context->pipelineCachePath = std::string(SME_PIPELINE_CACHE_PATH) + suffix;
+    }
+    
+    std::vector<char> data;
+    context->pipelineCacheWarm = !context->pipelineCachePath.empty() && readPipelineCacheFile(properties, data);
+    
+    VkPipelineCacheCreateInfo pipelineCacheInfo = {
+        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,       //sType
+        nullptr,                                            //pNext
+        0,                                                  //flags
+        context->pipelineCacheWarm ? data.size() : 0,                //initialDataSize
+        context->pipelineCacheWarm ? &data[0] : nullptr              //pInitialData
+    };
     
-    result = vkCreateSwapchainKHR(device, &swapChainInfo, nullptr, &swapChain.handle);
+    VkResult result = vkCreatePipelineCache(context->device, &pipelineCacheInfo, nullptr, &context->pipelineCache);
+    if (result != VK_SUCCESS && context->pipelineCacheWarm) {
+        //start over with an empty cache
+        context->pipelineCacheWarm = false;
+        pipelineCacheInfo.initialDataSize = 0;
+        pipelineCacheInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(context->device, &pipelineCacheInfo, nullptr, &context->pipelineCache);
+    }
     if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed creating swapchain: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        fprintf(stderr, "Failed creating pipeline cache: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
+    return true;
+}
+
+void savePipelineCache(){
+    if(context->pipelineCachePath.empty()){
+        return;
+    }
     
-    result = vkGetSwapchainImagesKHR(device, swapChain.handle, &swapChain.imageCount, nullptr);
+    size_t dataSize = 0;
+    VkResult result = vkGetPipelineCacheData(context->device, context->pipelineCache, &dataSize, nullptr);
+    if (result != VK_SUCCESS || dataSize == 0) {
+        return;
+    }
+    std::vector<char> data(dataSize);
+    result = vkGetPipelineCacheData(context->device, context->pipelineCache, &dataSize, &data[0]);
     if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed getting swapchain image count: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        fprintf(stderr, "Failed retrieving pipeline cache data: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        return;
+    }
+    
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context->physicalDevice, &properties);
+    PipelineCacheFileHeader fileHeader;
+    fileHeader.magic = SME_PIPELINE_CACHE_MAGIC;
+    fileHeader.vendorID = properties.vendorID;
+    fileHeader.deviceID = properties.deviceID;
+    fileHeader.driverVersion = properties.driverVersion;
+    memcpy(fileHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    fileHeader.dataSize = dataSize;
+    
+    //a crash or another context saving at the same time never leaves a damaged file
+    bool written = SME::VkUtil::replaceFile(context->pipelineCachePath.c_str(), [&fileHeader, &data](std::ofstream &file){
+        return static_cast<bool>(file.write(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader)) && file.write(&data[0], data.size()));
+    });
+    if(!written){
+        fprintf(stderr, "Couldn't write pipeline cache to %s\n", context->pipelineCachePath.c_str());
+    }
+}
+
+bool createPipeline(size_t index){
+    SME::Pipeline* pipeline = context->pipelines[index];
+    if(!pipeline->createRenderPass()){
+        fprintf(stderr, "Failed creating render pass of pipeline %zu!\n", index);
         return false;
     }
     
-    swapChain.images.resize(swapChain.imageCount);
-    result = vkGetSwapchainImagesKHR(device, swapChain.handle, &swapChain.imageCount, &swapChain.images[0]);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed getting swapchain images: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+    if(!createFramebuffers(pipeline)){
+        fprintf(stderr, "Failed creating framebuffers of pipeline %zu!\n", index);
         return false;
     }
     
-    //create image views
-    swapChain.imageViews.resize(swapChain.imageCount);
+    if(!pipeline->createPipeline()){
+        fprintf(stderr, "Failed creating pipeline %zu!\n", index);
+        return false;
+    }
+    return true;
+}
+
+bool createPipelines(){
+    if(context->pipelineCreationThreadCount == 1 || context->pipelines.size() < 2){
+        bool success = true;
+        for(size_t i = 0; i < context->pipelines.size(); i++){
+            success = createPipeline(i) && success;
+        }
+        return success;
+    }
     
-    VkImageViewCreateInfo imageViewInfo;
-    imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    imageViewInfo.pNext = nullptr;
-    imageViewInfo.flags = 0;    
-    imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    imageViewInfo.format = swapChain.surfaceFormat.format;
-    imageViewInfo.components = {
-        VK_COMPONENT_SWIZZLE_IDENTITY,
-        VK_COMPONENT_SWIZZLE_IDENTITY,
-        VK_COMPONENT_SWIZZLE_IDENTITY,
-        VK_COMPONENT_SWIZZLE_IDENTITY
-    };
-    imageViewInfo.subresourceRange = {
-        VK_IMAGE_ASPECT_COLOR_BIT,
-        0,
-        1,
-        0,
-        1
-    };
+    //pipelines are independent, compile them concurrently. The pipeline cache
+    //is internally synchronised, so every thread can share it
+    std::vector<char> created(context->pipelines.size(), false);
+    SME::ThreadPool threadPool(context->pipelineCreationThreadCount);
+    SME::Render::Context* owner = context;
+    threadPool.run(static_cast<uint32_t>(context->pipelines.size()), [&created, owner](uint32_t task, uint32_t thread){
+        context = owner;
+        created[task] = createPipeline(task);
+    });
     
-    for(size_t i = 0; i < swapChain.imageCount; i++){
-        imageViewInfo.image = swapChain.images[i];
-        
-        result = vkCreateImageView(device, &imageViewInfo, nullptr, &swapChain.imageViews[i]);
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "Failed creating image view: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-            return false;
+    size_t failed = 0;
+    for(char success : created){
+        if(!success){
+            failed++;
         }
     }
-    
+    if(failed > 0){
+        fprintf(stderr, "Failed creating %zu of %zu pipelines!\n", failed, context->pipelines.size());
+        return false;
+    }
     return true;
 }
 
 bool SME::Render::init(const char* applicationName, uint32_t applicationVersion){
+    context->initStart = std::chrono::high_resolution_clock::now();
+    
+    if(context != &defaultContext && !context->headless){
+        fprintf(stderr, "Only the default context can render to the window, call setHeadless first!\n");
+        return false;
+    }
+    
     //==========================Create Instance===============================//
     VkApplicationInfo appInfo;
     VkInstanceCreateInfo instanceInfo;
@@ -377,19 +1630,34 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
     instanceInfo.enabledLayerCount = 0;
     instanceInfo.ppEnabledLayerNames = NULL;
     
-    std::vector<const char *> enabledExtensions {
-        VK_KHR_SURFACE_EXTENSION_NAME,
-        #if defined(_WIN32)
-        VK_KHR_WIN32_SURFACE_EXTENSION_NAME
-        #elif defined(__linux__)
-        VK_KHR_XCB_SURFACE_EXTENSION_NAME
-        #endif
-    };
+    std::vector<const char *> enabledExtensions;
+    if(!context->headless){
+        enabledExtensions = {
+            VK_KHR_SURFACE_EXTENSION_NAME,
+            #if defined(_WIN32)
+            VK_KHR_WIN32_SURFACE_EXTENSION_NAME
+            #elif defined(__linux__)
+            VK_KHR_XCB_SURFACE_EXTENSION_NAME
+            #endif
+        };
+    }
+    
+    //needed to query VK_EXT_memory_budget, optional
+    uint32_t instanceExtensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, nullptr);
+    std::vector<VkExtensionProperties> instanceExtensions(instanceExtensionCount);
+    if(instanceExtensionCount > 0){
+        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, &instanceExtensions[0]);
+    }
+    bool physicalDeviceProperties2 = SME::VkUtil::checkExtensionAvailabile(instanceExtensions, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if(physicalDeviceProperties2){
+        enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
     
     instanceInfo.enabledExtensionCount = enabledExtensions.size();
-    instanceInfo.ppEnabledExtensionNames = &enabledExtensions[0];
+    instanceInfo.ppEnabledExtensionNames = enabledExtensions.empty() ? nullptr : &enabledExtensions[0];
     
-    VkResult result = vkCreateInstance(&instanceInfo, NULL, &instance);
+    VkResult result = vkCreateInstance(&instanceInfo, NULL, &context->instance);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed to create instance: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
@@ -397,30 +1665,35 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
     
     //========================Acquire drawable surface========================//
     
-    #if defined(_WIN32)
-        VkWin32SurfaceCreateInfoKHR surfaceCreateInfo;
-        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-        surfaceCreateInfo.hinstance = SME::Window::hInstance; 
-        surfaceCreateInfo.hwnd = SME::Window::hwnd;           
-        result = vkCreateWin32SurfaceKHR(instance, &surfaceCreateInfo, NULL, &surface);
-    #elif defined(__linux__)
-        VkXcbSurfaceCreateInfoKHR surfaceCreateInfo;
-        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR;
-        surfaceCreateInfo.connection = SME::Window::connection;
-        surfaceCreateInfo.window = SME::Window::window;
-        result = vkCreateXcbSurfaceKHR(instance, &surfaceCreateInfo, NULL, &surface);
-    #endif
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create Vulkan surface: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-        return false;
+    if(!context->headless){
+        #if defined(_WIN32)
+            VkWin32SurfaceCreateInfoKHR surfaceCreateInfo;
+            surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+            surfaceCreateInfo.hinstance = SME::Window::hInstance; 
+            surfaceCreateInfo.hwnd = SME::Window::hwnd;           
+            result = vkCreateWin32SurfaceKHR(context->instance, &surfaceCreateInfo, NULL, &context->surface);
+        #elif defined(__linux__)
+            VkXcbSurfaceCreateInfoKHR surfaceCreateInfo;
+            surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR;
+            surfaceCreateInfo.connection = SME::Window::connection;
+            surfaceCreateInfo.window = SME::Window::window;
+            result = vkCreateXcbSurfaceKHR(context->instance, &surfaceCreateInfo, NULL, &context->surface);
+        #endif
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create Vulkan surface: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
     }
         
     //========================Get Physical Devices============================//
     
-    std::vector<const char *> requiredExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    std::vector<const char *> requiredExtensions;
+    if(!context->headless){
+        requiredExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
     
     uint32_t deviceCount = 0;
-    result = vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
+    result = vkEnumeratePhysicalDevices(context->instance, &deviceCount, NULL);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed to query the number of physical devices present: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
@@ -438,7 +1711,7 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
 
     // Get the physical devices
     std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
-    result = vkEnumeratePhysicalDevices(instance, &deviceCount, &physicalDevices[0]);
+    result = vkEnumeratePhysicalDevices(context->instance, &deviceCount, &physicalDevices[0]);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed to enumerate physical devices present: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
@@ -446,10 +1719,16 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
     
     //queue family index to be passed to the buffer code
     uint32_t transferQueueFamilyIndex = UINT32_MAX;
+    bool transferOnlyFamily = false;
+    
+    bool memoryBudget = false;
     
     //Enumerate all physical devices and check for their properties
     //Automatically chooses the device that fulfills the requirements
     for (uint32_t physicalDeviceIndex = 0; physicalDeviceIndex < deviceCount; physicalDeviceIndex++) {
+        if(context->physicalDeviceIndex != UINT32_MAX && physicalDeviceIndex != context->physicalDeviceIndex){
+            continue;
+        }
         VkPhysicalDevice currentPhysicalDevice = physicalDevices[physicalDeviceIndex];
         
         #ifdef DEBUG
@@ -530,39 +1809,49 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
             fprintf(stdout, "--------------------------------------------------\n");
             #endif
             VkBool32 supportsPresentation = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(currentPhysicalDevice, queueFamilyIndex, surface, &supportsPresentation);
+            if(!context->headless){
+                vkGetPhysicalDeviceSurfaceSupportKHR(currentPhysicalDevice, queueFamilyIndex, context->surface, &supportsPresentation);
+            }
 
-            if(presentQueueFamilyIndex == UINT32_MAX && supportsPresentation){
-                presentQueueFamilyIndex = queueFamilyIndex;
+            if(context->presentQueueFamilyIndex == UINT32_MAX && supportsPresentation){
+                context->presentQueueFamilyIndex = queueFamilyIndex;
             }
             
             if(familyProperties[queueFamilyIndex].queueCount > 0 && familyProperties[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT){
-                if(graphicsQueueFamilyIndex == UINT32_MAX){
-                    graphicsQueueFamilyIndex = queueFamilyIndex;
+                if(context->graphicsQueueFamilyIndex == UINT32_MAX){
+                    context->graphicsQueueFamilyIndex = queueFamilyIndex;
                     if(familyProperties[queueFamilyIndex].queueFlags & VK_QUEUE_TRANSFER_BIT){
                         canUseGraphicsQueue = true;
                     }
                 }
             }
             
-            //use a different queue family if possible
-            if(familyProperties[queueFamilyIndex].queueFlags & VK_QUEUE_TRANSFER_BIT && queueFamilyIndex != graphicsQueueFamilyIndex){
-                if(transferQueueFamilyIndex == UINT32_MAX){
-                    transferQueueFamilyIndex = queueFamilyIndex;    
+            //uploads overlap rendering on a family without graphics, preferably
+            //a transfer only one, which maps to the copy engines
+            VkQueueFlags queueFlags = familyProperties[queueFamilyIndex].queueFlags;
+            if(familyProperties[queueFamilyIndex].queueCount > 0 && (queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFlags & VK_QUEUE_GRAPHICS_BIT)){
+                if(transferQueueFamilyIndex == UINT32_MAX || (!(queueFlags & VK_QUEUE_COMPUTE_BIT) && !transferOnlyFamily)){
+                    transferQueueFamilyIndex = queueFamilyIndex;
+                    transferOnlyFamily = !(queueFlags & VK_QUEUE_COMPUTE_BIT);
                 }
             }
         }
         
         //couldn't use a different family, use the same queue as the graphics
         if(transferQueueFamilyIndex == UINT32_MAX && canUseGraphicsQueue){
-            transferQueueFamilyIndex = graphicsQueueFamilyIndex;
+            transferQueueFamilyIndex = context->graphicsQueueFamilyIndex;
         }
         
-        if(graphicsQueueFamilyIndex == UINT32_MAX){
+        //nothing gets presented, the graphics queue stands in for the present queue
+        if(context->headless){
+            context->presentQueueFamilyIndex = context->graphicsQueueFamilyIndex;
+        }
+        
+        if(context->graphicsQueueFamilyIndex == UINT32_MAX){
             #ifdef DEBUG
             fprintf(stdout, "Device %u is missing a graphics capable queue, skipping\n", physicalDeviceIndex);
             #endif
-        } else if(presentQueueFamilyIndex == UINT32_MAX){
+        } else if(context->presentQueueFamilyIndex == UINT32_MAX){
             #ifdef DEBUG
             fprintf(stdout, "Device %u is missing a present capable queue, skipping\n", physicalDeviceIndex);
             #endif
@@ -572,19 +1861,31 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
                     "\tGraphics queue family: %u\n"
                     "\tPresentation queue family: %u\n"
                     "\tTransfer queue family: %u\n",
-                    physicalDeviceIndex, graphicsQueueFamilyIndex, presentQueueFamilyIndex, transferQueueFamilyIndex);
+                    physicalDeviceIndex, context->graphicsQueueFamilyIndex, context->presentQueueFamilyIndex, transferQueueFamilyIndex);
             fprintf(stdout, "==================================================\n");
             #endif
-            physicalDevice = currentPhysicalDevice;
+            context->physicalDevice = currentPhysicalDevice;
+            memoryBudget = physicalDeviceProperties2 && SME::VkUtil::checkExtensionAvailabile(availableExtensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
             break;
         }        
     }
     
-    if(physicalDevice == 0){
+    if(context->physicalDevice == 0){
         fprintf(stderr, "No compatible physical device found!");
         return false;
     }
     
+    //gpu frame timing support
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(context->physicalDevice, &physicalDeviceProperties);
+    context->timestampPeriod = physicalDeviceProperties.limits.timestampPeriod;
+    
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, NULL);
+    std::vector<VkQueueFamilyProperties> selectedFamilyProperties(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, &selectedFamilyProperties[0]);
+    context->timestampValidBits = selectedFamilyProperties[context->graphicsQueueFamilyIndex].timestampValidBits;
+    
     //=========================Create logical device==========================//
       
     VkDeviceCreateInfo deviceInfo;
@@ -593,10 +1894,13 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
     deviceInfo.flags = 0;
 
     //Set enabled extensions or layers
+    if(memoryBudget){
+        requiredExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
     deviceInfo.enabledLayerCount = 0;
     deviceInfo.ppEnabledLayerNames = NULL; //No enabled layers
     deviceInfo.enabledExtensionCount = requiredExtensions.size();
-    deviceInfo.ppEnabledExtensionNames = &requiredExtensions[0];
+    deviceInfo.ppEnabledExtensionNames = requiredExtensions.empty() ? nullptr : &requiredExtensions[0];
     deviceInfo.pEnabledFeatures = NULL; //No enabled features
     
     std::vector<VkDeviceQueueCreateInfo> queueCreationInfos;
@@ -606,23 +1910,23 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
         VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,     //sType
         nullptr,                                        //pNext
         0,                                              //flags
-        graphicsQueueFamilyIndex,                       //queueFamilyIndex
+        context->graphicsQueueFamilyIndex,                       //queueFamilyIndex
         static_cast<uint32_t>(queuePriorities.size()),  //queueCount
         &queuePriorities[0]                             //pQueuePriorities
     });
     
-    if(graphicsQueueFamilyIndex != presentQueueFamilyIndex){
+    if(context->graphicsQueueFamilyIndex != context->presentQueueFamilyIndex){
         queueCreationInfos.push_back({
             VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,     //sType
             nullptr,                                        //pNext
             0,                                              //flags
-            presentQueueFamilyIndex,                   //queueFamilyIndex
+            context->presentQueueFamilyIndex,                   //queueFamilyIndex
             static_cast<uint32_t>(queuePriorities.size()),  //queueCount
             &queuePriorities[0]                             //pQueuePriorities
         });
     }
     
-    if(graphicsQueueFamilyIndex != transferQueueFamilyIndex){
+    if(context->graphicsQueueFamilyIndex != transferQueueFamilyIndex){
         queueCreationInfos.push_back({
             VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,     //sType
             nullptr,                                        //pNext
@@ -637,7 +1941,7 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
     deviceInfo.queueCreateInfoCount = queueCreationInfos.size();
     deviceInfo.pQueueCreateInfos = &queueCreationInfos[0];
     
-    result = vkCreateDevice(physicalDevice, &deviceInfo, NULL, &device);
+    result = vkCreateDevice(context->physicalDevice, &deviceInfo, NULL, &context->device);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed creating logical device: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
@@ -645,74 +1949,93 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
         
     //=============================Create Queues==============================//
     
-    vkGetDeviceQueue(device, graphicsQueueFamilyIndex, 0, &graphicsQueue);    
-    vkGetDeviceQueue(device, presentQueueFamilyIndex, 0, &presentQueue);
+    vkGetDeviceQueue(context->device, context->graphicsQueueFamilyIndex, 0, &context->graphicsQueue);    
+    vkGetDeviceQueue(context->device, context->presentQueueFamilyIndex, 0, &context->presentQueue);
+    
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+    if(memoryBudget){
+        getMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(vkGetInstanceProcAddr(context->instance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
+    SME::Memory::initAllocator(context->device, context->physicalDevice, getMemoryProperties2);
     
-    if(!SME::Buffer::initTransferBuffer(transferQueueFamilyIndex, device, physicalDevice)){
+    if(!SME::Buffer::initTransferBuffer(transferQueueFamilyIndex, context->graphicsQueueFamilyIndex, context->device, context->physicalDevice)){
         fprintf(stderr, "Couldn't initialise transfer buffer.\n");
         return false;
     }
+    context->bufferPool = new SME::BufferPool(context->device, context->physicalDevice);
+    context->frameGraph = new SME::FrameGraph(context->graphicsQueueFamilyIndex);
+    
+    if(!createPipelineCache()){
+        return false;
+    }
     
-    //============================Create Semaphore============================//
+    //=====================Create Semaphores and Fences=======================//
         
     VkSemaphoreCreateInfo semaphoreInfo;
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
     semaphoreInfo.pNext = nullptr;
     semaphoreInfo.flags = 0;
     
-    result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed creating image available semaphore: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-        return false;
-    }
+    VkFenceCreateInfo fenceInfo = {
+        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,    //sType
+        nullptr,                                //pNext
+        VK_FENCE_CREATE_SIGNALED_BIT            //flags, so the first wait returns immediately
+    };
     
-    result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderingFinishedSemaphore);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed creating rendering finished semaphore: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-        return false;
+    context->imageAvailableSemaphores.resize(context->framesInFlight, VK_NULL_HANDLE);
+    context->renderingFinishedSemaphores.resize(context->framesInFlight, VK_NULL_HANDLE);
+    context->inFlightFences.resize(context->framesInFlight, VK_NULL_HANDLE);
+    
+    for(uint32_t i = 0; i < context->framesInFlight; i++){
+        result = vkCreateSemaphore(context->device, &semaphoreInfo, nullptr, &context->imageAvailableSemaphores[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating image available semaphore: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+
+        result = vkCreateSemaphore(context->device, &semaphoreInfo, nullptr, &context->renderingFinishedSemaphores[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating rendering finished semaphore: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
+        
+        result = vkCreateFence(context->device, &fenceInfo, nullptr, &context->inFlightFences[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed creating in flight fence: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+            return false;
+        }
     }
     
     //==========================Create Swapchain==============================//
     
-    if(!createSwapchain()){
+    if(context->headless){
+        if(!createOffscreenTargets()){
+            fprintf(stderr, "Couldn't create offscreen render targets!\n");
+            return false;
+        }
+    } else if(!createSwapchain()){
         fprintf(stderr, "Couldn't create swap chain!\n");
         return false;
     }
     
+    context->imagesInFlight.resize(context->swapChain.imageCount, VK_NULL_HANDLE);
+    
+    //contents are cleared every frame, and left ready for presenting or copying out
+    context->swapChainResource = context->frameGraph->addImage(context->swapChain.images, VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, context->swapChain.imageLayout, true);
+    if(!context->headless){
+        context->frameGraph->setExternal(context->swapChainResource, context->presentQueueFamilyIndex, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    }
+    
     //======================Start creating pipeline===========================//
     
-    VkFramebufferCreateInfo framebufferInfo;
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.pNext = nullptr;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.width = SME::Window::getWidth();
-    framebufferInfo.height = SME::Window::getHeight();
-    framebufferInfo.layers = 1;
+    if(!createPipelines()){
+        return false;
+    }
     
-    for(Pipeline* pipeline : pipelines){
-        if(!pipeline->createRenderPass()){
-            fprintf(stderr, "Failed creating pipeline render pass!\n");
-            return false;
-        }
-        
-        for(size_t i = 0; i < swapChain.imageCount; i++){
-            framebufferInfo.renderPass = pipeline->getRenderPass();
-            framebufferInfo.pAttachments = &swapChain.imageViews[i];
-
-            VkFramebuffer framebuffer;
-            result = vkCreateFramebuffer(SME::Render::getLogicalDevice(), &framebufferInfo, nullptr, &framebuffer);
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "Failed creating framebuffer: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-                return false;
-            } else {
-                pipeline->attachFramebuffer(framebuffer);
-            }
-        }
-        
-        if(!pipeline->createPipeline()){
-            fprintf(stderr, "Failed creating pipeline!\n");
-            return false;
-        }
+    if(!context->frameGraph->compile(context->pipelines)){
+        fprintf(stderr, "Couldn't compile the frame graph!\n");
+        return false;
     }
     
     //=========================Create command buffers=========================//
@@ -720,140 +2043,181 @@ bool SME::Render::init(const char* applicationName, uint32_t applicationVersion)
     VkCommandPoolCreateInfo gfxCmdPoolInfo = {
         VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
         nullptr,
-        0,
-        graphicsQueueFamilyIndex
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, //frame command buffers get rerecorded
+        context->graphicsQueueFamilyIndex
     };
     
-    result = vkCreateCommandPool(device, &gfxCmdPoolInfo, nullptr, &graphicsQueueCmdPool);
+    result = vkCreateCommandPool(context->device, &gfxCmdPoolInfo, nullptr, &context->graphicsQueueCmdPool);
     if (result != VK_SUCCESS) {
         fprintf(stderr, "Failed creating graphics command pool: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
     
-    graphicsCommandBuffers.resize(swapChain.imageCount, VK_NULL_HANDLE);
+    context->uploadCommandBuffers.resize(context->framesInFlight, VK_NULL_HANDLE);
     
-    VkCommandBufferAllocateInfo cmdBufferAllocateInfo;    
-    cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    cmdBufferAllocateInfo.pNext = nullptr;
-    cmdBufferAllocateInfo.commandPool = graphicsQueueCmdPool;
-    cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    cmdBufferAllocateInfo.commandBufferCount = swapChain.imageCount;
+    VkCommandBufferAllocateInfo uploadCmdBufferAllocateInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, //sType
+        nullptr,                                        //pNext
+        context->graphicsQueueCmdPool,                  //commandPool
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY,                //level
+        context->framesInFlight                         //commandBufferCount
+    };
     
-    result = vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &graphicsCommandBuffers[0]);
+    result = vkAllocateCommandBuffers(context->device, &uploadCmdBufferAllocateInfo, &context->uploadCommandBuffers[0]);
     if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed allocating graphics command buffers: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
+        fprintf(stderr, "Failed allocating upload command buffers: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
         return false;
     }
-        
-    //===============Record command buffers description=======================//
     
-    VkCommandBufferBeginInfo graphicsCmdBufferBeginInfo;
-    graphicsCmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    graphicsCmdBufferBeginInfo.pNext = nullptr;
-    graphicsCmdBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-    graphicsCmdBufferBeginInfo.pInheritanceInfo = nullptr;
+    if(context->uniformRingSize > 0 && !createUniformRing()){
+        return false;
+    }
     
-    VkImageSubresourceRange imageSubresourceRange;
-    imageSubresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageSubresourceRange.baseMipLevel = 0;
-    imageSubresourceRange.levelCount = 1;
-    imageSubresourceRange.baseArrayLayer = 0;
-    imageSubresourceRange.layerCount = 1;
-        
-    for(size_t i = 0; i < swapChain.imageCount; i++){
-        vkBeginCommandBuffer(graphicsCommandBuffers[i], &graphicsCmdBufferBeginInfo);
-
-        if(presentQueue != graphicsQueue){
-            VkImageMemoryBarrier barrierFromPresentToDraw = {
-                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,     // sType
-                nullptr,                                    // *pNext
-                VK_ACCESS_MEMORY_READ_BIT,                  // srcAccessMask
-                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,       // dstAccessMask
-                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,            // oldLayout
-                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,            // newLayout
-                presentQueueFamilyIndex,                    // srcQueueFamilyIndex
-                graphicsQueueFamilyIndex,                   // dstQueueFamilyIndex
-                swapChain.images[i],                        // image
-                imageSubresourceRange                       // subresourceRange
-            };
-
-            vkCmdPipelineBarrier( graphicsCommandBuffers[i],
-                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0,
-                nullptr, 1, &barrierFromPresentToDraw );
-        }
-        
-        for(Pipeline* pipeline : pipelines){
-            pipeline->recordCommandBuffers(graphicsCommandBuffers[i], i);
-        }
-        
-        if(presentQueue != graphicsQueue) {
-            VkImageMemoryBarrier barrierFromDrawToPresent = {
-                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,         // sType
-                nullptr,                                        // *pNext
-                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,           // srcAccessMask
-                VK_ACCESS_MEMORY_READ_BIT,                      // dstAccessMask
-                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,                // oldLayout
-                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,                // newLayout
-                graphicsQueueFamilyIndex,                       // srcQueueFamilyIndex
-                presentQueueFamilyIndex,                        // dstQueueFamilyIndex
-                swapChain.images[i],                            // image
-                imageSubresourceRange                           // subresourceRange
-            };
-            vkCmdPipelineBarrier( graphicsCommandBuffers[i],
-                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
-                1, &barrierFromDrawToPresent);
-        }
-
-        result = vkEndCommandBuffer(graphicsCommandBuffers[i]);
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "Could not record graphics command buffers: %d (%s)\n", result, SME::VkUtil::translateVkResult(result));
-            return false;
-        }
+    if(context->recordingThreadCount > 0 && !createRecordingResources()){
+        return false;
+    }
+    
+    if(!createTimestampQueryPools()){
+        return false;
+    }
+    
+    if(!recordCommandBuffers()){
+        return false;
     }
     
     //=============================Add Hooks==================================//
     
-    SME::Core::addLoopRenderHook(render);
-    SME::Core::addCleanupHook(cleanup);
+    //headless frames are only rendered when submitFrame is called, and other
+    //contexts are cleaned up by destroyContext
+    if(context == &defaultContext){
+        if(!context->headless){
+            SME::Core::addLoopRenderHook(render);
+        }
+        SME::Core::addCleanupHook(cleanup);
+    }
     
     return true;
 }
 
 void SME::Render::cleanup(){
-    if(device != VK_NULL_HANDLE){
-        vkDeviceWaitIdle(device);
+    if(context->device != VK_NULL_HANDLE){
+        vkDeviceWaitIdle(context->device);
+        publishPendingFrameTimings();
+        
+        #ifdef DEBUG
+        SME::Memory::printStatistics(context->device);
+        #endif
         
-        for(std::vector<SME::Pipeline*>::iterator it = pipelines.begin(); it != pipelines.end(); ++it){
+        for(std::vector<SME::Pipeline*>::iterator it = context->pipelines.begin(); it != context->pipelines.end(); ++it){
             delete (*it);
         }
+        context->pipelines.clear();
+        
+        if(context->pipelineCache != VK_NULL_HANDLE){
+            savePipelineCache();
+            vkDestroyPipelineCache(context->device, context->pipelineCache, nullptr);
+            context->pipelineCache = VK_NULL_HANDLE;
+        }
+        
+        if(context->graphicsCommandBuffers.size() > 0 && context->graphicsCommandBuffers[0] != VK_NULL_HANDLE){
+            vkFreeCommandBuffers(context->device, context->graphicsQueueCmdPool, static_cast<uint32_t>(context->graphicsCommandBuffers.size()), &context->graphicsCommandBuffers[0]);
+            context->graphicsCommandBuffers.clear();
+        }
+
+        if(context->recordingThreadPool != nullptr){
+            delete context->recordingThreadPool;
+            context->recordingThreadPool = nullptr;
+        }
+        
+        for(SecondaryCommandPool &pool : context->secondaryCommandPools){
+            if(pool.handle != VK_NULL_HANDLE){
+                vkDestroyCommandPool(context->device, pool.handle, nullptr);
+            }
+        }
+        context->secondaryCommandPools.clear();
+        
+        if(context->frameCommandBuffers.size() > 0 && context->frameCommandBuffers[0] != VK_NULL_HANDLE){
+            vkFreeCommandBuffers(context->device, context->graphicsQueueCmdPool, static_cast<uint32_t>(context->frameCommandBuffers.size()), &context->frameCommandBuffers[0]);
+        }
+        context->frameCommandBuffers.clear();
         
-        if(graphicsCommandBuffers.size() > 0 && graphicsCommandBuffers[0] != VK_NULL_HANDLE){
-            vkFreeCommandBuffers(device, graphicsQueueCmdPool, static_cast<uint32_t>(graphicsCommandBuffers.size()), &graphicsCommandBuffers[0]);
-            graphicsCommandBuffers.clear();
+        if(context->uploadCommandBuffers.size() > 0 && context->uploadCommandBuffers[0] != VK_NULL_HANDLE){
+            vkFreeCommandBuffers(context->device, context->graphicsQueueCmdPool, static_cast<uint32_t>(context->uploadCommandBuffers.size()), &context->uploadCommandBuffers[0]);
         }
+        context->uploadCommandBuffers.clear();
 
-        if(graphicsQueueCmdPool != VK_NULL_HANDLE){
-            vkDestroyCommandPool(device, graphicsQueueCmdPool, nullptr);
-            graphicsQueueCmdPool = VK_NULL_HANDLE;
+        if(context->graphicsQueueCmdPool != VK_NULL_HANDLE){
+            vkDestroyCommandPool(context->device, context->graphicsQueueCmdPool, nullptr);
+            context->graphicsQueueCmdPool = VK_NULL_HANDLE;
         }
 
-        if(imageAvailableSemaphore != VK_NULL_HANDLE){
-            vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
+        for(VkSemaphore semaphore : context->imageAvailableSemaphores){
+            if(semaphore != VK_NULL_HANDLE){
+                vkDestroySemaphore(context->device, semaphore, nullptr);
+            }
         }
+        context->imageAvailableSemaphores.clear();
 
-        if(renderingFinishedSemaphore != VK_NULL_HANDLE){
-            vkDestroySemaphore(device, renderingFinishedSemaphore, nullptr);
+        for(VkSemaphore semaphore : context->renderingFinishedSemaphores){
+            if(semaphore != VK_NULL_HANDLE){
+                vkDestroySemaphore(context->device, semaphore, nullptr);
+            }
+        }
+        context->renderingFinishedSemaphores.clear();
+        
+        for(VkFence fence : context->inFlightFences){
+            if(fence != VK_NULL_HANDLE){
+                vkDestroyFence(context->device, fence, nullptr);
+            }
+        }
+        context->inFlightFences.clear();
+        context->imagesInFlight.clear();
+        
+        destroyTimestampQueryPools();
+        destroyUniformRing();
+        
+        for(VkImageView imageView : context->swapChain.imageViews){
+            vkDestroyImageView(context->device, imageView, nullptr);
+        }
+        context->swapChain.imageViews.clear();
+        
+        if(context->swapChain.handle != VK_NULL_HANDLE){
+            vkDestroySwapchainKHR(context->device, context->swapChain.handle, nullptr);
+            context->swapChain.handle = VK_NULL_HANDLE;
+        }
+        
+        //offscreen images are owned by the renderer, unlike swap chain ones
+        if(context->headless){
+            for(VkImage image : context->swapChain.images){
+                if(image != VK_NULL_HANDLE){
+                    vkDestroyImage(context->device, image, nullptr);
+                }
+            }
+            for(SME::Memory::Allocation &allocation : context->offscreenImageMemory){
+                SME::Memory::release(context->device, &allocation);
+            }
+            context->offscreenImageMemory.clear();
         }
-        vkDestroyDevice(device, nullptr);
+        context->swapChain.images.clear();
+        
+        delete context->frameGraph;
+        context->frameGraph = nullptr;
+        delete context->bufferPool;
+        context->bufferPool = nullptr;
+        SME::Buffer::destroyTransferBuffer(context->device);
+        SME::Memory::destroyAllocator(context->device);
+        
+        vkDestroyDevice(context->device, nullptr);
+        context->device = VK_NULL_HANDLE;
     }
     
-    if(surface != VK_NULL_HANDLE){
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+    if(context->surface != VK_NULL_HANDLE){
+        vkDestroySurfaceKHR(context->instance, context->surface, nullptr);
+        context->surface = VK_NULL_HANDLE;
     }
     
-    if(instance != VK_NULL_HANDLE){
-        vkDestroyInstance(instance, NULL);
+    if(context->instance != VK_NULL_HANDLE){
+        vkDestroyInstance(context->instance, NULL);
+        context->instance = VK_NULL_HANDLE;
     }
 }
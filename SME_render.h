@@ -11,15 +11,77 @@
 #include <vector>
 
 #include "SME_pipeline.h"
+#include "SME_buffer.h"
+#include "SME_framegraph.h"
+#include "SME_timing.h"
+
+#ifndef SME_FRAMES_IN_FLIGHT
+#define SME_FRAMES_IN_FLIGHT 2 //frames the cpu can prepare ahead of the gpu by default
+#endif
+
+#ifndef SME_PRESENT_POLICY
+#ifdef BENCHMARK
+#define SME_PRESENT_POLICY SME::Render::PRESENT_POLICY_UNCAPPED
+#else
+#define SME_PRESENT_POLICY SME::Render::PRESENT_POLICY_LOW_LATENCY
+#endif
+#endif
+
+#ifndef SME_SWAPCHAIN_IMAGES
+#define SME_SWAPCHAIN_IMAGES 0 //one more than the surface minimum by default
+#endif
+
+#ifndef SME_PIPELINE_CREATION_THREADS
+#define SME_PIPELINE_CREATION_THREADS 0 //pipelines are created on one thread per core by default
+#endif
+
+#ifndef SME_PIPELINE_CACHE_PATH
+#define SME_PIPELINE_CACHE_PATH "pipeline_cache" //default cache file, the vendor and device IDs are appended
+#endif
+
+#ifndef SME_RECORDING_THREADS
+#define SME_RECORDING_THREADS 0 //command buffers are prerecorded on the main thread by default
+#endif
+
+#ifndef SME_DEFRAGMENTATION_BUDGET
+#define SME_DEFRAGMENTATION_BUDGET 0.0 //microseconds per frame spent moving buffers, disabled by default
+#endif
+
+#ifndef SME_UNIFORM_RING_SIZE
+#define SME_UNIFORM_RING_SIZE (1024 * 1024) //bytes of uniform data each frame in flight can allocate
+#endif
+
+#ifndef SME_UNIFORM_RANGE
+#define SME_UNIFORM_RANGE 16384 //largest uniform block reachable through the dynamic descriptor
+#endif
 
 namespace SME { namespace Render {
     
+    /**
+     * Holds everything a renderer owns: instance, device, queues, swap chain
+     * or offscreen targets, pipelines and settings. Every function in this
+     * namespace operates on the calling thread's current context.
+     */
+    struct Context;
+    
+    /**
+     * How presented images are paced. When the preferred present modes aren't
+     * supported by the surface, FIFO is used.
+     */
+    enum PresentPolicy {
+        PRESENT_POLICY_LOW_LATENCY,     //MAILBOX: newest frame shown at vblank, no tearing
+        PRESENT_POLICY_UNCAPPED,        //IMMEDIATE, then MAILBOX: no frame rate cap, may tear
+        PRESENT_POLICY_POWER_SAVING     //FIFO: capped to the refresh rate, the CPU sleeps in between
+    };
+    
     struct SwapChain {
         VkSwapchainKHR handle;
         VkSurfaceFormatKHR surfaceFormat;
         std::vector<VkImage> images;
         std::vector<VkImageView> imageViews;
         uint32_t imageCount;
+        VkExtent2D extent;
+        VkImageLayout imageLayout; //layout the images must be left in after rendering
     };
     
     /**
@@ -31,6 +93,47 @@ namespace SME { namespace Render {
      */
     bool init(const char* applicationName, uint32_t applicationVersion);
     
+    /**
+     * Makes the renderer run without a window, surface or swap chain. Frames
+     * are rendered into device local images, described by getSwapChain, and
+     * only when submitFrame is called. Useful on machines without a display.
+     * Must be called before init.
+     * @param width width of the offscreen images
+     * @param height height of the offscreen images
+     * @param imageCount amount of offscreen images to cycle through, 0 to use
+     * one per frame in flight
+     */
+    void setHeadless(uint32_t width, uint32_t height, uint32_t imageCount = 0);
+    
+    /**
+     * @return true if the renderer was set up to run without a window
+     */
+    bool isHeadless();
+    
+    /**
+     * Renders a single frame. In headless mode this is the only way frames
+     * get rendered, otherwise they are rendered automatically every loop.
+     * Returns as soon as the frame is submitted, call waitIdle before reading
+     * the resulting image.
+     * @return true if the frame was submitted, false if an error occurred
+     */
+    bool submitFrame();
+    
+    /**
+     * Returns the index, within getSwapChain().images, of the image the last
+     * submitted frame rendered to.
+     * @return the image index of the last frame
+     */
+    uint32_t getLastFrameImageIndex();
+    
+    /**
+     * Blocks until the GPU has finished all submitted work. Queues the
+     * timings of the frames still waiting for their image to come round,
+     * see pollFrameTiming.
+     * @return true on success, false if an error occurred
+     */
+    bool waitIdle();
+    
     /**
      * Adds a pipeline to the renderer system
      * @param pipeline it has to be an object created with new, otherwise the
@@ -41,19 +144,68 @@ namespace SME { namespace Render {
     
     /*
      * Destroys the vulkan context and all pipelines associated with it
-     * Called automatically, however, can be called manually
+     * Called automatically for the default context, however, can be called
+     * manually
      */
     void cleanup();
     
     /**
-     * Returns the swap chain currently used for displaying images
+     * Returns the swap chain currently used for displaying images, or the
+     * offscreen images in headless mode
      * @return a structure containing the information of the swapchain
      */
     SwapChain getSwapChain();
     
+    /**
+     * Returns the size of the swap chain images. This can differ from the
+     * window size and changes whenever the swap chain is recreated after a
+     * resize, so pipelines should use it for their render areas and viewports.
+     * @return the extent of the current swap chain images
+     */
+    VkExtent2D getSwapChainExtent();
+    
+    /**
+     * Creates an independent renderer context, with its own logical device,
+     * queues, pipelines and offscreen targets. Make it current on a thread,
+     * call setHeadless and init, and that thread can render with it
+     * concurrently with other contexts. Only the default context, which every
+     * thread uses until another one is made current, can render to the window.
+     * Contexts on the same kind of device share the default pipeline cache
+     * file, the one destroyed last wins.
+     * @return the new context, uninitialised
+     */
+    Context* createContext();
+    
+    /**
+     * Cleans up and deletes a context created with createContext. Threads
+     * still using it must switch to another context first. The calling
+     * thread falls back to the default context if it was using this one.
+     * @param context the context to destroy
+     */
+    void destroyContext(Context* context);
+    
+    /**
+     * Sets the context every function of the renderer operates on, for the
+     * calling thread only
+     * @param context the context to use, null for the default context
+     */
+    void makeContextCurrent(Context* context);
+    
+    /**
+     * @return the context the calling thread operates on
+     */
+    Context* getCurrentContext();
+    
+    /**
+     * Selects the physical device to create the logical device on, for
+     * example to spread contexts across GPUs. Must be called before init.
+     * @param index the index of the device as enumerated by Vulkan, init
+     * fails if it isn't compatible. Defaults to the first compatible device
+     */
+    void setPhysicalDeviceIndex(uint32_t index);
+    
     /**
      * Returns the logical device used for all operations with Vulkan.
-     * TODO: multiple GPU support 
      * @return the logical device currently in use
      */
     VkDevice getLogicalDevice();
@@ -63,6 +215,245 @@ namespace SME { namespace Render {
      * @return the physical device that represents the logical device in use
      */
     VkPhysicalDevice getPhysicalDevice();
+    
+    /**
+     * Sets how many frames the CPU is allowed to prepare while the GPU is
+     * still executing previous ones. Each frame in flight owns its own
+     * semaphores and fence. Must be called before init.
+     * @param count the amount of frames in flight, at least 1. Defaults to
+     * SME_FRAMES_IN_FLIGHT
+     */
+    void setFramesInFlight(uint32_t count);
+    
+    /**
+     * Returns the amount of frames that can be in flight at the same time
+     * @return the frames in flight count
+     */
+    uint32_t getFramesInFlight();
+    
+    /**
+     * Sets the amount of worker threads used to record command buffers.
+     * With 0 threads the command buffers are recorded once per swap chain image
+     * on the calling thread. Otherwise they are rerecorded every frame: each
+     * pipeline (or each of its draw chunks) is recorded into a secondary
+     * command buffer by a worker thread with its own command pool, and the
+     * primary command buffer executes them. Must be called before init.
+     * @param threadCount the amount of recording threads, defaults to
+     * SME_RECORDING_THREADS
+     */
+    void setRecordingThreadCount(uint32_t threadCount);
+    
+    /**
+     * Sets the amount of worker threads used to create the pipelines added
+     * before init. Each pipeline's render pass, framebuffers and pipeline are
+     * created on one of the workers, so Pipeline implementations must be safe
+     * to create concurrently with each other. Must be called before init.
+     * @param threadCount the amount of threads, 0 for one per core or 1 to
+     * create them on the calling thread. Defaults to
+     * SME_PIPELINE_CREATION_THREADS
+     */
+    void setPipelineCreationThreadCount(uint32_t threadCount);
+    
+    /**
+     * Returns how long the CPU stalled waiting on fences during the last
+     * rendered frame. A value close to the frame time means the application is
+     * GPU bound.
+     * @return the time waited on fences, in microseconds
+     */
+    uint64_t getLastFenceWaitTime();
+    
+    /**
+     * Enables or disables frame timing collection. While enabled, the CPU time
+     * spent acquiring, recording, submitting and presenting each frame is
+     * measured, and GPU timestamps are written before and after every
+     * pipeline. Each frame's timings are queued once its GPU work completes.
+     * Enabled by default in BENCHMARK builds, and by setBenchmarkEnabled.
+     * @param enabled whether to collect frame timings
+     */
+    void setFrameTimingEnabled(bool enabled);
+    
+    /**
+     * Sets the file the pipeline cache is loaded from on init and written to
+     * on cleanup. The file records the device and driver it was created
+     * with, and is ignored if they don't match the current ones. It is
+     * written to a temporary file first and renamed over the old one. Must
+     * be called before init.
+     * @param path the cache file, or an empty string to never touch the disk.
+     * Defaults to SME_PIPELINE_CACHE_PATH followed by _vendor_device.bin, the
+     * IDs of the device in hex, relative to the working directory.
+     * Applications should rather give a path in their own data directory
+     */
+    void setPipelineCachePath(const char* path);
+    
+    /**
+     * Returns the pipeline cache owned by the renderer. Pipelines should pass
+     * it to vkCreateGraphicsPipelines so compiled pipelines are reused across
+     * runs.
+     * @return the pipeline cache
+     */
+    VkPipelineCache getPipelineCache();
+    
+    /**
+     * @return true if valid pipeline cache data was loaded from disk on init
+     */
+    bool isPipelineCacheWarm();
+    
+    /**
+     * Returns the time from the start of init until the first frame was
+     * submitted, which includes creating every pipeline added before it.
+     * Printed along with the pipeline cache state when the benchmark counters
+     * are enabled.
+     * @return the startup time in microseconds, negative if no frame was
+     * submitted yet
+     */
+    double getStartupTime();
+    
+    /**
+     * Sets how presented images are paced. Can be called before init or at
+     * any time afterwards, in which case the swap chain is rebuilt before the
+     * next frame. Ignored in headless mode.
+     * @param policy the present policy, defaults to SME_PRESENT_POLICY
+     */
+    void setPresentPolicy(PresentPolicy policy);
+    
+    /**
+     * @return the present policy currently requested
+     */
+    PresentPolicy getPresentPolicy();
+    
+    /**
+     * Returns the present mode the swap chain was actually created with, which
+     * depends on the present policy and on what the surface supports
+     * @return the present mode in use
+     */
+    VkPresentModeKHR getPresentMode();
+    
+    /**
+     * Sets the amount of images requested for the swap chain. The value is
+     * clamped to what the surface supports. Can be called before init or at
+     * any time afterwards, in which case the swap chain is rebuilt before the
+     * next frame. Ignored in headless mode, see setHeadless.
+     * @param count the amount of images, 0 for one more than the minimum the
+     * surface requires. Defaults to SME_SWAPCHAIN_IMAGES
+     */
+    void setSwapChainImageCount(uint32_t count);
+    
+    /**
+     * Enables or disables the benchmark counters. While enabled, the frame
+     * rate and frame time statistics are printed once per second, and frame
+     * timing is enabled. Since the statistics consume the frame timing queue,
+     * pollFrameTiming shouldn't be used at the same time. Enabled by default
+     * in BENCHMARK builds.
+     * @param enabled whether to print the benchmark counters
+     */
+    void setBenchmarkEnabled(bool enabled);
+    
+    /**
+     * @return true if the benchmark counters are being printed
+     */
+    bool isBenchmarkEnabled();
+    
+    /**
+     * Takes the oldest collected frame timing out of the queue. The queue holds
+     * SME_TIMING_HISTORY frames, newer ones are dropped if it isn't polled.
+     * A frame is queued once its GPU timestamps can be read, when its image
+     * is rendered to again or on waitIdle. Frames have no GPU times if the
+     * graphics queue doesn't support timestamps. Lock free, but only a single thread may poll at a time.
+     * @param timing where to store the timing
+     * @return true if a timing was available, false if the queue was empty
+     */
+    bool pollFrameTiming(SME::Timing::FrameTiming* timing);
+    
+    /**
+     * Takes every queued frame timing out and computes statistics of their CPU
+     * frame times and GPU times. Consumes the same queue as pollFrameTiming.
+     * @param cpuFrameTime where to store the CPU frame time statistics, can
+     * be null
+     * @param gpuFrameTime where to store the GPU time statistics, can be null
+     * @return true if there was at least one frame to compute statistics of
+     */
+    bool getFrameStatistics(SME::Timing::Statistics* cpuFrameTime, SME::Timing::Statistics* gpuFrameTime);
+    
+    /**
+     * Pool for buffers that only live for a frame or a few, such as per frame
+     * vertex or staging data. Released buffers are recycled once the frame
+     * they were released in is done.
+     * @return the pool of the current context, null before init
+     */
+    SME::BufferPool* getBufferPool();
+    
+    /**
+     * Sets how much CPU time each frame may spend starting to move device
+     * local vertex and index buffers out of sparse memory blocks, see
+     * SME::Buffer::defragment. When buffers were moved, prerecorded command
+     * buffers are recorded again after waiting for the device to be idle, so
+     * without recording threads the moves are swapped in batches of
+     * SME_DEFRAGMENT_BATCH_BYTES. Can be called at any time.
+     * @param microseconds the budget, 0 disables defragmentation
+     */
+    void setDefragmentationBudget(double microseconds);
+    
+    /**
+     * Sets how many bytes of uniform data can be allocated per frame in
+     * flight, 0 disables the uniform ring. Must be called before init.
+     * @param size the size of each frame's slice, defaults to
+     * SME_UNIFORM_RING_SIZE
+     */
+    void setUniformRingSize(VkDeviceSize size);
+    
+    /**
+     * Hands out space for a uniform block in the current frame's slice of the
+     * uniform ring, a single atomic add. The block is read by the shaders
+     * through getUniformDescriptorSet, bound with the returned dynamic offset.
+     * The space is reused once the same frame in flight comes round again,
+     * so it must be written while recording the frame's command buffers,
+     * which requires rerecording every frame (see setRecordingThreadCount).
+     * Safe to call from the recording threads.
+     * @param size size of the block, at most getUniformRange bytes
+     * @param data where to store the host address to write the block to
+     * @param dynamicOffset where to store the offset to pass to
+     * vkCmdBindDescriptorSets
+     * @return false if the ring is disabled, the block is too big or the
+     * frame's slice is full
+     */
+    bool allocateUniforms(VkDeviceSize size, void** data, uint32_t* dynamicOffset);
+    
+    /**
+     * Layout with a single UNIFORM_BUFFER_DYNAMIC binding at 0, visible to all
+     * graphics stages. Pipelines reading ring uniforms include it in their
+     * pipeline layout.
+     * @return the layout, or VK_NULL_HANDLE if the uniform ring is disabled
+     */
+    VkDescriptorSetLayout getUniformDescriptorSetLayout();
+    
+    /**
+     * The only descriptor set ever needed for ring uniforms, it covers the
+     * whole ring and the dynamic offset selects the block.
+     * @return the descriptor set, or VK_NULL_HANDLE if the uniform ring is
+     * disabled
+     */
+    VkDescriptorSet getUniformDescriptorSet();
+    
+    /**
+     * @return the range of the uniform descriptor, the biggest block
+     * allocateUniforms hands out
+     */
+    VkDeviceSize getUniformRange();
+    
+    /**
+     * Graph synchronising the pipelines. Pipelines add the images and buffers
+     * they share with other pipelines to it, at the latest in
+     * createRenderPass, and declare how they use them in declareResources.
+     * @return the frame graph of the current context, null before init
+     */
+    SME::FrameGraph* getFrameGraph();
+    
+    /**
+     * The swap chain images, or the offscreen targets when headless, as a
+     * frame graph resource. Passes writing it are never culled.
+     * @return the resource, valid once init has created the swap chain
+     */
+    SME::FrameGraph::Resource getSwapChainResource();
 }}
 
 #endif /* SME_RENDER_H */
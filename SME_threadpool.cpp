@@ -0,0 +1,78 @@
+#include "SME_threadpool.h"
+
+SME::ThreadPool::ThreadPool(uint32_t threadCount) : nextTask(0) {
+    if(threadCount == 0){
+        threadCount = std::thread::hardware_concurrency();
+        if(threadCount == 0){
+            threadCount = 1;
+        }
+    }
+
+    threads.reserve(threadCount);
+    for(uint32_t i = 0; i < threadCount; i++){
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+SME::ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for(std::thread &thread : threads){
+        thread.join();
+    }
+}
+
+void SME::ThreadPool::run(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task){
+    if(taskCount == 0){
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+    std::unique_lock<std::mutex> lock(mutex);
+    currentTask = &task;
+    this->taskCount = taskCount;
+    nextTask = 0;
+    busyThreads = static_cast<uint32_t>(threads.size());
+    generation++;
+    workAvailable.notify_all();
+
+    workDone.wait(lock, [this]{ return busyThreads == 0; });
+    currentTask = nullptr;
+}
+
+uint32_t SME::ThreadPool::getThreadCount(){
+    return static_cast<uint32_t>(threads.size());
+}
+
+void SME::ThreadPool::workerLoop(uint32_t threadIndex){
+    uint64_t lastGeneration = 0;
+
+    while(true){
+        const std::function<void(uint32_t, uint32_t)>* task;
+        uint32_t count;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workAvailable.wait(lock, [this, lastGeneration]{ return stopping || generation != lastGeneration; });
+            if(stopping){
+                return;
+            }
+            lastGeneration = generation;
+            task = currentTask;
+            count = taskCount;
+        }
+
+        for(uint32_t i = nextTask++; i < count; i = nextTask++){
+            (*task)(i, threadIndex);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyThreads--;
+        }
+        workDone.notify_one();
+    }
+}
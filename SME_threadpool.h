@@ -0,0 +1,56 @@
+#ifndef SME_THREADPOOL_H
+#define SME_THREADPOOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace SME {
+    class ThreadPool {
+    public:
+        /**
+         * Starts the worker threads. They sleep until work is handed to them
+         * through run.
+         * @param threadCount amount of worker threads, 0 to use one per core
+         */
+        ThreadPool(uint32_t threadCount);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /**
+         * Runs the given function once per task, spread across the worker
+         * threads, and returns once every task has finished. Tasks are handed
+         * out in increasing order, but may complete in any order.
+         * @param taskCount amount of tasks to run
+         * @param task function called with the task index and the index of the
+         * worker thread running it, which is always lower than getThreadCount()
+         */
+        void run(uint32_t taskCount, const std::function<void(uint32_t task, uint32_t thread)>& task);
+
+        uint32_t getThreadCount();
+    private:
+        void workerLoop(uint32_t threadIndex);
+
+        std::vector<std::thread> threads;
+        std::mutex runMutex; //only one batch of tasks may run at a time
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable workDone;
+
+        const std::function<void(uint32_t, uint32_t)>* currentTask = nullptr;
+        std::atomic<uint32_t> nextTask;
+        uint32_t taskCount = 0;
+        uint32_t busyThreads = 0;
+        uint64_t generation = 0;
+        bool stopping = false;
+    };
+}
+
+#endif /* SME_THREADPOOL_H */
+
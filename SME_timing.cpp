@@ -0,0 +1,30 @@
+#include "SME_timing.h"
+
+#include <algorithm>
+
+SME::Timing::Statistics SME::Timing::computeStatistics(std::vector<double> samples){
+    samples.erase(std::remove_if(samples.begin(), samples.end(), [](double sample){ return sample < 0.0; }), samples.end());
+
+    Statistics statistics = {0, 0.0, 0.0, 0.0, 0.0};
+    if(samples.empty()){
+        return statistics;
+    }
+
+    statistics.count = static_cast<uint32_t>(samples.size());
+    statistics.min = samples[0];
+    statistics.max = samples[0];
+    double total = 0.0;
+    for(double sample : samples){
+        statistics.min = std::min(statistics.min, sample);
+        statistics.max = std::max(statistics.max, sample);
+        total += sample;
+    }
+    statistics.average = total / samples.size();
+
+    //nearest rank, only a partial sort is needed
+    size_t rank = (samples.size() * 99 + 99) / 100 - 1;
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    statistics.p99 = samples[rank];
+
+    return statistics;
+}
@@ -0,0 +1,97 @@
+#ifndef SME_TIMING_H
+#define SME_TIMING_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#ifndef SME_TIMING_MAX_PIPELINES
+#define SME_TIMING_MAX_PIPELINES 16 //pipelines with individual gpu timings per frame
+#endif
+
+#ifndef SME_TIMING_HISTORY
+#define SME_TIMING_HISTORY 256 //frame timings buffered until they are polled
+#endif
+
+namespace SME { namespace Timing {
+
+    /**
+     * Timings of a single frame. All times are in microseconds, GPU times are
+     * negative if they couldn't be measured.
+     */
+    struct FrameTiming {
+        uint64_t frameNumber;
+        double frameTime;       //cpu time since the previous frame started
+        double fenceWaitTime;   //cpu stalled waiting for the gpu
+        double acquireTime;     //vkAcquireNextImageKHR
+        double recordTime;      //command buffer recording, 0 if prerecorded
+        double submitTime;      //vkQueueSubmit
+        double presentTime;     //vkQueuePresentKHR
+        double gpuTime;         //from the start of the first pipeline to the end of the last one
+        uint32_t pipelineCount;
+        double pipelineGpuTime[SME_TIMING_MAX_PIPELINES];
+    };
+
+    struct Statistics {
+        uint32_t count;
+        double min;
+        double average;
+        double p99;
+        double max;
+    };
+
+    /**
+     * Fixed size single producer, single consumer queue. One thread may push
+     * while another one pops without any locking.
+     */
+    template<typename T, uint32_t Capacity>
+    class RingBuffer {
+    public:
+        /**
+         * Adds an element to the queue, only to be called by the producer
+         * @param value the element to add
+         * @return false if the queue was full and the element was dropped
+         */
+        bool push(const T& value){
+            uint32_t currentHead = head.load(std::memory_order_relaxed);
+            uint32_t nextHead = (currentHead + 1) % Capacity;
+            if(nextHead == tail.load(std::memory_order_acquire)){
+                return false;
+            }
+            items[currentHead] = value;
+            head.store(nextHead, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Removes the oldest element of the queue, only to be called by the
+         * consumer
+         * @param value where to store the element
+         * @return false if the queue was empty
+         */
+        bool pop(T& value){
+            uint32_t currentTail = tail.load(std::memory_order_relaxed);
+            if(currentTail == head.load(std::memory_order_acquire)){
+                return false;
+            }
+            value = items[currentTail];
+            tail.store((currentTail + 1) % Capacity, std::memory_order_release);
+            return true;
+        }
+    private:
+        T items[Capacity];
+        std::atomic<uint32_t> head{0};
+        std::atomic<uint32_t> tail{0};
+    };
+
+    /**
+     * Computes the minimum, average, 99th percentile and maximum of the
+     * given samples. Negative samples (unmeasured) are ignored.
+     * @param samples the values to compute the statistics of
+     * @return the statistics, with a count of 0 if there were no samples
+     */
+    Statistics computeStatistics(std::vector<double> samples);
+}}
+
+#endif /* SME_TIMING_H */
+
@@ -0,0 +1,197 @@
+#include "SME_vertex.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SME_VERTEX_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace {
+#ifdef SME_VERTEX_SSE2
+    __m128 loadFloats(const char* source){
+        return _mm_loadu_ps(reinterpret_cast<const float*>(source));
+    }
+
+    __m128 clamp(__m128 value, float min, float max){
+        return _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(min)), _mm_set1_ps(max));
+    }
+
+    void store32(char* destination, __m128i value){
+        int32_t packed = _mm_cvtsi128_si32(value);
+        memcpy(destination, &packed, sizeof(packed));
+    }
+
+#ifndef __F16C__
+    //Fabian Giesen's float to half with round to nearest even, the halves end
+    //up sign extended in the 32 bit lanes so they survive a signed pack
+    __m128i floatToHalf(__m128 value){
+        const __m128i f16max = _mm_set1_epi32((127 + 16) << 23);
+        const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+        const __m128i subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+        const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+        __m128 sign = _mm_and_ps(value, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+        __m128 absolute = _mm_xor_ps(value, sign);
+        __m128i absoluteBits = _mm_castps_si128(absolute);
+
+        //infinity, or a quiet NaN
+        __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absolute, absolute));
+        __m128i special = _mm_or_si128(_mm_and_si128(isNaN, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+        //subnormal results are rounded by the float addition
+        __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absolute, _mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+
+        //normal results rebias the exponent and round the mantissa
+        __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absoluteBits, 31 - 13), 31);
+        __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absoluteBits, normalBias), mantissaOdd), 13);
+
+        __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absoluteBits);
+        __m128i isRegular = _mm_cmpgt_epi32(f16max, absoluteBits);
+        __m128i finite = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+        __m128i half = _mm_or_si128(_mm_and_si128(isRegular, finite), _mm_andnot_si128(isRegular, special));
+        return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+    }
+#endif
+#else
+    void readFloats(const char* source, float* values){
+        memcpy(values, source, 4 * sizeof(float));
+    }
+
+    float clamp(float value, float min, float max){
+        return std::min(std::max(value, min), max);
+    }
+
+    //scalar version of Fabian Giesen's float to half with round to nearest even
+    uint16_t floatToHalf(float value){
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        uint32_t half;
+        if(bits >= (127u + 16) << 23){
+            half = bits > 255u << 23 ? 0x7e00 : 0x7c00;
+        } else if(bits < (127u - 14) << 23){
+            const uint32_t magicBits = ((127u - 15) + (23 - 10) + 1) << 23;
+            float magic;
+            memcpy(&magic, &magicBits, sizeof(magic));
+            float absolute;
+            memcpy(&absolute, &bits, sizeof(absolute));
+            absolute += magic;
+            memcpy(&half, &absolute, sizeof(half));
+            half -= magicBits;
+        } else {
+            uint32_t mantissaOdd = (bits >> 13) & 1;
+            half = (bits + 0xfff + mantissaOdd - ((127u - 15) << 23)) >> 13;
+        }
+        return static_cast<uint16_t>(half | (sign >> 16));
+    }
+#endif
+}
+
+void SME::Vertex::Float32x4::convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count){
+    for(size_t i = 0; i < count; i++){
+        memcpy(destination, source, 16);
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
+
+void SME::Vertex::Float32x3::convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count){
+    for(size_t i = 0; i < count; i++){
+        memcpy(destination, source, 12);
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
+
+void SME::Vertex::Float16x4::convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count){
+    for(size_t i = 0; i < count; i++){
+#if defined(__F16C__)
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(destination), _mm_cvtps_ph(loadFloats(source), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(SME_VERTEX_SSE2)
+        __m128i half = floatToHalf(loadFloats(source));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(destination), _mm_packs_epi32(half, half));
+#else
+        float values[4];
+        readFloats(source, values);
+        uint16_t halves[4];
+        for(int j = 0; j < 4; j++){
+            halves[j] = floatToHalf(values[j]);
+        }
+        memcpy(destination, halves, sizeof(halves));
+#endif
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
+
+void SME::Vertex::Snorm16x4::convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count){
+    for(size_t i = 0; i < count; i++){
+#ifdef SME_VERTEX_SSE2
+        __m128i values = _mm_cvtps_epi32(_mm_mul_ps(clamp(loadFloats(source), -1.0f, 1.0f), _mm_set1_ps(32767.0f)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(destination), _mm_packs_epi32(values, values));
+#else
+        float values[4];
+        readFloats(source, values);
+        int16_t snorms[4];
+        for(int j = 0; j < 4; j++){
+            snorms[j] = static_cast<int16_t>(lrintf(clamp(values[j], -1.0f, 1.0f) * 32767.0f));
+        }
+        memcpy(destination, snorms, sizeof(snorms));
+#endif
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
+
+void SME::Vertex::Snorm10x3::convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count){
+    for(size_t i = 0; i < count; i++){
+        int32_t snorms[4];
+#ifdef SME_VERTEX_SSE2
+        __m128i values = _mm_cvtps_epi32(_mm_mul_ps(clamp(loadFloats(source), -1.0f, 1.0f), _mm_setr_ps(511.0f, 511.0f, 511.0f, 1.0f)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(snorms), values);
+#else
+        float values[4];
+        readFloats(source, values);
+        for(int j = 0; j < 4; j++){
+            snorms[j] = static_cast<int32_t>(lrintf(clamp(values[j], -1.0f, 1.0f) * (j < 3 ? 511.0f : 1.0f)));
+        }
+#endif
+        //x in the low bits, the two's complement fields are masked to width
+        uint32_t packed = (static_cast<uint32_t>(snorms[0]) & 0x3ff)
+                | (static_cast<uint32_t>(snorms[1]) & 0x3ff) << 10
+                | (static_cast<uint32_t>(snorms[2]) & 0x3ff) << 20
+                | (static_cast<uint32_t>(snorms[3]) & 0x3) << 30;
+        memcpy(destination, &packed, sizeof(packed));
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
+
+void SME::Vertex::Unorm8x4::convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count){
+    for(size_t i = 0; i < count; i++){
+#ifdef SME_VERTEX_SSE2
+        __m128i values = _mm_cvtps_epi32(_mm_mul_ps(clamp(loadFloats(source), 0.0f, 1.0f), _mm_set1_ps(255.0f)));
+        values = _mm_packs_epi32(values, values);
+        store32(destination, _mm_packus_epi16(values, values));
+#else
+        float values[4];
+        readFloats(source, values);
+        uint8_t unorms[4];
+        for(int j = 0; j < 4; j++){
+            unorms[j] = static_cast<uint8_t>(lrintf(clamp(values[j], 0.0f, 1.0f) * 255.0f));
+        }
+        memcpy(destination, unorms, sizeof(unorms));
+#endif
+        source += sourceStride;
+        destination += destinationStride;
+    }
+}
@@ -0,0 +1,175 @@
+#ifndef SME_VERTEX_H
+#define SME_VERTEX_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+namespace SME { namespace Vertex {
+
+    /*
+     * Attribute formats. Each one converts attributes from four floats per
+     * vertex (xyzw, rgba) with SSE2 where available. Three component source
+     * data must be padded to four floats.
+     */
+
+    /**
+     * Full precision, 16 bytes.
+     */
+    struct Float32x4 {
+        static const VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        static const uint32_t size = 16;
+        static void convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count);
+    };
+
+    /**
+     * Full precision without the fourth component, 12 bytes.
+     */
+    struct Float32x3 {
+        static const VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;
+        static const uint32_t size = 12;
+        static void convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count);
+    };
+
+    /**
+     * Half floats, 8 bytes. Enough for positions of most models, converted
+     * with round to nearest even.
+     */
+    struct Float16x4 {
+        static const VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        static const uint32_t size = 8;
+        static void convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count);
+    };
+
+    /**
+     * Signed normalised 16 bit integers, 8 bytes. Values are clamped to
+     * [-1, 1], positions must be scaled into that range.
+     */
+    struct Snorm16x4 {
+        static const VkFormat format = VK_FORMAT_R16G16B16A16_SNORM;
+        static const uint32_t size = 8;
+        static void convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count);
+    };
+
+    /**
+     * Signed normalised 10:10:10:2, 4 bytes, for normals and tangents. The
+     * fourth component only keeps its sign, like a tangent's handedness.
+     * Vertex buffer support for the format is optional, if rare to lack.
+     */
+    struct Snorm10x3 {
+        static const VkFormat format = VK_FORMAT_A2B10G10R10_SNORM_PACK32;
+        static const uint32_t size = 4;
+        static void convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count);
+    };
+
+    /**
+     * Unsigned normalised 8 bit integers, 4 bytes, for colors. Values are
+     * clamped to [0, 1].
+     */
+    struct Unorm8x4 {
+        static const VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+        static const uint32_t size = 4;
+        static void convert(const char* source, uint32_t sourceStride, char* destination, uint32_t destinationStride, size_t count);
+    };
+
+    template<uint32_t... Indices>
+    struct IndexSequence {};
+
+    template<uint32_t Count, uint32_t... Indices>
+    struct MakeIndexSequence : MakeIndexSequence<Count - 1, Count - 1, Indices...> {};
+
+    template<uint32_t... Indices>
+    struct MakeIndexSequence<0, Indices...> {
+        typedef IndexSequence<Indices...> Type;
+    };
+
+    template<typename... Formats>
+    struct LayoutSize;
+
+    template<>
+    struct LayoutSize<> {
+        static const uint32_t value = 0;
+    };
+
+    template<typename First, typename... Rest>
+    struct LayoutSize<First, Rest...> {
+        static const uint32_t value = First::size + LayoutSize<Rest...>::value;
+    };
+
+    //offset of the attribute at Index, the size of the ones before it
+    template<uint32_t Index, typename... Formats>
+    struct AttributeOffset;
+
+    template<typename First, typename... Rest>
+    struct AttributeOffset<0, First, Rest...> {
+        static const uint32_t value = 0;
+    };
+
+    template<uint32_t Index, typename First, typename... Rest>
+    struct AttributeOffset<Index, First, Rest...> {
+        static const uint32_t value = First::size + AttributeOffset<Index - 1, Rest...>::value;
+    };
+
+    /**
+     * Interleaved vertex layout with the given attribute formats, tightly
+     * packed in order. The Vulkan vertex input descriptions are worked out
+     * at compile time, so pipelines and the code filling the vertex buffers
+     * can't disagree on them, e.g.
+     * Layout<Float16x4, Snorm10x3, Unorm8x4> is 16 bytes per vertex.
+     */
+    template<typename... Formats>
+    class Layout {
+    public:
+        static const uint32_t attributeCount = sizeof...(Formats);
+        static const uint32_t stride = LayoutSize<Formats...>::value;
+
+        /**
+         * @param binding the binding the vertex buffer is bound to
+         * @return the per vertex binding description of the layout
+         */
+        static constexpr VkVertexInputBindingDescription getBinding(uint32_t binding = 0){
+            return {binding, stride, VK_VERTEX_INPUT_RATE_VERTEX};
+        }
+
+        /**
+         * @param binding the binding the vertex buffer is bound to
+         * @param firstLocation shader location of the first attribute, the
+         * others follow in order
+         * @return the attribute descriptions of the layout
+         */
+        static constexpr std::array<VkVertexInputAttributeDescription, sizeof...(Formats)> getAttributes(uint32_t binding = 0, uint32_t firstLocation = 0){
+            return getAttributes(binding, firstLocation, typename MakeIndexSequence<sizeof...(Formats)>::Type());
+        }
+
+        /**
+         * Converts float vertices to the layout. Converts one attribute at a
+         * time, so every conversion runs in a tight loop.
+         * @param source the first source vertex
+         * @param sourceStride bytes from one source vertex to the next
+         * @param sourceOffsets offset, within a source vertex, of the four
+         * floats of every attribute
+         * @param destination where to write the vertices, stride bytes each
+         * @param count amount of vertices to convert
+         */
+        static void convert(const void* source, uint32_t sourceStride, const uint32_t* sourceOffsets, void* destination, size_t count){
+            convert(static_cast<const char*>(source), sourceStride, sourceOffsets, static_cast<char*>(destination), count,
+                    typename MakeIndexSequence<sizeof...(Formats)>::Type());
+        }
+    private:
+        template<uint32_t... Indices>
+        static constexpr std::array<VkVertexInputAttributeDescription, sizeof...(Formats)> getAttributes(uint32_t binding, uint32_t firstLocation, IndexSequence<Indices...>){
+            return {{{firstLocation + Indices, binding, Formats::format, AttributeOffset<Indices, Formats...>::value}...}};
+        }
+
+        template<uint32_t... Indices>
+        static void convert(const char* source, uint32_t sourceStride, const uint32_t* sourceOffsets, char* destination, size_t count, IndexSequence<Indices...>){
+            int expand[] = {0, (Formats::convert(source + sourceOffsets[Indices], sourceStride,
+                    destination + AttributeOffset<Indices, Formats...>::value, stride, count), 0)...};
+            (void) expand;
+        }
+    };
+}}
+
+#endif /* SME_VERTEX_H */
+